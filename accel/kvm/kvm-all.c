@@ -68,6 +68,7 @@
 struct KVMParkedVcpu {
     unsigned long vcpu_id;
     int kvm_fd;
+    uint32_t kvm_fetch_index;
     QLIST_ENTRY(KVMParkedVcpu) node;
 };
 
@@ -81,7 +82,19 @@ struct KVMState
     int coalesced_mmio;
     int coalesced_pio;
     struct kvm_coalesced_mmio_ring *coalesced_mmio_ring;
-    bool coalesced_flush_in_progress;
+    /*
+     * Serializes the threads that drain the coalesced MMIO ring.  The
+     * lock only protects coalesced_mmio_busy, and is never held while
+     * dispatching a write; see kvm_coalesced_mmio_claim().
+     */
+    QemuMutex coalesced_mmio_lock;
+    QemuCond coalesced_mmio_cond;
+    bool coalesced_mmio_busy;
+    /* Polling period of the coalesced MMIO drain thread; 0 if disabled */
+    uint32_t coalesced_mmio_poll_us;
+    QemuThread coalesced_mmio_drain;
+    /* Set when a flush finds writes in the ring; wakes the drain thread */
+    QemuEvent coalesced_mmio_event;
     int vcpu_events;
     int robust_singlestep;
     int debugregs;
@@ -107,6 +120,20 @@ struct KVMState
     KVMMemoryListener memory_listener;
     QLIST_HEAD(, KVMParkedVcpu) kvm_parked_vcpus;
 
+    /* Listener of each address space id, to look up dirty ring slots */
+    int nr_as;
+    KVMMemoryListener **as_listeners;
+
+    /* Entries of each per-vCPU dirty ring; 0 when using dirty bitmaps */
+    uint32_t kvm_dirty_ring_size;
+    uint32_t kvm_dirty_ring_bytes;
+    QemuThread kvm_dirty_ring_reaper;
+    /* Slots with dirty logging enabled; the reaper sleeps while it is 0 */
+    int kvm_dirty_ring_slots;
+    QemuEvent kvm_dirty_ring_event;
+    /* KVM_GET_DIRTY_LOG does not write-protect, see kvm_log_clear() */
+    bool manual_dirty_log_protect;
+
     /* memory encryption */
     void *memcrypt_handle;
     int (*memcrypt_encrypt_data)(void *handle, uint8_t *ptr, uint64_t len);
@@ -165,6 +192,10 @@ int kvm_memcrypt_encrypt_data(uint8_t *ptr, uint64_t len)
     return 1;
 }
 
+#define kvm_slots_lock(kml)      qemu_mutex_lock(&(kml)->slots_lock)
+#define kvm_slots_unlock(kml)    qemu_mutex_unlock(&(kml)->slots_lock)
+
+/* Called with KVMMemoryListener.slots_lock held */
 static KVMSlot *kvm_get_free_slot(KVMMemoryListener *kml)
 {
     KVMState *s = kvm_state;
@@ -182,10 +213,16 @@ static KVMSlot *kvm_get_free_slot(KVMMemoryListener *kml)
 bool kvm_has_free_slot(MachineState *ms)
 {
     KVMState *s = KVM_STATE(ms->accelerator);
+    bool result;
+
+    kvm_slots_lock(&s->memory_listener);
+    result = kvm_get_free_slot(&s->memory_listener);
+    kvm_slots_unlock(&s->memory_listener);
 
-    return kvm_get_free_slot(&s->memory_listener);
+    return result;
 }
 
+/* Called with KVMMemoryListener.slots_lock held */
 static KVMSlot *kvm_alloc_slot(KVMMemoryListener *kml)
 {
     KVMSlot *slot = kvm_get_free_slot(kml);
@@ -198,6 +235,7 @@ static KVMSlot *kvm_alloc_slot(KVMMemoryListener *kml)
     abort();
 }
 
+/* Called with KVMMemoryListener.slots_lock held */
 static KVMSlot *kvm_lookup_matching_slot(KVMMemoryListener *kml,
                                          hwaddr start_addr,
                                          hwaddr size)
@@ -244,20 +282,25 @@ int kvm_physical_memory_addr_from_host(KVMState *s, void *ram,
                                        hwaddr *phys_addr)
 {
     KVMMemoryListener *kml = &s->memory_listener;
-    int i;
+    int i, ret = 0;
 
+    kvm_slots_lock(kml);
     for (i = 0; i < s->nr_slots; i++) {
         KVMSlot *mem = &kml->slots[i];
 
         if (ram >= mem->ram && ram < mem->ram + mem->memory_size) {
             *phys_addr = mem->start_addr + (ram - mem->ram);
-            return 1;
+            ret = 1;
+            break;
         }
     }
+    kvm_slots_unlock(kml);
 
-    return 0;
+    return ret;
 }
 
+static void kvm_dirty_ring_update_slot(KVMState *s, KVMSlot *slot);
+
 static int kvm_set_user_memory_region(KVMMemoryListener *kml, KVMSlot *slot, bool new)
 {
     KVMState *s = kvm_state;
@@ -278,11 +321,16 @@ static int kvm_set_user_memory_region(KVMMemoryListener *kml, KVMSlot *slot, boo
     mem.memory_size = slot->memory_size;
     ret = kvm_vm_ioctl(s, KVM_SET_USER_MEMORY_REGION, &mem);
     slot->old_flags = mem.flags;
+    if (s->kvm_dirty_ring_size && !ret) {
+        kvm_dirty_ring_update_slot(s, slot);
+    }
     trace_kvm_set_user_memory(mem.slot, mem.flags, mem.guest_phys_addr,
                               mem.memory_size, mem.userspace_addr, ret);
     return ret;
 }
 
+static void kvm_dirty_ring_reap(KVMState *s, CPUState *cpu);
+
 int kvm_destroy_vcpu(CPUState *cpu)
 {
     KVMState *s = kvm_state;
@@ -304,16 +352,28 @@ int kvm_destroy_vcpu(CPUState *cpu)
         goto err;
     }
 
+    if (cpu->kvm_dirty_gfns) {
+        kvm_dirty_ring_reap(s, cpu);
+        ret = munmap(cpu->kvm_dirty_gfns, s->kvm_dirty_ring_bytes);
+        if (ret < 0) {
+            goto err;
+        }
+        cpu->kvm_dirty_gfns = NULL;
+    }
+
     vcpu = g_malloc0(sizeof(*vcpu));
     vcpu->vcpu_id = kvm_arch_vcpu_id(cpu);
     vcpu->kvm_fd = cpu->kvm_fd;
+    /* The kernel keeps filling the ring from where we stopped harvesting */
+    vcpu->kvm_fetch_index = cpu->kvm_fetch_index;
     QLIST_INSERT_HEAD(&kvm_state->kvm_parked_vcpus, vcpu, node);
 err:
     return ret;
 }
 
-static int kvm_get_vcpu(KVMState *s, unsigned long vcpu_id)
+static int kvm_get_vcpu(KVMState *s, CPUState *cs)
 {
+    unsigned long vcpu_id = kvm_arch_vcpu_id(cs);
     struct KVMParkedVcpu *cpu;
 
     QLIST_FOREACH(cpu, &s->kvm_parked_vcpus, node) {
@@ -322,11 +382,13 @@ static int kvm_get_vcpu(KVMState *s, unsigned long vcpu_id)
 
             QLIST_REMOVE(cpu, node);
             kvm_fd = cpu->kvm_fd;
+            cs->kvm_fetch_index = cpu->kvm_fetch_index;
             g_free(cpu);
             return kvm_fd;
         }
     }
 
+    cs->kvm_fetch_index = 0;
     return kvm_vm_ioctl(s, KVM_CREATE_VCPU, (void *)vcpu_id);
 }
 
@@ -338,7 +400,7 @@ int kvm_init_vcpu(CPUState *cpu)
 
     DPRINTF("kvm_init_vcpu\n");
 
-    ret = kvm_get_vcpu(s, kvm_arch_vcpu_id(cpu));
+    ret = kvm_get_vcpu(s, cpu);
     if (ret < 0) {
         DPRINTF("kvm_create_vcpu failed\n");
         goto err;
@@ -364,8 +426,21 @@ int kvm_init_vcpu(CPUState *cpu)
     }
 
     if (s->coalesced_mmio && !s->coalesced_mmio_ring) {
-        s->coalesced_mmio_ring =
-            (void *)cpu->kvm_run + s->coalesced_mmio * PAGE_SIZE;
+        atomic_set(&s->coalesced_mmio_ring,
+                   (void *)cpu->kvm_run + s->coalesced_mmio * PAGE_SIZE);
+    }
+
+    if (s->kvm_dirty_ring_size) {
+        cpu->kvm_dirty_gfns = mmap(NULL, s->kvm_dirty_ring_bytes,
+                                   PROT_READ | PROT_WRITE, MAP_SHARED,
+                                   cpu->kvm_fd,
+                                   PAGE_SIZE * KVM_DIRTY_LOG_PAGE_OFFSET);
+        if (cpu->kvm_dirty_gfns == MAP_FAILED) {
+            cpu->kvm_dirty_gfns = NULL;
+            ret = -errno;
+            DPRINTF("mmap'ing vcpu dirty ring failed\n");
+            goto err;
+        }
     }
 
     ret = kvm_arch_init_vcpu(cpu);
@@ -435,7 +510,9 @@ static void kvm_log_start(MemoryListener *listener,
         return;
     }
 
+    kvm_slots_lock(kml);
     r = kvm_section_update_flags(kml, section);
+    kvm_slots_unlock(kml);
     if (r < 0) {
         abort();
     }
@@ -452,7 +529,9 @@ static void kvm_log_stop(MemoryListener *listener,
         return;
     }
 
+    kvm_slots_lock(kml);
     r = kvm_section_update_flags(kml, section);
+    kvm_slots_unlock(kml);
     if (r < 0) {
         abort();
     }
@@ -470,6 +549,195 @@ static int kvm_get_dirty_pages_log_range(MemoryRegionSection *section,
     return 0;
 }
 
+/*
+ * Dirty ring support.  Each vCPU has a ring where KVM pushes the pages
+ * that the vCPU dirtied.  The rings are harvested under the BQL, by a
+ * reaper thread, by log_sync and by vCPUs whose ring is full; harvested
+ * entries are recycled with KVM_RESET_DIRTY_RINGS.
+ */
+
+static void kvm_dirty_ring_mark_page(KVMState *s, uint32_t as_id,
+                                     uint32_t slot_id, uint64_t offset)
+{
+    KVMMemoryListener *kml;
+    KVMSlot *mem;
+
+    trace_kvm_dirty_ring_page(as_id, slot_id, offset);
+    if (as_id >= s->nr_as || !s->as_listeners[as_id]) {
+        return;
+    }
+    kml = s->as_listeners[as_id];
+    if (slot_id >= s->nr_slots) {
+        return;
+    }
+    mem = &kml->slots[slot_id];
+    /* The slot may have been removed since the page was dirtied */
+    if (offset >= mem->memory_size / getpagesize()) {
+        return;
+    }
+
+    cpu_physical_memory_set_dirty_range(mem->ram_start_offset +
+                                        offset * getpagesize(),
+                                        getpagesize(), DIRTY_CLIENTS_NOCODE);
+}
+
+static bool dirty_gfn_is_dirtied(struct kvm_dirty_gfn *gfn)
+{
+    return atomic_load_acquire(&gfn->flags) == KVM_DIRTY_GFN_F_DIRTY;
+}
+
+static void dirty_gfn_set_collected(struct kvm_dirty_gfn *gfn)
+{
+    atomic_store_release(&gfn->flags, KVM_DIRTY_GFN_F_RESET);
+}
+
+static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
+{
+    struct kvm_dirty_gfn *cur;
+    uint32_t ring_size = s->kvm_dirty_ring_size;
+    uint32_t count = 0;
+
+    for (;;) {
+        cur = &cpu->kvm_dirty_gfns[cpu->kvm_fetch_index & (ring_size - 1)];
+        if (!dirty_gfn_is_dirtied(cur)) {
+            break;
+        }
+        kvm_dirty_ring_mark_page(s, cur->slot >> 16, cur->slot & 0xffff,
+                                 cur->offset);
+        dirty_gfn_set_collected(cur);
+        cpu->kvm_fetch_index++;
+        count++;
+    }
+
+    return count;
+}
+
+/*
+ * Harvest the dirty ring of CPU, or of all vCPUs if CPU is NULL, into
+ * the dirty memory bitmaps.  Must be called with the BQL held.
+ */
+static void kvm_dirty_ring_reap(KVMState *s, CPUState *cpu)
+{
+    uint64_t total = 0;
+
+    if (cpu) {
+        if (cpu->kvm_dirty_gfns) {
+            total = kvm_dirty_ring_reap_one(s, cpu);
+        }
+    } else {
+        CPU_FOREACH(cpu) {
+            if (cpu->kvm_dirty_gfns) {
+                total += kvm_dirty_ring_reap_one(s, cpu);
+            }
+        }
+    }
+
+    if (total) {
+        int ret = kvm_vm_ioctl(s, KVM_RESET_DIRTY_RINGS);
+        if (ret < 0) {
+            error_report("KVM_RESET_DIRTY_RINGS failed: %s", strerror(-ret));
+            abort();
+        }
+    }
+    trace_kvm_dirty_ring_reap(total, cpu ? cpu->cpu_index : -1);
+}
+
+static void kvm_dirty_ring_kick_cpu(CPUState *cpu, run_on_cpu_data arg)
+{
+}
+
+/*
+ * Make every vCPU leave guest mode once.  Pages that the processor
+ * logged while the vCPU ran (e.g. in the PML buffer) only reach the
+ * dirty ring on the next exit.  Must be called with the BQL held, which
+ * run_on_cpu() drops while it waits.
+ */
+static void kvm_dirty_ring_kick_all(void)
+{
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        run_on_cpu(cpu, kvm_dirty_ring_kick_cpu, RUN_ON_CPU_NULL);
+    }
+}
+
+/*
+ * Track the slots that log dirty pages into the rings, and wake up the
+ * reaper when the first one appears.  Called with the slots lock of the
+ * slot's KVMMemoryListener held, so the count itself is atomic.
+ */
+static void kvm_dirty_ring_update_slot(KVMState *s, KVMSlot *slot)
+{
+    bool logging = slot->memory_size &&
+                   (slot->flags & KVM_MEM_LOG_DIRTY_PAGES);
+
+    if (logging == slot->dirty_ring_logging) {
+        return;
+    }
+    slot->dirty_ring_logging = logging;
+    if (!logging) {
+        atomic_dec(&s->kvm_dirty_ring_slots);
+    } else if (atomic_fetch_inc(&s->kvm_dirty_ring_slots) == 0) {
+        qemu_event_set(&s->kvm_dirty_ring_event);
+    }
+}
+
+/*
+ * Harvest the rings periodically, so that they do not fill up and
+ * dirty pages reach the bitmaps without waiting for the next log_sync.
+ * KVM only pushes pages of slots with dirty logging enabled, so the
+ * thread sleeps while there are none.
+ */
+static void *kvm_dirty_ring_reaper_thread(void *opaque)
+{
+    KVMState *s = opaque;
+
+    rcu_register_thread();
+    for (;;) {
+        qemu_event_reset(&s->kvm_dirty_ring_event);
+        if (!atomic_read(&s->kvm_dirty_ring_slots)) {
+            qemu_event_wait(&s->kvm_dirty_ring_event);
+            continue;
+        }
+        sleep(1);
+        qemu_mutex_lock_iothread();
+        kvm_dirty_ring_reap(s, NULL);
+        qemu_mutex_unlock_iothread();
+    }
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static int kvm_dirty_ring_init(KVMState *s)
+{
+    uint64_t ring_bytes = (uint64_t)s->kvm_dirty_ring_size *
+                          sizeof(struct kvm_dirty_gfn);
+    int max_bytes, ret;
+
+    max_bytes = kvm_vm_check_extension(s, KVM_CAP_DIRTY_LOG_RING);
+    if (max_bytes <= 0) {
+        error_report("KVM does not support dirty rings");
+        return -EINVAL;
+    }
+    if (ring_bytes > max_bytes) {
+        error_report("KVM dirty ring size %" PRIu32 " too big "
+                     "(maximum is %zu)", s->kvm_dirty_ring_size,
+                     max_bytes / sizeof(struct kvm_dirty_gfn));
+        return -EINVAL;
+    }
+
+    ret = kvm_vm_enable_cap(s, KVM_CAP_DIRTY_LOG_RING, 0, ring_bytes);
+    if (ret) {
+        error_report("Enabling of KVM dirty ring failed: %s",
+                     strerror(-ret));
+        return ret;
+    }
+
+    s->kvm_dirty_ring_bytes = ring_bytes;
+    qemu_event_init(&s->kvm_dirty_ring_event, false);
+    return 0;
+}
+
 #define ALIGN(x, y)  (((x)+(y)-1) & ~((y)-1))
 
 /**
@@ -480,6 +748,8 @@ static int kvm_get_dirty_pages_log_range(MemoryRegionSection *section,
  *
  * @start_add: start of logged region.
  * @end_addr: end of logged region.
+ *
+ * Called with KVMMemoryListener.slots_lock held.
  */
 static int kvm_physical_sync_dirty_bitmap(KVMMemoryListener *kml,
                                           MemoryRegionSection *section)
@@ -489,6 +759,16 @@ static int kvm_physical_sync_dirty_bitmap(KVMMemoryListener *kml,
     KVMSlot *mem;
     hwaddr start_addr, size;
 
+    if (s->kvm_dirty_ring_size) {
+        /*
+         * KVM_GET_DIRTY_LOG is not available with dirty rings.  This is
+         * only reached when a slot is removed, see kvm_log_sync_global()
+         * for log_sync.
+         */
+        kvm_dirty_ring_reap(s, NULL);
+        return 0;
+    }
+
     size = kvm_align_section(section, &start_addr);
     if (size) {
         mem = kvm_lookup_matching_slot(kml, start_addr, size);
@@ -511,22 +791,126 @@ static int kvm_physical_sync_dirty_bitmap(KVMMemoryListener *kml,
          */
         size = ALIGN(((mem->memory_size) >> TARGET_PAGE_BITS),
                      /*HOST_LONG_BITS*/ 64) / 8;
-        d.dirty_bitmap = g_malloc0(size);
+        if (s->manual_dirty_log_protect) {
+            /* Kept until kvm_log_clear() knows which pages to re-protect */
+            if (!mem->dirty_bmap) {
+                mem->dirty_bmap = g_malloc0(size);
+            }
+            d.dirty_bitmap = mem->dirty_bmap;
+        } else {
+            d.dirty_bitmap = g_malloc0(size);
+        }
 
         d.slot = mem->slot | (kml->as_id << 16);
         if (kvm_vm_ioctl(s, KVM_GET_DIRTY_LOG, &d) == -1) {
             DPRINTF("ioctl failed %d\n", errno);
-            g_free(d.dirty_bitmap);
+            if (!s->manual_dirty_log_protect) {
+                g_free(d.dirty_bitmap);
+            }
             return -1;
         }
 
         kvm_get_dirty_pages_log_range(section, d.dirty_bitmap);
-        g_free(d.dirty_bitmap);
+        if (!s->manual_dirty_log_protect) {
+            g_free(d.dirty_bitmap);
+        }
     }
 
     return 0;
 }
 
+/*
+ * With manual dirty log protect, KVM_GET_DIRTY_LOG leaves the dirty pages
+ * writable and their bits set in KVM.  Clear them, which write-protects
+ * the pages again, only for pages that the last KVM_GET_DIRTY_LOG
+ * returned: the others may have been dirtied since, and their state has
+ * not been fetched yet.
+ *
+ * Called with KVMMemoryListener.slots_lock held.
+ */
+static int kvm_log_clear_one_slot(KVMMemoryListener *kml, KVMSlot *mem,
+                                  uint64_t start, uint64_t size)
+{
+    KVMState *s = kvm_state;
+    uint64_t psize = getpagesize();
+    uint64_t npages = mem->memory_size / psize;
+    uint64_t first = (start - mem->start_addr) / psize;
+    uint64_t end = DIV_ROUND_UP(start + size - mem->start_addr, psize);
+    uint64_t bmap_first, bmap_end, i;
+    struct kvm_clear_dirty_log d = {};
+    unsigned long *bmap;
+    bool found = false;
+    int ret;
+
+    /* KVM wants the range aligned to 64 pages, except at the slot end */
+    bmap_first = QEMU_ALIGN_DOWN(first, 64);
+    bmap_end = MIN(QEMU_ALIGN_UP(end, 64), npages);
+    bmap = bitmap_new(QEMU_ALIGN_UP(bmap_end - bmap_first, 64));
+
+    for (i = find_next_bit(mem->dirty_bmap, end, first); i < end;
+         i = find_next_bit(mem->dirty_bmap, end, i + 1)) {
+        clear_bit(i, mem->dirty_bmap);
+        set_bit(i - bmap_first, bmap);
+        found = true;
+    }
+
+    ret = 0;
+    if (found) {
+        d.slot = mem->slot | (kml->as_id << 16);
+        d.first_page = bmap_first;
+        d.num_pages = bmap_end - bmap_first;
+        d.dirty_bitmap = bmap;
+        ret = kvm_vm_ioctl(s, KVM_CLEAR_DIRTY_LOG, &d);
+        if (ret < 0) {
+            error_report("%s: KVM_CLEAR_DIRTY_LOG failed, slot=%d, "
+                         "start=0x%"PRIx64", size=0x%"PRIx64", errno=%d",
+                         __func__, d.slot, (uint64_t)d.first_page,
+                         (uint64_t)d.num_pages, ret);
+        }
+    }
+
+    g_free(bmap);
+    return ret;
+}
+
+static void kvm_log_clear(MemoryListener *listener,
+                          MemoryRegionSection *section)
+{
+    KVMMemoryListener *kml = container_of(listener, KVMMemoryListener, listener);
+    KVMState *s = kvm_state;
+    uint64_t start, end, psize = getpagesize();
+    KVMSlot *mem;
+    int i;
+
+    /* Only whole host pages can be cleared; all of their target pages
+     * were reported dirty together, so rounding outwards is safe.
+     */
+    start = QEMU_ALIGN_DOWN(section->offset_within_address_space, psize);
+    end = QEMU_ALIGN_UP(section->offset_within_address_space +
+                        int128_get64(section->size), psize);
+
+    /* Slots may be removed concurrently under the BQL, which we lack */
+    kvm_slots_lock(kml);
+    for (i = 0; i < s->nr_slots; i++) {
+        uint64_t slot_start, slot_end;
+
+        mem = &kml->slots[i];
+        if (!mem->memory_size || !mem->dirty_bmap) {
+            continue;
+        }
+        slot_start = MAX(start, mem->start_addr);
+        slot_end = MIN(end, mem->start_addr + mem->memory_size);
+        if (slot_start >= slot_end) {
+            continue;
+        }
+        if (kvm_log_clear_one_slot(kml, mem, slot_start,
+                                   slot_end - slot_start) < 0) {
+            abort();
+        }
+    }
+    kvm_slots_unlock(kml);
+}
+
 static void kvm_coalesce_mmio_region(MemoryListener *listener,
                                      MemoryRegionSection *secion,
                                      hwaddr start, hwaddr size)
@@ -757,6 +1141,7 @@ kvm_check_extension_list(KVMState *s, const KVMCapabilityInfo *list)
     return NULL;
 }
 
+/* Called with KVMMemoryListener.slots_lock held */
 static void kvm_set_phys_mem(KVMMemoryListener *kml,
                              MemoryRegionSection *section, bool add)
 {
@@ -796,6 +1181,8 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
         }
 
         /* unregister the slot */
+        g_free(mem->dirty_bmap);
+        mem->dirty_bmap = NULL;
         mem->memory_size = 0;
         mem->flags = 0;
         err = kvm_set_user_memory_region(kml, mem, false);
@@ -812,6 +1199,9 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
     mem->memory_size = size;
     mem->start_addr = start_addr;
     mem->ram = ram;
+    mem->ram_start_offset = memory_region_get_ram_addr(mr) +
+                            section->offset_within_region +
+                            (start_addr - section->offset_within_address_space);
     mem->flags = kvm_mem_flags(mr);
 
     err = kvm_set_user_memory_region(kml, mem, true);
@@ -828,7 +1218,9 @@ static void kvm_region_add(MemoryListener *listener,
     KVMMemoryListener *kml = container_of(listener, KVMMemoryListener, listener);
 
     memory_region_ref(section->mr);
+    kvm_slots_lock(kml);
     kvm_set_phys_mem(kml, section, true);
+    kvm_slots_unlock(kml);
 }
 
 static void kvm_region_del(MemoryListener *listener,
@@ -836,7 +1228,9 @@ static void kvm_region_del(MemoryListener *listener,
 {
     KVMMemoryListener *kml = container_of(listener, KVMMemoryListener, listener);
 
+    kvm_slots_lock(kml);
     kvm_set_phys_mem(kml, section, false);
+    kvm_slots_unlock(kml);
     memory_region_unref(section->mr);
 }
 
@@ -846,12 +1240,26 @@ static void kvm_log_sync(MemoryListener *listener,
     KVMMemoryListener *kml = container_of(listener, KVMMemoryListener, listener);
     int r;
 
+    kvm_slots_lock(kml);
     r = kvm_physical_sync_dirty_bitmap(kml, section);
+    kvm_slots_unlock(kml);
     if (r < 0) {
         abort();
     }
 }
 
+/*
+ * With dirty rings, pages are not tracked per slot, and one harvest of
+ * all rings syncs every section of every address space at once.
+ */
+static void kvm_log_sync_global(MemoryListener *listener)
+{
+    KVMState *s = kvm_state;
+
+    kvm_dirty_ring_kick_all();
+    kvm_dirty_ring_reap(s, NULL);
+}
+
 static void kvm_mem_ioeventfd_add(MemoryListener *listener,
                                   MemoryRegionSection *section,
                                   bool match_data, uint64_t data,
@@ -926,8 +1334,12 @@ void kvm_memory_listener_register(KVMState *s, KVMMemoryListener *kml,
 {
     int i;
 
+    qemu_mutex_init(&kml->slots_lock);
     kml->slots = g_malloc0(s->nr_slots * sizeof(KVMSlot));
     kml->as_id = as_id;
+    if (as_id < s->nr_as) {
+        s->as_listeners[as_id] = kml;
+    }
 
     for (i = 0; i < s->nr_slots; i++) {
         kml->slots[i].slot = i;
@@ -937,7 +1349,15 @@ void kvm_memory_listener_register(KVMState *s, KVMMemoryListener *kml,
     kml->listener.region_del = kvm_region_del;
     kml->listener.log_start = kvm_log_start;
     kml->listener.log_stop = kvm_log_stop;
-    kml->listener.log_sync = kvm_log_sync;
+    if (!s->kvm_dirty_ring_size) {
+        kml->listener.log_sync = kvm_log_sync;
+    } else if (as_id == 0) {
+        /* The harvest covers all address spaces, register it only once */
+        kml->listener.log_sync_global = kvm_log_sync_global;
+    }
+    if (s->manual_dirty_log_protect) {
+        kml->listener.log_clear = kvm_log_clear;
+    }
     kml->listener.priority = 10;
 
     memory_listener_register(&kml->listener, as);
@@ -1658,9 +2078,40 @@ static int kvm_init(MachineState *ms)
         goto err;
     }
 
+    s->nr_as = kvm_check_extension(s, KVM_CAP_MULTI_ADDRESS_SPACE);
+    if (s->nr_as <= 1) {
+        s->nr_as = 1;
+    }
+    s->as_listeners = g_new0(KVMMemoryListener *, s->nr_as);
+
+    s->kvm_dirty_ring_size = machine_kvm_dirty_ring_size(ms);
+    if (s->kvm_dirty_ring_size) {
+        ret = kvm_dirty_ring_init(s);
+        if (ret < 0) {
+            goto err;
+        }
+    }
+
+    /* Dirty rings have their own way of re-arming dirty logging */
+    if (!s->kvm_dirty_ring_size &&
+        kvm_check_extension(s, KVM_CAP_MANUAL_DIRTY_LOG_PROTECT)) {
+        ret = kvm_vm_enable_cap(s, KVM_CAP_MANUAL_DIRTY_LOG_PROTECT, 0, 1);
+        if (ret) {
+            warn_report("Failed to enable manual dirty log protection: %s, "
+                        "falling back to write-protecting on every sync",
+                        strerror(-ret));
+        } else {
+            s->manual_dirty_log_protect = true;
+        }
+    }
+
     s->coalesced_mmio = kvm_check_extension(s, KVM_CAP_COALESCED_MMIO);
     s->coalesced_pio = s->coalesced_mmio &&
                        kvm_check_extension(s, KVM_CAP_COALESCED_PIO);
+    qemu_mutex_init(&s->coalesced_mmio_lock);
+    qemu_cond_init(&s->coalesced_mmio_cond);
+    qemu_event_init(&s->coalesced_mmio_event, false);
+    s->coalesced_mmio_poll_us = machine_kvm_coalesced_mmio_poll_us(ms);
 
 #ifdef KVM_CAP_VCPU_EVENTS
     s->vcpu_events = kvm_check_extension(s, KVM_CAP_VCPU_EVENTS);
@@ -1748,6 +2199,18 @@ static int kvm_init(MachineState *ms)
         qemu_balloon_inhibit(true);
     }
 
+    if (s->kvm_dirty_ring_size) {
+        qemu_thread_create(&s->kvm_dirty_ring_reaper, "kvm-reaper",
+                           kvm_dirty_ring_reaper_thread, s,
+                           QEMU_THREAD_DETACHED);
+    }
+
+    if (s->coalesced_mmio && s->coalesced_mmio_poll_us) {
+        qemu_thread_create(&s->coalesced_mmio_drain, "kvm-coalesced",
+                           kvm_coalesced_mmio_drain_thread, s,
+                           QEMU_THREAD_DETACHED);
+    }
+
     return 0;
 
 err:
@@ -1759,6 +2222,7 @@ err:
         close(s->fd);
     }
     g_free(s->memory_listener.slots);
+    g_free(s->as_listeners);
 
     return ret;
 }
@@ -1808,36 +2272,180 @@ static int kvm_handle_internal_error(CPUState *cpu, struct kvm_run *run)
     return -1;
 }
 
+/* Per thread, because a write done by the flush may flush again */
+static __thread bool coalesced_flush_in_progress;
+
+/*
+ * Become the only thread that drains the coalesced MMIO ring.  vCPUs
+ * drain it with the BQL held, the drain thread without it, so no lock
+ * may be held while the writes are dispatched: a write could need the
+ * BQL, or flush the ring again.
+ */
+static void kvm_coalesced_mmio_claim(KVMState *s)
+{
+    qemu_mutex_lock(&s->coalesced_mmio_lock);
+    while (s->coalesced_mmio_busy) {
+        qemu_cond_wait(&s->coalesced_mmio_cond, &s->coalesced_mmio_lock);
+    }
+    s->coalesced_mmio_busy = true;
+    qemu_mutex_unlock(&s->coalesced_mmio_lock);
+}
+
+static void kvm_coalesced_mmio_release(KVMState *s)
+{
+    qemu_mutex_lock(&s->coalesced_mmio_lock);
+    s->coalesced_mmio_busy = false;
+    qemu_cond_broadcast(&s->coalesced_mmio_cond);
+    qemu_mutex_unlock(&s->coalesced_mmio_lock);
+}
+
+static void kvm_coalesced_mmio_dispatch(struct kvm_coalesced_mmio *ent)
+{
+    if (ent->pio == 1) {
+        address_space_rw(&address_space_io, ent->phys_addr,
+                         MEMTXATTRS_UNSPECIFIED, ent->data,
+                         ent->len, true);
+    } else {
+        cpu_physical_memory_write(ent->phys_addr, ent->data, ent->len);
+    }
+}
+
 void kvm_flush_coalesced_mmio_buffer(void)
 {
     KVMState *s = kvm_state;
 
-    if (s->coalesced_flush_in_progress) {
+    if (coalesced_flush_in_progress) {
         return;
     }
 
-    s->coalesced_flush_in_progress = true;
+    coalesced_flush_in_progress = true;
 
     if (s->coalesced_mmio_ring) {
         struct kvm_coalesced_mmio_ring *ring = s->coalesced_mmio_ring;
+        bool drained = false;
+
+        kvm_coalesced_mmio_claim(s);
         while (ring->first != ring->last) {
-            struct kvm_coalesced_mmio *ent;
+            kvm_coalesced_mmio_dispatch(&ring->coalesced_mmio[ring->first]);
+            smp_wmb();
+            ring->first = (ring->first + 1) % KVM_COALESCED_MMIO_MAX;
+            drained = true;
+        }
+        kvm_coalesced_mmio_release(s);
 
-            ent = &ring->coalesced_mmio[ring->first];
+        /* The guest is using the ring: let the drain thread poll it */
+        if (drained && s->coalesced_mmio_poll_us) {
+            qemu_event_set(&s->coalesced_mmio_event);
+        }
+    }
 
-            if (ent->pio == 1) {
-                address_space_rw(&address_space_io, ent->phys_addr,
-                                 MEMTXATTRS_UNSPECIFIED, ent->data,
-                                 ent->len, true);
-            } else {
-                cpu_physical_memory_write(ent->phys_addr, ent->data, ent->len);
+    coalesced_flush_in_progress = false;
+}
+
+/*
+ * Dispatch the coalesced write ENT without the BQL, if its device allows
+ * it: the region must have opted out of global locking, must not want
+ * the ring to be flushed before it is accessed, and must take the whole
+ * write in one access.  The region is translated and written in a single
+ * RCU critical section, and written directly rather than through the
+ * address space, so that neither the BQL nor a flush of the ring is
+ * needed on the way.
+ *
+ * Such regions must not take the BQL in their write handler: a vCPU that
+ * flushes the ring holds it while waiting for the drain thread.  The drain
+ * thread never holds the BQL here, and a handler that returns with it
+ * held trips the assertion below.
+ *
+ * Returns whether ENT was dispatched.
+ */
+static bool kvm_coalesced_mmio_dispatch_unlocked(struct kvm_coalesced_mmio *ent)
+{
+    AddressSpace *as = ent->pio == 1 ? &address_space_io
+                                     : &address_space_memory;
+    hwaddr xlat, len = ent->len;
+    unsigned max_access_size;
+    MemoryRegion *mr;
+    bool ret = false;
+
+    assert(!qemu_mutex_iothread_locked());
+
+    rcu_read_lock();
+    mr = address_space_translate(as, ent->phys_addr, &xlat, &len, true,
+                                 MEMTXATTRS_UNSPECIFIED);
+    max_access_size = mr->ops->valid.max_access_size ?: 4;
+    if (!mr->global_locking && !mr->flush_coalesced_mmio &&
+        !memory_access_is_direct(mr, true) &&
+        len == ent->len && len <= max_access_size) {
+        memory_region_dispatch_write(mr, xlat, ldn_p(ent->data, len), len,
+                                     MEMTXATTRS_UNSPECIFIED);
+        assert(!qemu_mutex_iothread_locked());
+        ret = true;
+    }
+    rcu_read_unlock();
+    return ret;
+}
+
+/*
+ * Number of consecutive polls that find the ring empty before the drain
+ * thread stops polling.
+ */
+#define KVM_COALESCED_MMIO_IDLE_POLLS 100
+
+/*
+ * Drain the coalesced MMIO ring without waiting for a vCPU to need it.
+ * Writes to thread-safe devices are dispatched outside the BQL; when
+ * the oldest write needs the BQL, take it and flush the whole ring as
+ * a vCPU would, so that writes are still applied in order.
+ *
+ * The thread only polls while the guest uses the ring.  Once it has
+ * been empty for a while, the thread sleeps until a vCPU flush finds
+ * writes in it again.
+ */
+static void *kvm_coalesced_mmio_drain_thread(void *opaque)
+{
+    KVMState *s = opaque;
+    struct kvm_coalesced_mmio_ring *ring;
+    unsigned idle_polls = KVM_COALESCED_MMIO_IDLE_POLLS;
+    bool need_bql;
+
+    rcu_register_thread();
+    for (;;) {
+        if (idle_polls >= KVM_COALESCED_MMIO_IDLE_POLLS) {
+            qemu_event_reset(&s->coalesced_mmio_event);
+            qemu_event_wait(&s->coalesced_mmio_event);
+            idle_polls = 0;
+        }
+
+        g_usleep(s->coalesced_mmio_poll_us);
+
+        ring = atomic_read(&s->coalesced_mmio_ring);
+        if (!ring || atomic_read(&ring->first) == atomic_read(&ring->last)) {
+            idle_polls++;
+            continue;
+        }
+        idle_polls = 0;
+
+        need_bql = false;
+        kvm_coalesced_mmio_claim(s);
+        while (ring->first != ring->last) {
+            if (!kvm_coalesced_mmio_dispatch_unlocked(
+                    &ring->coalesced_mmio[ring->first])) {
+                need_bql = true;
+                break;
             }
             smp_wmb();
             ring->first = (ring->first + 1) % KVM_COALESCED_MMIO_MAX;
         }
-    }
+        kvm_coalesced_mmio_release(s);
 
-    s->coalesced_flush_in_progress = false;
+        if (need_bql) {
+            qemu_mutex_lock_iothread();
+            kvm_flush_coalesced_mmio_buffer();
+            qemu_mutex_unlock_iothread();
+        }
+    }
+    rcu_unregister_thread();
+    return NULL;
 }
 
 static void do_kvm_cpu_synchronize_state(CPUState *cpu, run_on_cpu_data arg)
@@ -2042,6 +2650,14 @@ int kvm_cpu_exec(CPUState *cpu)
             DPRINTF("irq_window_open\n");
             ret = EXCP_INTERRUPT;
             break;
+        case KVM_EXIT_DIRTY_RING_FULL:
+            /* Harvest our own ring; the kernel flushed it on exit */
+            trace_kvm_dirty_ring_full(cpu->cpu_index);
+            qemu_mutex_lock_iothread();
+            kvm_dirty_ring_reap(kvm_state, cpu);
+            qemu_mutex_unlock_iothread();
+            ret = 0;
+            break;
         case KVM_EXIT_SHUTDOWN:
             DPRINTF("shutdown\n");
             qemu_system_reset_request(SHUTDOWN_CAUSE_GUEST_RESET);
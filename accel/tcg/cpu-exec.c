@@ -266,6 +266,7 @@ void cpu_exec_step_atomic(CPUState *cpu)
 #ifndef CONFIG_SOFTMMU
         tcg_debug_assert(!have_mmap_lock());
 #endif
+        tb_gen_lock_reset();
         if (qemu_mutex_iothread_locked()) {
             qemu_mutex_unlock_iothread();
         }
@@ -324,6 +325,7 @@ TranslationBlock *tb_htable_lookup(CPUState *cpu, target_ulong pc,
                                    target_ulong cs_base, uint32_t flags,
                                    uint32_t cf_mask)
 {
+    TranslationBlock *tb, **slot;
     tb_page_addr_t phys_pc;
     struct tb_desc desc;
     uint32_t h;
@@ -340,7 +342,22 @@ TranslationBlock *tb_htable_lookup(CPUState *cpu, target_ulong pc,
     }
     desc.phys_page1 = phys_pc & TARGET_PAGE_MASK;
     h = tb_hash_func(phys_pc, pc, flags, cf_mask, *cpu->trace_dstate);
-    return qht_lookup_custom(&tb_ctx.htable, &desc, h, tb_lookup_cmp);
+
+    slot = &tb_ctx.jmp_cache[h & (TB_JMP_CACHE_L2_SIZE - 1)];
+    tb = atomic_rcu_read(slot);
+    if (likely(tb && tb_lookup_cmp(tb, &desc))) {
+        atomic_set(&tcg_ctx->tb_jmp_cache_l2_hits,
+                   tcg_ctx->tb_jmp_cache_l2_hits + 1);
+        return tb;
+    }
+    atomic_set(&tcg_ctx->tb_jmp_cache_l2_misses,
+               tcg_ctx->tb_jmp_cache_l2_misses + 1);
+
+    tb = qht_lookup_custom(&tb_ctx.htable, &desc, h, tb_lookup_cmp);
+    if (tb) {
+        atomic_rcu_set(slot, tb);
+    }
+    return tb;
 }
 
 void tb_set_jmp_target(TranslationBlock *tb, int n, uintptr_t addr)
@@ -699,6 +716,7 @@ int cpu_exec(CPUState *cpu)
 #ifndef CONFIG_SOFTMMU
         tcg_debug_assert(!have_mmap_lock());
 #endif
+        tb_gen_lock_reset();
         if (qemu_mutex_iothread_locked()) {
             qemu_mutex_unlock_iothread();
         }
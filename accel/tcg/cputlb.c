@@ -27,6 +27,7 @@
 #include "exec/cputlb.h"
 #include "exec/memory-internal.h"
 #include "exec/ram_addr.h"
+#include "exec/tb-hash.h"
 #include "tcg/tcg.h"
 #include "qemu/error-report.h"
 #include "exec/log.h"
@@ -288,6 +289,9 @@ static void tlb_flush_one_mmuidx_locked(CPUArchState *env, int mmu_idx)
     memset(env->tlb_v_table[mmu_idx], -1, sizeof(env->tlb_v_table[0]));
     env->tlb_d[mmu_idx].large_page_addr = -1;
     env->tlb_d[mmu_idx].large_page_mask = -1;
+    memset(env->tlb_d[mmu_idx].large_pages, 0,
+           sizeof(env->tlb_d[0].large_pages));
+    env->tlb_d[mmu_idx].lp_index = 0;
     env->tlb_d[mmu_idx].vindex = 0;
 }
 
@@ -420,11 +424,76 @@ static inline void tlb_flush_vtlb_page_locked(CPUArchState *env, int mmu_idx,
     }
 }
 
-static void tlb_flush_page_locked(CPUArchState *env, int midx,
-                                  target_ulong page)
+static inline bool tlb_hit_range(target_ulong tlb_addr, target_ulong addr,
+                                 target_ulong mask)
+{
+    return (tlb_addr & (mask | TLB_INVALID_MASK)) == addr;
+}
+
+static inline bool tlb_hit_range_anyprot(CPUTLBEntry *tlb_entry,
+                                         target_ulong addr, target_ulong mask)
+{
+    return tlb_hit_range(tlb_entry->addr_read, addr, mask) ||
+           tlb_hit_range(tlb_addr_write(tlb_entry), addr, mask) ||
+           tlb_hit_range(tlb_entry->addr_code, addr, mask);
+}
+
+/*
+ * Flush the entries of the large page @lp from the tlb of @midx.
+ * Each page can only be cached at its own index, so a large page with
+ * fewer pages than the tlb has entries is flushed page by page; only
+ * larger ones need a scan of the whole tlb.
+ * Called with tlb_c.lock held.
+ */
+static void tlb_flush_large_page_locked(CPUArchState *env, int midx,
+                                        CPUTLBLargePage *lp)
+{
+    target_ulong mask = ~(lp->size - 1);
+    target_ulong n_pages = lp->size >> TARGET_PAGE_BITS;
+    size_t i, n = tlb_n_entries(env, midx);
+
+    tlb_debug("flush large page midx %d (" TARGET_FMT_lx "/" TARGET_FMT_lx
+              ")\n", midx, lp->vaddr, lp->size);
+    if (n_pages <= n) {
+        for (i = 0; i < n_pages; i++) {
+            target_ulong page = lp->vaddr + (i << TARGET_PAGE_BITS);
+
+            if (tlb_flush_entry_locked(tlb_entry(env, midx, page), page)) {
+                tlb_n_used_entries_dec(env, midx);
+            }
+        }
+    } else {
+        for (i = 0; i < n; i++) {
+            CPUTLBEntry *te = &env->tlb_table[midx][i];
+
+            if (tlb_hit_range_anyprot(te, lp->vaddr, mask)) {
+                memset(te, -1, sizeof(*te));
+                tlb_n_used_entries_dec(env, midx);
+            }
+        }
+    }
+    for (i = 0; i < CPU_VTLB_SIZE; i++) {
+        CPUTLBEntry *te = &env->tlb_v_table[midx][i];
+
+        if (tlb_hit_range_anyprot(te, lp->vaddr, mask)) {
+            memset(te, -1, sizeof(*te));
+        }
+    }
+    lp->size = 0;
+}
+
+/*
+ * Flush @page from the tlb of @midx, except for the victim tlb.
+ * Return false if the whole tlb had to be flushed because of large
+ * pages, in which case the victim tlb is flushed as well.
+ */
+static bool tlb_flush_page_novtlb_locked(CPUArchState *env, int midx,
+                                         target_ulong page)
 {
     target_ulong lp_addr = env->tlb_d[midx].large_page_addr;
     target_ulong lp_mask = env->tlb_d[midx].large_page_mask;
+    CPUTLBDesc *desc = &env->tlb_d[midx];
+    int i;
 
     /* Check if we need to flush due to large pages.  */
     if ((page & lp_mask) == lp_addr) {
@@ -432,10 +501,26 @@ static void tlb_flush_page_locked(CPUArchState *env, int midx,
                   TARGET_FMT_lx "/" TARGET_FMT_lx ")\n",
                   midx, lp_addr, lp_mask);
         tlb_flush_one_mmuidx_locked(env, midx);
-    } else {
-        if (tlb_flush_entry_locked(tlb_entry(env, midx, page), page)) {
-            tlb_n_used_entries_dec(env, midx);
+        return false;
+    }
+
+    for (i = 0; i < CPU_TLB_LARGE_PAGES; i++) {
+        CPUTLBLargePage *lp = &desc->large_pages[i];
+
+        if (lp->size && (page & ~(lp->size - 1)) == lp->vaddr) {
+            tlb_flush_large_page_locked(env, midx, lp);
         }
+    }
+    if (tlb_flush_entry_locked(tlb_entry(env, midx, page), page)) {
+        tlb_n_used_entries_dec(env, midx);
+    }
+    return true;
+}
+
+static void tlb_flush_page_locked(CPUArchState *env, int midx,
+                                  target_ulong page)
+{
+    if (tlb_flush_page_novtlb_locked(env, midx, page)) {
         tlb_flush_vtlb_page_locked(env, midx, page);
     }
 }
@@ -537,6 +622,179 @@ void tlb_flush_page_all_cpus_synced(CPUState *src, target_ulong addr)
     tlb_flush_page_by_mmuidx_all_cpus_synced(src, addr, ALL_MMUIDX_BITS);
 }
 
+typedef struct TLBFlushRangeData {
+    target_ulong addr;
+    target_ulong len;
+    uint16_t idxmap;
+} TLBFlushRangeData;
+
+static inline bool tlb_hit_pages(target_ulong tlb_addr, target_ulong addr,
+                                 target_ulong len)
+{
+    return !(tlb_addr & TLB_INVALID_MASK) &&
+           (tlb_addr & TARGET_PAGE_MASK) - addr < len;
+}
+
+/* Called with tlb_c.lock held */
+static void tlb_flush_vtlb_pages_locked(CPUArchState *env, int mmu_idx,
+                                        target_ulong addr, target_ulong len)
+{
+    int k;
+
+    for (k = 0; k < CPU_VTLB_SIZE; k++) {
+        CPUTLBEntry *te = &env->tlb_v_table[mmu_idx][k];
+
+        if (tlb_hit_pages(te->addr_read, addr, len) ||
+            tlb_hit_pages(tlb_addr_write(te), addr, len) ||
+            tlb_hit_pages(te->addr_code, addr, len)) {
+            memset(te, -1, sizeof(*te));
+            tlb_n_used_entries_dec(env, mmu_idx);
+        }
+    }
+}
+
+/*
+ * Flush the @n_pages pages at @addr.  Each page is looked up at its own
+ * index, and the victim tlb is scanned once for the whole range.
+ */
+static void tlb_flush_range_by_mmuidx_locked(CPUArchState *env, int mmu_idx,
+                                             target_ulong addr,
+                                             target_ulong n_pages)
+{
+    target_ulong i;
+
+    /* Past the size of the TLB, a full flush is cheaper */
+    if (n_pages > tlb_n_entries(env, mmu_idx)) {
+        tlb_flush_one_mmuidx_locked(env, mmu_idx);
+        return;
+    }
+    for (i = 0; i < n_pages; i++) {
+        if (!tlb_flush_page_novtlb_locked(env, mmu_idx,
+                                          addr + (i << TARGET_PAGE_BITS))) {
+            return;
+        }
+    }
+    tlb_flush_vtlb_pages_locked(env, mmu_idx, addr,
+                                n_pages << TARGET_PAGE_BITS);
+}
+
+static void tlb_flush_range_by_mmuidx_work(CPUState *cpu,
+                                           const TLBFlushRangeData *d)
+{
+    CPUArchState *env = cpu->env_ptr;
+    target_ulong n_pages = d->len >> TARGET_PAGE_BITS;
+    target_ulong i;
+    int mmu_idx;
+
+    assert_cpu_is_self(cpu);
+
+    tlb_debug("range addr:" TARGET_FMT_lx " len:" TARGET_FMT_lx
+              " mmu_map:0x%" PRIx16 "\n", d->addr, d->len, d->idxmap);
+
+    qemu_spin_lock(&env->tlb_c.lock);
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        if (d->idxmap & (1 << mmu_idx)) {
+            tlb_flush_range_by_mmuidx_locked(env, mmu_idx, d->addr, n_pages);
+        }
+    }
+    qemu_spin_unlock(&env->tlb_c.lock);
+
+    /*
+     * Each page clears one slice of the jump cache; past the number of
+     * slices, clearing all of it is cheaper.
+     */
+    if (n_pages >= TB_JMP_CACHE_SIZE / TB_JMP_PAGE_SIZE) {
+        cpu_tb_jmp_cache_clear(cpu);
+    } else {
+        for (i = 0; i < n_pages; i++) {
+            tb_flush_jmp_cache(cpu, d->addr + (i << TARGET_PAGE_BITS));
+        }
+    }
+}
+
+static void tlb_flush_range_by_mmuidx_async_work(CPUState *cpu,
+                                                 run_on_cpu_data data)
+{
+    TLBFlushRangeData *d = data.host_ptr;
+
+    tlb_flush_range_by_mmuidx_work(cpu, d);
+    g_free(d);
+}
+
+static TLBFlushRangeData tlb_flush_range_data(target_ulong addr,
+                                              target_ulong len,
+                                              uint16_t idxmap)
+{
+    TLBFlushRangeData d;
+
+    d.addr = addr & TARGET_PAGE_MASK;
+    d.len = ((addr + len + TARGET_PAGE_SIZE - 1) & TARGET_PAGE_MASK) - d.addr;
+    d.idxmap = idxmap;
+    return d;
+}
+
+/* Queue the flush of @d on every vCPU but @src */
+static void tlb_flush_range_all_helper(CPUState *src,
+                                       const TLBFlushRangeData *d)
+{
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        if (cpu != src) {
+            async_run_on_cpu(cpu, tlb_flush_range_by_mmuidx_async_work,
+                             RUN_ON_CPU_HOST_PTR(g_memdup(d, sizeof(*d))));
+        }
+    }
+}
+
+void tlb_flush_range_by_mmuidx(CPUState *cpu, target_ulong addr,
+                               target_ulong len, uint16_t idxmap)
+{
+    TLBFlushRangeData d = tlb_flush_range_data(addr, len, idxmap);
+
+    if (d.len == 0) {
+        return;
+    }
+    if (!qemu_cpu_is_self(cpu)) {
+        async_run_on_cpu(cpu, tlb_flush_range_by_mmuidx_async_work,
+                         RUN_ON_CPU_HOST_PTR(g_memdup(&d, sizeof(d))));
+    } else {
+        tlb_flush_range_by_mmuidx_work(cpu, &d);
+    }
+}
+
+void tlb_flush_range(CPUState *cpu, target_ulong addr, target_ulong len)
+{
+    tlb_flush_range_by_mmuidx(cpu, addr, len, ALL_MMUIDX_BITS);
+}
+
+void tlb_flush_range_by_mmuidx_all_cpus(CPUState *src_cpu, target_ulong addr,
+                                        target_ulong len, uint16_t idxmap)
+{
+    TLBFlushRangeData d = tlb_flush_range_data(addr, len, idxmap);
+
+    if (d.len == 0) {
+        return;
+    }
+    tlb_flush_range_all_helper(src_cpu, &d);
+    tlb_flush_range_by_mmuidx_work(src_cpu, &d);
+}
+
+void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
+                                               target_ulong addr,
+                                               target_ulong len,
+                                               uint16_t idxmap)
+{
+    TLBFlushRangeData d = tlb_flush_range_data(addr, len, idxmap);
+
+    if (d.len == 0) {
+        return;
+    }
+    tlb_flush_range_all_helper(src_cpu, &d);
+    async_safe_run_on_cpu(src_cpu, tlb_flush_range_by_mmuidx_async_work,
+                          RUN_ON_CPU_HOST_PTR(g_memdup(&d, sizeof(d))));
+}
+
 /* update the TLBs so that writes to code in the virtual page 'addr'
    can be detected */
 void tlb_protect_code(ram_addr_t ram_addr)
@@ -662,8 +920,8 @@ void tlb_set_dirty(CPUState *cpu, target_ulong vaddr)
 
 /* Our TLB does not support large pages, so remember the area covered by
    large pages and trigger a full TLB flush if these are invalidated.  */
-static void tlb_add_large_page(CPUArchState *env, int mmu_idx,
-                               target_ulong vaddr, target_ulong size)
+static void tlb_add_large_page_region(CPUArchState *env, int mmu_idx,
+                                      target_ulong vaddr, target_ulong size)
 {
     target_ulong lp_addr = env->tlb_d[mmu_idx].large_page_addr;
     target_ulong lp_mask = ~(size - 1);
@@ -684,6 +942,36 @@ static void tlb_add_large_page(CPUArchState *env, int mmu_idx,
     env->tlb_d[mmu_idx].large_page_mask = lp_mask;
 }
 
+/*
+ * Remember the large page that contains @vaddr, so that its entries
+ * can be flushed without flushing the entire TLB.  Only the most recent
+ * large pages are remembered; older ones fall back to
+ * tlb_add_large_page_region().
+ */
+static void tlb_add_large_page(CPUArchState *env, int mmu_idx,
+                               target_ulong vaddr, target_ulong size)
+{
+    CPUTLBDesc *desc = &env->tlb_d[mmu_idx];
+    target_ulong lp_vaddr = vaddr & ~(size - 1);
+    CPUTLBLargePage *lp;
+    int i;
+
+    for (i = 0; i < CPU_TLB_LARGE_PAGES; i++) {
+        lp = &desc->large_pages[i];
+        if (lp->size == size && lp->vaddr == lp_vaddr) {
+            goto found;
+        }
+    }
+    lp = &desc->large_pages[desc->lp_index];
+    desc->lp_index = (desc->lp_index + 1) % CPU_TLB_LARGE_PAGES;
+    if (lp->size) {
+        tlb_add_large_page_region(env, mmu_idx, lp->vaddr, lp->size);
+    }
+ found:
+    lp->vaddr = lp_vaddr;
+    lp->size = size;
+}
+
 /* Add a new TLB entry. At most one entry for a given virtual address
  * is permitted. Only a single TARGET_PAGE_SIZE region is mapped, the
  * supplied size is only used by tlb_flush_page.
@@ -0,0 +1,395 @@
+/*
+ * plugin-gen.c - TCG-related bits of plugin infrastructure
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ *
+ * Plugins only see a translation block once it has been fully
+ * translated, because they need to know its instructions before they
+ * can decide which of them to instrument.  While translating, we thus
+ * only record where each instruction starts in the op stream, and
+ * where its guest memory accesses are.  Once the plugins have
+ * registered their callbacks, the code that implements them is
+ * generated at the end of the op stream and moved in place.
+ *
+ * That code needs TCG temps.  A temp that is free at the end of the TB
+ * may well hold a live value at the point where the code is moved to,
+ * e.g. the result of a qemu_ld that the translator frees later on.  So
+ * while translating, we also record which temps are free at each of
+ * those points, and the code for a point only allocates from that set.
+ */
+#include "qemu/osdep.h"
+#include "cpu.h"
+#include "tcg/tcg.h"
+#include "tcg/tcg-op.h"
+#include "exec/exec-all.h"
+#include "exec/helper-proto.h"
+#include "exec/translator.h"
+#include "exec/plugin-gen.h"
+
+#if TARGET_LONG_BITS == 32
+#define tcgv_tl_temp tcgv_i32_temp
+#define temp_tcgv_tl temp_tcgv_i32
+#else
+#define tcgv_tl_temp tcgv_i64_temp
+#define temp_tcgv_tl temp_tcgv_i64
+#endif
+
+void HELPER(plugin_vcpu_udata_cb)(uint32_t cpu_index, void *fn, void *udata)
+{
+    qemu_plugin_vcpu_udata_cb_t cb = fn;
+
+    cb(cpu_index, udata);
+}
+
+void HELPER(plugin_vcpu_mem_cb)(uint32_t cpu_index, uint32_t info,
+                                uint64_t vaddr, void *fn, void *udata)
+{
+    qemu_plugin_vcpu_mem_cb_t cb = fn;
+
+    cb(cpu_index, info, vaddr, udata);
+}
+
+#ifndef CONFIG_ATOMIC64
+static QemuSpin plugin_inline_lock;
+#endif
+
+void HELPER(plugin_inline_add_u64)(void *ptr, uint64_t imm)
+{
+#ifdef CONFIG_ATOMIC64
+    atomic_add((uint64_t *)ptr, imm);
+#else
+    qemu_spin_lock(&plugin_inline_lock);
+    *(uint64_t *)ptr += imm;
+    qemu_spin_unlock(&plugin_inline_lock);
+#endif
+}
+
+static qemu_plugin_meminfo_t plugin_meminfo(TCGMemOp memop, bool is_store)
+{
+    qemu_plugin_meminfo_t info = memop & MO_SIZE;
+
+    if (memop & MO_SIGN) {
+        info |= QEMU_PLUGIN_MEMINFO_SIGN;
+    }
+    if ((memop & MO_BSWAP) == MO_BE) {
+        info |= QEMU_PLUGIN_MEMINFO_BE;
+    }
+    if (is_store) {
+        info |= QEMU_PLUGIN_MEMINFO_STORE;
+    }
+    return info;
+}
+
+static TCGv_i32 gen_cpu_index(void)
+{
+    TCGv_i32 cpu_index = tcg_temp_new_i32();
+
+    tcg_gen_ld_i32(cpu_index, cpu_env,
+                   -ENV_OFFSET + offsetof(CPUState, cpu_index));
+    return cpu_index;
+}
+
+static void gen_inline_op(const struct qemu_plugin_dyn_cb *cb)
+{
+    TCGv_ptr ptr = tcg_const_ptr(cb->userp);
+    TCGv_i64 val = tcg_temp_new_i64();
+
+    switch (cb->inline_insn.op) {
+    case QEMU_PLUGIN_INLINE_ADD_U64:
+        if (tcg_ctx->tb_cflags & CF_PARALLEL) {
+            /* Other vCPUs may be updating the same counter */
+            tcg_gen_movi_i64(val, cb->inline_insn.imm);
+            gen_helper_plugin_inline_add_u64(ptr, val);
+        } else {
+            tcg_gen_ld_i64(val, ptr, 0);
+            tcg_gen_addi_i64(val, val, cb->inline_insn.imm);
+            tcg_gen_st_i64(val, ptr, 0);
+        }
+        break;
+    default:
+        g_assert_not_reached();
+    }
+    tcg_temp_free_i64(val);
+    tcg_temp_free_ptr(ptr);
+}
+
+static void gen_udata_cb(const struct qemu_plugin_dyn_cb *cb)
+{
+    TCGv_i32 cpu_index = gen_cpu_index();
+    TCGv_ptr fn = tcg_const_ptr(cb->f.vcpu_udata);
+    TCGv_ptr udata = tcg_const_ptr(cb->userp);
+
+    gen_helper_plugin_vcpu_udata_cb(cpu_index, fn, udata);
+    tcg_temp_free_ptr(udata);
+    tcg_temp_free_ptr(fn);
+    tcg_temp_free_i32(cpu_index);
+}
+
+static void gen_exec_cbs(GArray *cbs)
+{
+    guint i;
+
+    for (i = 0; i < cbs->len; i++) {
+        struct qemu_plugin_dyn_cb *cb =
+            &g_array_index(cbs, struct qemu_plugin_dyn_cb, i);
+
+        if (cb->type == PLUGIN_CB_INLINE) {
+            gen_inline_op(cb);
+        } else {
+            gen_udata_cb(cb);
+        }
+    }
+}
+
+static bool mem_cb_matches(const struct qemu_plugin_dyn_cb *cb,
+                           qemu_plugin_meminfo_t info)
+{
+    if (info & QEMU_PLUGIN_MEMINFO_STORE) {
+        return cb->rw & QEMU_PLUGIN_MEM_W;
+    }
+    return cb->rw & QEMU_PLUGIN_MEM_R;
+}
+
+static void gen_mem_cbs(GArray *cbs, const struct qemu_plugin_mem_site *site)
+{
+    TCGv_i64 vaddr = tcg_temp_new_i64();
+    guint i;
+
+    tcg_gen_extu_tl_i64(vaddr, temp_tcgv_tl(site->vaddr));
+    for (i = 0; i < cbs->len; i++) {
+        struct qemu_plugin_dyn_cb *cb =
+            &g_array_index(cbs, struct qemu_plugin_dyn_cb, i);
+        TCGv_i32 cpu_index, info;
+        TCGv_ptr fn, udata;
+
+        if (!mem_cb_matches(cb, site->info)) {
+            continue;
+        }
+        if (cb->type == PLUGIN_CB_INLINE) {
+            gen_inline_op(cb);
+            continue;
+        }
+        cpu_index = gen_cpu_index();
+        info = tcg_const_i32(site->info);
+        fn = tcg_const_ptr(cb->f.vcpu_mem);
+        udata = tcg_const_ptr(cb->userp);
+        gen_helper_plugin_vcpu_mem_cb(cpu_index, info, vaddr, fn, udata);
+        tcg_temp_free_ptr(udata);
+        tcg_temp_free_ptr(fn);
+        tcg_temp_free_i32(info);
+        tcg_temp_free_i32(cpu_index);
+    }
+    tcg_temp_free_i64(vaddr);
+}
+
+/*
+ * The temps that are free at an instrumentation point.  Callbacks only
+ * allocate non-local i32, i64 and ptr temps.
+ */
+typedef struct PluginFreeTemps {
+    TCGTempSet i32;
+    TCGTempSet i64;
+} PluginFreeTemps;
+
+/* Record the temps that are free now, and return the index of the record */
+static unsigned plugin_save_free_temps(void)
+{
+    GArray *free_temps = tcg_ctx->plugin_tb->free_temps;
+    PluginFreeTemps *ft;
+
+    g_array_set_size(free_temps, free_temps->len + 1);
+    ft = &g_array_index(free_temps, PluginFreeTemps, free_temps->len - 1);
+    ft->i32 = tcg_ctx->free_temps[TCG_TYPE_I32];
+    ft->i64 = tcg_ctx->free_temps[TCG_TYPE_I64];
+    return free_temps->len - 1;
+}
+
+/*
+ * Make the temps that were free at the instrumentation point @idx the
+ * only ones available for allocation, and save the current set in @save.
+ * Temps that do not exist yet are created as usual.
+ */
+static void plugin_use_free_temps(unsigned idx, PluginFreeTemps *save)
+{
+    PluginFreeTemps *ft = &g_array_index(tcg_ctx->plugin_tb->free_temps,
+                                         PluginFreeTemps, idx);
+
+    save->i32 = tcg_ctx->free_temps[TCG_TYPE_I32];
+    save->i64 = tcg_ctx->free_temps[TCG_TYPE_I64];
+    tcg_ctx->free_temps[TCG_TYPE_I32] = ft->i32;
+    tcg_ctx->free_temps[TCG_TYPE_I64] = ft->i64;
+}
+
+static void plugin_restore_free_temps(const PluginFreeTemps *save)
+{
+    tcg_ctx->free_temps[TCG_TYPE_I32] = save->i32;
+    tcg_ctx->free_temps[TCG_TYPE_I64] = save->i64;
+}
+
+/* Move the ops that were emitted after @last so that they follow @dest. */
+static void plugin_move_ops(TCGOp *last, TCGOp *dest)
+{
+    TCGOp *op;
+
+    if (last == dest) {
+        return;
+    }
+    while ((op = QTAILQ_NEXT(last, link)) != NULL) {
+        QTAILQ_REMOVE(&tcg_ctx->ops, op, link);
+        QTAILQ_INSERT_AFTER(&tcg_ctx->ops, dest, op, link);
+        dest = op;
+    }
+}
+
+static void plugin_inject_exec_cbs(GArray *cbs, TCGOp *dest,
+                                   unsigned free_temps)
+{
+    PluginFreeTemps save;
+    TCGOp *last = tcg_last_op();
+
+    plugin_use_free_temps(free_temps, &save);
+    gen_exec_cbs(cbs);
+    plugin_restore_free_temps(&save);
+    plugin_move_ops(last, dest);
+}
+
+static void plugin_inject_insn(struct qemu_plugin_insn *insn)
+{
+    PluginFreeTemps save;
+    TCGOp *last;
+    guint i;
+
+    if (insn->exec_cbs->len) {
+        plugin_inject_exec_cbs(insn->exec_cbs, insn->start_op,
+                               insn->free_temps);
+    }
+    if (insn->mem_cbs->len) {
+        /*
+         * Go backwards, so that the callbacks of several accesses done by
+         * the same op (atomic read-modify-write helpers) end up in order.
+         */
+        for (i = insn->mem_sites->len; i-- > 0; ) {
+            struct qemu_plugin_mem_site *site =
+                &g_array_index(insn->mem_sites, struct qemu_plugin_mem_site, i);
+
+            last = tcg_last_op();
+            plugin_use_free_temps(site->free_temps, &save);
+            gen_mem_cbs(insn->mem_cbs, site);
+            plugin_restore_free_temps(&save);
+            plugin_move_ops(last, site->op);
+        }
+    }
+}
+
+bool plugin_gen_tb_start(CPUState *cpu, const TranslationBlock *tb)
+{
+    struct qemu_plugin_tb *ptb;
+
+    if (!qemu_plugin_tb_trans_enabled()) {
+        return false;
+    }
+    ptb = tcg_ctx->plugin_tb;
+    if (ptb == NULL) {
+        ptb = g_new0(struct qemu_plugin_tb, 1);
+        ptb->insns = g_ptr_array_new();
+        ptb->exec_cbs = g_array_new(false, false,
+                                    sizeof(struct qemu_plugin_dyn_cb));
+        ptb->free_temps = g_array_new(false, false, sizeof(PluginFreeTemps));
+        tcg_ctx->plugin_tb = ptb;
+    }
+    ptb->n = 0;
+    ptb->vaddr = tb->pc;
+    g_array_set_size(ptb->exec_cbs, 0);
+    g_array_set_size(ptb->free_temps, 0);
+    tcg_ctx->plugin_insn = NULL;
+    return true;
+}
+
+void plugin_gen_insn_start(CPUState *cpu, const DisasContextBase *db)
+{
+    struct qemu_plugin_insn *insn;
+
+    insn = qemu_plugin_tb_insn_get(tcg_ctx->plugin_tb);
+    insn->vaddr = db->pc_next;
+    insn->start_op = tcg_last_op();
+    insn->free_temps = plugin_save_free_temps();
+    tcg_ctx->plugin_insn = insn;
+}
+
+void plugin_gen_insn_end(void)
+{
+    tcg_ctx->plugin_insn = NULL;
+}
+
+void plugin_gen_tb_end(CPUState *cpu, const DisasContextBase *db)
+{
+    struct qemu_plugin_tb *ptb = tcg_ctx->plugin_tb;
+    struct qemu_plugin_insn *insn;
+    size_t i;
+
+    tcg_ctx->plugin_insn = NULL;
+    if (ptb->n == 0) {
+        return;
+    }
+
+    /* The instructions of a TB are contiguous in guest memory */
+    for (i = 0; i < ptb->n; i++) {
+        uint64_t end = db->pc_next;
+
+        insn = g_ptr_array_index(ptb->insns, i);
+        if (i + 1 < ptb->n) {
+            struct qemu_plugin_insn *next;
+
+            next = g_ptr_array_index(ptb->insns, i + 1);
+            end = next->vaddr;
+        }
+        insn->size = end - insn->vaddr;
+    }
+
+    qemu_plugin_tb_trans_cb(ptb);
+
+    for (i = 0; i < ptb->n; i++) {
+        plugin_inject_insn(g_ptr_array_index(ptb->insns, i));
+    }
+    /* TB callbacks go in front of those of the first instruction */
+    if (ptb->exec_cbs->len) {
+        insn = g_ptr_array_index(ptb->insns, 0);
+        plugin_inject_exec_cbs(ptb->exec_cbs, insn->start_op,
+                               insn->free_temps);
+    }
+}
+
+/*
+ * The address of a guest memory access may be overwritten by the access
+ * itself, e.g. for a load into the address register.  When translating
+ * for plugins, keep a copy of it for the memory callbacks; the copy is
+ * dead, and removed by the liveness pass, if no plugin asks for it.
+ */
+TCGv plugin_prep_mem_callbacks(TCGv vaddr)
+{
+    TCGv copy;
+
+    if (tcg_ctx->plugin_insn == NULL) {
+        return NULL;
+    }
+    copy = tcg_temp_new();
+    tcg_gen_mov_tl(copy, vaddr);
+    return copy;
+}
+
+/* Must be called right after the qemu_ld/qemu_st op has been emitted. */
+void plugin_gen_mem_callbacks(TCGv vaddr, TCGMemOp memop, bool is_store)
+{
+    struct qemu_plugin_mem_site site;
+
+    if (vaddr == NULL) {
+        return;
+    }
+    site.op = tcg_last_op();
+    site.vaddr = tcgv_tl_temp(vaddr);
+    site.info = plugin_meminfo(memop, is_store);
+    site.free_temps = plugin_save_free_temps();
+    g_array_append_val(tcg_ctx->plugin_insn->mem_sites, site);
+    tcg_temp_free(vaddr);
+}
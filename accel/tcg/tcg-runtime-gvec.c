@@ -78,12 +78,190 @@ static inline void clear_high(void *d, intptr_t oprsz, uint32_t desc)
     }
 }
 
+/*
+ * On x86 hosts that support AVX2, the most common helpers process the
+ * bulk of their operands 32 bytes at a time, leaving any 16-byte tail
+ * to the generic loop.  The selection is done at runtime, so that the
+ * same binary runs on hosts without AVX2.
+ *
+ * GVEC_AVX2 returns the number of bytes processed by the AVX2 version
+ * of the helper, i.e. the offset at which the generic loop must start.
+ */
+#ifdef CONFIG_AVX2_OPT
+#include "qemu/cpuid.h"
+
+static bool gvec_have_avx2;
+
+static void __attribute__((constructor)) gvec_init_avx2(void)
+{
+    int max = __get_cpuid_max(0, NULL);
+    int a, b, c, d;
+
+    if (max >= 7) {
+        __cpuid(1, a, b, c, d);
+        /* We must check that AVX is not just available, but usable.  */
+        if ((c & bit_OSXSAVE) && (c & bit_AVX)) {
+            int bv;
+            __asm("xgetbv" : "=a"(bv), "=d"(d) : "c"(0));
+            __cpuid_count(7, 0, a, b, c, d);
+            gvec_have_avx2 = (bv & 6) == 6 && (b & bit_AVX2);
+        }
+    }
+}
+
+#define GVEC_AVX2(NAME, ...) \
+    (gvec_have_avx2 && oprsz >= 32 ? NAME##_avx2(__VA_ARGS__) : 0)
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include <immintrin.h>
+
+/*
+ * The operands are only guaranteed to be 16-byte aligned; lowering the
+ * alignment of the types makes the compiler use unaligned accesses.
+ */
+typedef uint8_t vec8_256 __attribute__((vector_size(32), aligned(16)));
+typedef uint16_t vec16_256 __attribute__((vector_size(32), aligned(16)));
+typedef uint32_t vec32_256 __attribute__((vector_size(32), aligned(16)));
+typedef uint64_t vec64_256 __attribute__((vector_size(32), aligned(16)));
+
+typedef int8_t svec8_256 __attribute__((vector_size(32), aligned(16)));
+typedef int16_t svec16_256 __attribute__((vector_size(32), aligned(16)));
+typedef int32_t svec32_256 __attribute__((vector_size(32), aligned(16)));
+typedef int64_t svec64_256 __attribute__((vector_size(32), aligned(16)));
+
+#define DO_AVX2_3(NAME, TYPE, EXPR)                                       \
+static intptr_t NAME##_avx2(void *d, void *a, void *b, intptr_t oprsz)    \
+{                                                                         \
+    intptr_t i;                                                           \
+    for (i = 0; i + 32 <= oprsz; i += 32) {                               \
+        TYPE aa = *(TYPE *)(a + i);                                       \
+        TYPE bb = *(TYPE *)(b + i);                                       \
+        *(TYPE *)(d + i) = (TYPE)(EXPR);                                  \
+    }                                                                     \
+    return i;                                                             \
+}
+
+#define DO_AVX2_SHI(NAME, TYPE, OP)                                       \
+static intptr_t NAME##_avx2(void *d, void *a, intptr_t oprsz, int shift)  \
+{                                                                         \
+    intptr_t i;                                                           \
+    for (i = 0; i + 32 <= oprsz; i += 32) {                               \
+        *(TYPE *)(d + i) = *(TYPE *)(a + i) OP shift;                     \
+    }                                                                     \
+    return i;                                                             \
+}
+
+#define DO_AVX2_INTRIN(NAME, FN)                                          \
+static intptr_t NAME##_avx2(void *d, void *a, void *b, intptr_t oprsz)    \
+{                                                                         \
+    intptr_t i;                                                           \
+    for (i = 0; i + 32 <= oprsz; i += 32) {                               \
+        __m256i aa = _mm256_loadu_si256(a + i);                           \
+        __m256i bb = _mm256_loadu_si256(b + i);                           \
+        _mm256_storeu_si256(d + i, FN(aa, bb));                           \
+    }                                                                     \
+    return i;                                                             \
+}
+
+DO_AVX2_3(gvec_add8, vec8_256, aa + bb)
+DO_AVX2_3(gvec_add16, vec16_256, aa + bb)
+DO_AVX2_3(gvec_add32, vec32_256, aa + bb)
+DO_AVX2_3(gvec_add64, vec64_256, aa + bb)
+DO_AVX2_3(gvec_sub8, vec8_256, aa - bb)
+DO_AVX2_3(gvec_sub16, vec16_256, aa - bb)
+DO_AVX2_3(gvec_sub32, vec32_256, aa - bb)
+DO_AVX2_3(gvec_sub64, vec64_256, aa - bb)
+DO_AVX2_3(gvec_mul16, vec16_256, aa * bb)
+DO_AVX2_3(gvec_mul32, vec32_256, aa * bb)
+
+DO_AVX2_3(gvec_and, vec64_256, aa & bb)
+DO_AVX2_3(gvec_or, vec64_256, aa | bb)
+DO_AVX2_3(gvec_xor, vec64_256, aa ^ bb)
+DO_AVX2_3(gvec_andc, vec64_256, aa &~ bb)
+DO_AVX2_3(gvec_orc, vec64_256, aa |~ bb)
+DO_AVX2_3(gvec_nand, vec64_256, ~(aa & bb))
+DO_AVX2_3(gvec_nor, vec64_256, ~(aa | bb))
+DO_AVX2_3(gvec_eqv, vec64_256, ~(aa ^ bb))
+
+/* AVX2 has no 8-bit shifts, nor a 64-bit arithmetic right shift.  */
+DO_AVX2_SHI(gvec_shl16i, vec16_256, <<)
+DO_AVX2_SHI(gvec_shl32i, vec32_256, <<)
+DO_AVX2_SHI(gvec_shl64i, vec64_256, <<)
+DO_AVX2_SHI(gvec_shr16i, vec16_256, >>)
+DO_AVX2_SHI(gvec_shr32i, vec32_256, >>)
+DO_AVX2_SHI(gvec_shr64i, vec64_256, >>)
+DO_AVX2_SHI(gvec_sar16i, svec16_256, >>)
+DO_AVX2_SHI(gvec_sar32i, svec32_256, >>)
+
+#define DO_AVX2_CMP(SZ) \
+    DO_AVX2_3(gvec_eq##SZ, vec##SZ##_256, aa == bb)    \
+    DO_AVX2_3(gvec_ne##SZ, vec##SZ##_256, aa != bb)    \
+    DO_AVX2_3(gvec_lt##SZ, svec##SZ##_256, aa < bb)    \
+    DO_AVX2_3(gvec_le##SZ, svec##SZ##_256, aa <= bb)   \
+    DO_AVX2_3(gvec_ltu##SZ, vec##SZ##_256, aa < bb)    \
+    DO_AVX2_3(gvec_leu##SZ, vec##SZ##_256, aa <= bb)
+
+DO_AVX2_CMP(8)
+DO_AVX2_CMP(16)
+DO_AVX2_CMP(32)
+DO_AVX2_CMP(64)
+
+DO_AVX2_INTRIN(gvec_ssadd8, _mm256_adds_epi8)
+DO_AVX2_INTRIN(gvec_ssadd16, _mm256_adds_epi16)
+DO_AVX2_INTRIN(gvec_sssub8, _mm256_subs_epi8)
+DO_AVX2_INTRIN(gvec_sssub16, _mm256_subs_epi16)
+DO_AVX2_INTRIN(gvec_usadd8, _mm256_adds_epu8)
+DO_AVX2_INTRIN(gvec_usadd16, _mm256_adds_epu16)
+DO_AVX2_INTRIN(gvec_ussub8, _mm256_subs_epu8)
+DO_AVX2_INTRIN(gvec_ussub16, _mm256_subs_epu16)
+
+DO_AVX2_INTRIN(gvec_smin8, _mm256_min_epi8)
+DO_AVX2_INTRIN(gvec_smin16, _mm256_min_epi16)
+DO_AVX2_INTRIN(gvec_smin32, _mm256_min_epi32)
+DO_AVX2_INTRIN(gvec_smax8, _mm256_max_epi8)
+DO_AVX2_INTRIN(gvec_smax16, _mm256_max_epi16)
+DO_AVX2_INTRIN(gvec_smax32, _mm256_max_epi32)
+DO_AVX2_INTRIN(gvec_umin8, _mm256_min_epu8)
+DO_AVX2_INTRIN(gvec_umin16, _mm256_min_epu16)
+DO_AVX2_INTRIN(gvec_umin32, _mm256_min_epu32)
+DO_AVX2_INTRIN(gvec_umax8, _mm256_max_epu8)
+DO_AVX2_INTRIN(gvec_umax16, _mm256_max_epu16)
+DO_AVX2_INTRIN(gvec_umax32, _mm256_max_epu32)
+
+static intptr_t gvec_dup64_avx2(void *d, uint64_t c, intptr_t oprsz)
+{
+    vec64_256 vecc = { c, c, c, c };
+    intptr_t i;
+
+    for (i = 0; i + 32 <= oprsz; i += 32) {
+        *(vec64_256 *)(d + i) = vecc;
+    }
+    return i;
+}
+
+static intptr_t gvec_dup32_avx2(void *d, uint32_t c, intptr_t oprsz)
+{
+    return gvec_dup64_avx2(d, c * 0x100000001ull, oprsz);
+}
+
+#undef DO_AVX2_3
+#undef DO_AVX2_SHI
+#undef DO_AVX2_INTRIN
+#undef DO_AVX2_CMP
+
+#pragma GCC pop_options
+#else
+#define GVEC_AVX2(NAME, ...)  0
+#endif /* CONFIG_AVX2_OPT */
+
 void HELPER(gvec_add8)(void *d, void *a, void *b, uint32_t desc)
 {
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(vec8)) {
+    for (i = GVEC_AVX2(gvec_add8, d, a, b, oprsz);
+         i < oprsz; i += sizeof(vec8)) {
         *(vec8 *)(d + i) = *(vec8 *)(a + i) + *(vec8 *)(b + i);
     }
     clear_high(d, oprsz, desc);
@@ -94,7 +272,8 @@ void HELPER(gvec_add16)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(vec16)) {
+    for (i = GVEC_AVX2(gvec_add16, d, a, b, oprsz);
+         i < oprsz; i += sizeof(vec16)) {
         *(vec16 *)(d + i) = *(vec16 *)(a + i) + *(vec16 *)(b + i);
     }
     clear_high(d, oprsz, desc);
@@ -105,7 +284,8 @@ void HELPER(gvec_add32)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(vec32)) {
+    for (i = GVEC_AVX2(gvec_add32, d, a, b, oprsz);
+         i < oprsz; i += sizeof(vec32)) {
         *(vec32 *)(d + i) = *(vec32 *)(a + i) + *(vec32 *)(b + i);
     }
     clear_high(d, oprsz, desc);
@@ -116,7 +296,8 @@ void HELPER(gvec_add64)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(vec64)) {
+    for (i = GVEC_AVX2(gvec_add64, d, a, b, oprsz);
+         i < oprsz; i += sizeof(vec64)) {
         *(vec64 *)(d + i) = *(vec64 *)(a + i) + *(vec64 *)(b + i);
     }
     clear_high(d, oprsz, desc);
@@ -175,7 +356,8 @@ void HELPER(gvec_sub8)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(vec8)) {
+    for (i = GVEC_AVX2(gvec_sub8, d, a, b, oprsz);
+         i < oprsz; i += sizeof(vec8)) {
         *(vec8 *)(d + i) = *(vec8 *)(a + i) - *(vec8 *)(b + i);
     }
     clear_high(d, oprsz, desc);
@@ -186,7 +368,8 @@ void HELPER(gvec_sub16)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(vec16)) {
+    for (i = GVEC_AVX2(gvec_sub16, d, a, b, oprsz);
+         i < oprsz; i += sizeof(vec16)) {
         *(vec16 *)(d + i) = *(vec16 *)(a + i) - *(vec16 *)(b + i);
     }
     clear_high(d, oprsz, desc);
@@ -197,7 +380,8 @@ void HELPER(gvec_sub32)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(vec32)) {
+    for (i = GVEC_AVX2(gvec_sub32, d, a, b, oprsz);
+         i < oprsz; i += sizeof(vec32)) {
         *(vec32 *)(d + i) = *(vec32 *)(a + i) - *(vec32 *)(b + i);
     }
     clear_high(d, oprsz, desc);
@@ -208,7 +392,8 @@ void HELPER(gvec_sub64)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(vec64)) {
+    for (i = GVEC_AVX2(gvec_sub64, d, a, b, oprsz);
+         i < oprsz; i += sizeof(vec64)) {
         *(vec64 *)(d + i) = *(vec64 *)(a + i) - *(vec64 *)(b + i);
     }
     clear_high(d, oprsz, desc);
@@ -278,7 +463,8 @@ void HELPER(gvec_mul16)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(vec16)) {
+    for (i = GVEC_AVX2(gvec_mul16, d, a, b, oprsz);
+         i < oprsz; i += sizeof(vec16)) {
         *(vec16 *)(d + i) = *(vec16 *)(a + i) * *(vec16 *)(b + i);
     }
     clear_high(d, oprsz, desc);
@@ -289,7 +475,8 @@ void HELPER(gvec_mul32)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(vec32)) {
+    for (i = GVEC_AVX2(gvec_mul32, d, a, b, oprsz);
+         i < oprsz; i += sizeof(vec32)) {
         *(vec32 *)(d + i) = *(vec32 *)(a + i) * *(vec32 *)(b + i);
     }
     clear_high(d, oprsz, desc);
@@ -414,7 +601,8 @@ void HELPER(gvec_dup64)(void *d, uint32_t desc, uint64_t c)
     if (c == 0) {
         oprsz = 0;
     } else {
-        for (i = 0; i < oprsz; i += sizeof(uint64_t)) {
+        for (i = GVEC_AVX2(gvec_dup64, d, c, oprsz);
+             i < oprsz; i += sizeof(uint64_t)) {
             *(uint64_t *)(d + i) = c;
         }
     }
@@ -429,7 +617,8 @@ void HELPER(gvec_dup32)(void *d, uint32_t desc, uint32_t c)
     if (c == 0) {
         oprsz = 0;
     } else {
-        for (i = 0; i < oprsz; i += sizeof(uint32_t)) {
+        for (i = GVEC_AVX2(gvec_dup32, d, c, oprsz);
+             i < oprsz; i += sizeof(uint32_t)) {
             *(uint32_t *)(d + i) = c;
         }
     }
@@ -462,7 +651,8 @@ void HELPER(gvec_and)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(vec64)) {
+    for (i = GVEC_AVX2(gvec_and, d, a, b, oprsz);
+         i < oprsz; i += sizeof(vec64)) {
         *(vec64 *)(d + i) = *(vec64 *)(a + i) & *(vec64 *)(b + i);
     }
     clear_high(d, oprsz, desc);
@@ -473,7 +663,8 @@ void HELPER(gvec_or)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(vec64)) {
+    for (i = GVEC_AVX2(gvec_or, d, a, b, oprsz);
+         i < oprsz; i += sizeof(vec64)) {
         *(vec64 *)(d + i) = *(vec64 *)(a + i) | *(vec64 *)(b + i);
     }
     clear_high(d, oprsz, desc);
@@ -484,7 +675,8 @@ void HELPER(gvec_xor)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(vec64)) {
+    for (i = GVEC_AVX2(gvec_xor, d, a, b, oprsz);
+         i < oprsz; i += sizeof(vec64)) {
         *(vec64 *)(d + i) = *(vec64 *)(a + i) ^ *(vec64 *)(b + i);
     }
     clear_high(d, oprsz, desc);
@@ -495,7 +687,8 @@ void HELPER(gvec_andc)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(vec64)) {
+    for (i = GVEC_AVX2(gvec_andc, d, a, b, oprsz);
+         i < oprsz; i += sizeof(vec64)) {
         *(vec64 *)(d + i) = *(vec64 *)(a + i) &~ *(vec64 *)(b + i);
     }
     clear_high(d, oprsz, desc);
@@ -506,7 +699,8 @@ void HELPER(gvec_orc)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(vec64)) {
+    for (i = GVEC_AVX2(gvec_orc, d, a, b, oprsz);
+         i < oprsz; i += sizeof(vec64)) {
         *(vec64 *)(d + i) = *(vec64 *)(a + i) |~ *(vec64 *)(b + i);
     }
     clear_high(d, oprsz, desc);
@@ -517,7 +711,8 @@ void HELPER(gvec_nand)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(vec64)) {
+    for (i = GVEC_AVX2(gvec_nand, d, a, b, oprsz);
+         i < oprsz; i += sizeof(vec64)) {
         *(vec64 *)(d + i) = ~(*(vec64 *)(a + i) & *(vec64 *)(b + i));
     }
     clear_high(d, oprsz, desc);
@@ -528,7 +723,8 @@ void HELPER(gvec_nor)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(vec64)) {
+    for (i = GVEC_AVX2(gvec_nor, d, a, b, oprsz);
+         i < oprsz; i += sizeof(vec64)) {
         *(vec64 *)(d + i) = ~(*(vec64 *)(a + i) | *(vec64 *)(b + i));
     }
     clear_high(d, oprsz, desc);
@@ -539,7 +735,8 @@ void HELPER(gvec_eqv)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(vec64)) {
+    for (i = GVEC_AVX2(gvec_eqv, d, a, b, oprsz);
+         i < oprsz; i += sizeof(vec64)) {
         *(vec64 *)(d + i) = ~(*(vec64 *)(a + i) ^ *(vec64 *)(b + i));
     }
     clear_high(d, oprsz, desc);
@@ -599,7 +796,8 @@ void HELPER(gvec_shl16i)(void *d, void *a, uint32_t desc)
     int shift = simd_data(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(vec16)) {
+    for (i = GVEC_AVX2(gvec_shl16i, d, a, oprsz, shift);
+         i < oprsz; i += sizeof(vec16)) {
         *(vec16 *)(d + i) = *(vec16 *)(a + i) << shift;
     }
     clear_high(d, oprsz, desc);
@@ -611,7 +809,8 @@ void HELPER(gvec_shl32i)(void *d, void *a, uint32_t desc)
     int shift = simd_data(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(vec32)) {
+    for (i = GVEC_AVX2(gvec_shl32i, d, a, oprsz, shift);
+         i < oprsz; i += sizeof(vec32)) {
         *(vec32 *)(d + i) = *(vec32 *)(a + i) << shift;
     }
     clear_high(d, oprsz, desc);
@@ -623,7 +822,8 @@ void HELPER(gvec_shl64i)(void *d, void *a, uint32_t desc)
     int shift = simd_data(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(vec64)) {
+    for (i = GVEC_AVX2(gvec_shl64i, d, a, oprsz, shift);
+         i < oprsz; i += sizeof(vec64)) {
         *(vec64 *)(d + i) = *(vec64 *)(a + i) << shift;
     }
     clear_high(d, oprsz, desc);
@@ -647,7 +847,8 @@ void HELPER(gvec_shr16i)(void *d, void *a, uint32_t desc)
     int shift = simd_data(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(vec16)) {
+    for (i = GVEC_AVX2(gvec_shr16i, d, a, oprsz, shift);
+         i < oprsz; i += sizeof(vec16)) {
         *(vec16 *)(d + i) = *(vec16 *)(a + i) >> shift;
     }
     clear_high(d, oprsz, desc);
@@ -659,7 +860,8 @@ void HELPER(gvec_shr32i)(void *d, void *a, uint32_t desc)
     int shift = simd_data(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(vec32)) {
+    for (i = GVEC_AVX2(gvec_shr32i, d, a, oprsz, shift);
+         i < oprsz; i += sizeof(vec32)) {
         *(vec32 *)(d + i) = *(vec32 *)(a + i) >> shift;
     }
     clear_high(d, oprsz, desc);
@@ -671,7 +873,8 @@ void HELPER(gvec_shr64i)(void *d, void *a, uint32_t desc)
     int shift = simd_data(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(vec64)) {
+    for (i = GVEC_AVX2(gvec_shr64i, d, a, oprsz, shift);
+         i < oprsz; i += sizeof(vec64)) {
         *(vec64 *)(d + i) = *(vec64 *)(a + i) >> shift;
     }
     clear_high(d, oprsz, desc);
@@ -695,7 +898,8 @@ void HELPER(gvec_sar16i)(void *d, void *a, uint32_t desc)
     int shift = simd_data(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(vec16)) {
+    for (i = GVEC_AVX2(gvec_sar16i, d, a, oprsz, shift);
+         i < oprsz; i += sizeof(vec16)) {
         *(svec16 *)(d + i) = *(svec16 *)(a + i) >> shift;
     }
     clear_high(d, oprsz, desc);
@@ -707,7 +911,8 @@ void HELPER(gvec_sar32i)(void *d, void *a, uint32_t desc)
     int shift = simd_data(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(vec32)) {
+    for (i = GVEC_AVX2(gvec_sar32i, d, a, oprsz, shift);
+         i < oprsz; i += sizeof(vec32)) {
         *(svec32 *)(d + i) = *(svec32 *)(a + i) >> shift;
     }
     clear_high(d, oprsz, desc);
@@ -738,7 +943,8 @@ void HELPER(NAME)(void *d, void *a, void *b, uint32_t desc)                \
 {                                                                          \
     intptr_t oprsz = simd_oprsz(desc);                                     \
     intptr_t i;                                                            \
-    for (i = 0; i < oprsz; i += sizeof(TYPE)) {                            \
+    for (i = GVEC_AVX2(NAME, d, a, b, oprsz); i < oprsz;                   \
+         i += sizeof(TYPE)) {                                              \
         *(TYPE *)(d + i) = DO_CMP0(*(TYPE *)(a + i) OP *(TYPE *)(b + i));  \
     }                                                                      \
     clear_high(d, oprsz, desc);                                            \
@@ -766,7 +972,8 @@ void HELPER(gvec_ssadd8)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(int8_t)) {
+    for (i = GVEC_AVX2(gvec_ssadd8, d, a, b, oprsz);
+         i < oprsz; i += sizeof(int8_t)) {
         int r = *(int8_t *)(a + i) + *(int8_t *)(b + i);
         if (r > INT8_MAX) {
             r = INT8_MAX;
@@ -783,7 +990,8 @@ void HELPER(gvec_ssadd16)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(int16_t)) {
+    for (i = GVEC_AVX2(gvec_ssadd16, d, a, b, oprsz);
+         i < oprsz; i += sizeof(int16_t)) {
         int r = *(int16_t *)(a + i) + *(int16_t *)(b + i);
         if (r > INT16_MAX) {
             r = INT16_MAX;
@@ -836,7 +1044,8 @@ void HELPER(gvec_sssub8)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint8_t)) {
+    for (i = GVEC_AVX2(gvec_sssub8, d, a, b, oprsz);
+         i < oprsz; i += sizeof(uint8_t)) {
         int r = *(int8_t *)(a + i) - *(int8_t *)(b + i);
         if (r > INT8_MAX) {
             r = INT8_MAX;
@@ -853,7 +1062,8 @@ void HELPER(gvec_sssub16)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(int16_t)) {
+    for (i = GVEC_AVX2(gvec_sssub16, d, a, b, oprsz);
+         i < oprsz; i += sizeof(int16_t)) {
         int r = *(int16_t *)(a + i) - *(int16_t *)(b + i);
         if (r > INT16_MAX) {
             r = INT16_MAX;
@@ -906,7 +1116,8 @@ void HELPER(gvec_usadd8)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint8_t)) {
+    for (i = GVEC_AVX2(gvec_usadd8, d, a, b, oprsz);
+         i < oprsz; i += sizeof(uint8_t)) {
         unsigned r = *(uint8_t *)(a + i) + *(uint8_t *)(b + i);
         if (r > UINT8_MAX) {
             r = UINT8_MAX;
@@ -921,7 +1132,8 @@ void HELPER(gvec_usadd16)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint16_t)) {
+    for (i = GVEC_AVX2(gvec_usadd16, d, a, b, oprsz);
+         i < oprsz; i += sizeof(uint16_t)) {
         unsigned r = *(uint16_t *)(a + i) + *(uint16_t *)(b + i);
         if (r > UINT16_MAX) {
             r = UINT16_MAX;
@@ -970,7 +1182,8 @@ void HELPER(gvec_ussub8)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint8_t)) {
+    for (i = GVEC_AVX2(gvec_ussub8, d, a, b, oprsz);
+         i < oprsz; i += sizeof(uint8_t)) {
         int r = *(uint8_t *)(a + i) - *(uint8_t *)(b + i);
         if (r < 0) {
             r = 0;
@@ -985,7 +1198,8 @@ void HELPER(gvec_ussub16)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint16_t)) {
+    for (i = GVEC_AVX2(gvec_ussub16, d, a, b, oprsz);
+         i < oprsz; i += sizeof(uint16_t)) {
         int r = *(uint16_t *)(a + i) - *(uint16_t *)(b + i);
         if (r < 0) {
             r = 0;
@@ -1034,7 +1248,8 @@ void HELPER(gvec_smin8)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(int8_t)) {
+    for (i = GVEC_AVX2(gvec_smin8, d, a, b, oprsz);
+         i < oprsz; i += sizeof(int8_t)) {
         int8_t aa = *(int8_t *)(a + i);
         int8_t bb = *(int8_t *)(b + i);
         int8_t dd = aa < bb ? aa : bb;
@@ -1048,7 +1263,8 @@ void HELPER(gvec_smin16)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(int16_t)) {
+    for (i = GVEC_AVX2(gvec_smin16, d, a, b, oprsz);
+         i < oprsz; i += sizeof(int16_t)) {
         int16_t aa = *(int16_t *)(a + i);
         int16_t bb = *(int16_t *)(b + i);
         int16_t dd = aa < bb ? aa : bb;
@@ -1062,7 +1278,8 @@ void HELPER(gvec_smin32)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(int32_t)) {
+    for (i = GVEC_AVX2(gvec_smin32, d, a, b, oprsz);
+         i < oprsz; i += sizeof(int32_t)) {
         int32_t aa = *(int32_t *)(a + i);
         int32_t bb = *(int32_t *)(b + i);
         int32_t dd = aa < bb ? aa : bb;
@@ -1090,7 +1307,8 @@ void HELPER(gvec_smax8)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(int8_t)) {
+    for (i = GVEC_AVX2(gvec_smax8, d, a, b, oprsz);
+         i < oprsz; i += sizeof(int8_t)) {
         int8_t aa = *(int8_t *)(a + i);
         int8_t bb = *(int8_t *)(b + i);
         int8_t dd = aa > bb ? aa : bb;
@@ -1104,7 +1322,8 @@ void HELPER(gvec_smax16)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(int16_t)) {
+    for (i = GVEC_AVX2(gvec_smax16, d, a, b, oprsz);
+         i < oprsz; i += sizeof(int16_t)) {
         int16_t aa = *(int16_t *)(a + i);
         int16_t bb = *(int16_t *)(b + i);
         int16_t dd = aa > bb ? aa : bb;
@@ -1118,7 +1337,8 @@ void HELPER(gvec_smax32)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(int32_t)) {
+    for (i = GVEC_AVX2(gvec_smax32, d, a, b, oprsz);
+         i < oprsz; i += sizeof(int32_t)) {
         int32_t aa = *(int32_t *)(a + i);
         int32_t bb = *(int32_t *)(b + i);
         int32_t dd = aa > bb ? aa : bb;
@@ -1146,7 +1366,8 @@ void HELPER(gvec_umin8)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint8_t)) {
+    for (i = GVEC_AVX2(gvec_umin8, d, a, b, oprsz);
+         i < oprsz; i += sizeof(uint8_t)) {
         uint8_t aa = *(uint8_t *)(a + i);
         uint8_t bb = *(uint8_t *)(b + i);
         uint8_t dd = aa < bb ? aa : bb;
@@ -1160,7 +1381,8 @@ void HELPER(gvec_umin16)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint16_t)) {
+    for (i = GVEC_AVX2(gvec_umin16, d, a, b, oprsz);
+         i < oprsz; i += sizeof(uint16_t)) {
         uint16_t aa = *(uint16_t *)(a + i);
         uint16_t bb = *(uint16_t *)(b + i);
         uint16_t dd = aa < bb ? aa : bb;
@@ -1174,7 +1396,8 @@ void HELPER(gvec_umin32)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint32_t)) {
+    for (i = GVEC_AVX2(gvec_umin32, d, a, b, oprsz);
+         i < oprsz; i += sizeof(uint32_t)) {
         uint32_t aa = *(uint32_t *)(a + i);
         uint32_t bb = *(uint32_t *)(b + i);
         uint32_t dd = aa < bb ? aa : bb;
@@ -1202,7 +1425,8 @@ void HELPER(gvec_umax8)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint8_t)) {
+    for (i = GVEC_AVX2(gvec_umax8, d, a, b, oprsz);
+         i < oprsz; i += sizeof(uint8_t)) {
         uint8_t aa = *(uint8_t *)(a + i);
         uint8_t bb = *(uint8_t *)(b + i);
         uint8_t dd = aa > bb ? aa : bb;
@@ -1216,7 +1440,8 @@ void HELPER(gvec_umax16)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint16_t)) {
+    for (i = GVEC_AVX2(gvec_umax16, d, a, b, oprsz);
+         i < oprsz; i += sizeof(uint16_t)) {
         uint16_t aa = *(uint16_t *)(a + i);
         uint16_t bb = *(uint16_t *)(b + i);
         uint16_t dd = aa > bb ? aa : bb;
@@ -1230,7 +1455,8 @@ void HELPER(gvec_umax32)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint32_t)) {
+    for (i = GVEC_AVX2(gvec_umax32, d, a, b, oprsz);
+         i < oprsz; i += sizeof(uint32_t)) {
         uint32_t aa = *(uint32_t *)(a + i);
         uint32_t bb = *(uint32_t *)(b + i);
         uint32_t dd = aa > bb ? aa : bb;
@@ -283,3 +283,10 @@ DEF_HELPER_FLAGS_4(gvec_leu8, TCG_CALL_NO_RWG, void, ptr, ptr, ptr, i32)
 DEF_HELPER_FLAGS_4(gvec_leu16, TCG_CALL_NO_RWG, void, ptr, ptr, ptr, i32)
 DEF_HELPER_FLAGS_4(gvec_leu32, TCG_CALL_NO_RWG, void, ptr, ptr, ptr, i32)
 DEF_HELPER_FLAGS_4(gvec_leu64, TCG_CALL_NO_RWG, void, ptr, ptr, ptr, i32)
+
+#ifdef CONFIG_PLUGIN
+DEF_HELPER_FLAGS_3(plugin_vcpu_udata_cb, TCG_CALL_NO_RWG, void, i32, ptr, ptr)
+DEF_HELPER_FLAGS_5(plugin_vcpu_mem_cb, TCG_CALL_NO_RWG, void,
+                   i32, i32, i64, ptr, ptr)
+DEF_HELPER_FLAGS_2(plugin_inline_add_u64, TCG_CALL_NO_RWG, void, ptr, i64)
+#endif
@@ -483,9 +483,9 @@ static void page_init(void)
 #endif
 }
 
-static PageDesc *page_find_alloc(tb_page_addr_t index, int alloc)
+/* Return the slot of l1_map that points to the leaf holding @index */
+static void **page_leaf_slot(tb_page_addr_t index, int alloc)
 {
-    PageDesc *pd;
     void **lp;
     int i;
 
@@ -512,6 +512,71 @@ static PageDesc *page_find_alloc(tb_page_addr_t index, int alloc)
 
         lp = p + ((index >> (i * V_L2_BITS)) & (V_L2_SIZE - 1));
     }
+    return lp;
+}
+
+#ifdef CONFIG_USER_ONLY
+/*
+ * Guests reserve huge ranges of address space (sanitizers, JITs, 48-bit
+ * heaps) that they never execute from.  A leaf whose pages all have the
+ * same flags and no TBs points to a read-only array that is shared by
+ * all such leaves, instead of V_L2_SIZE descriptors of its own.  Shared
+ * leaves are never freed; page_find_alloc() with @alloc gives the leaf
+ * a private copy before anything in it is modified.
+ */
+static PageDesc *page_shared_leaves[(PAGE_BITS | PAGE_VALID |
+                                     PAGE_WRITE_ORG | PAGE_RESERVED) + 1];
+
+static PageDesc *page_shared_leaf(int flags)
+{
+    PageDesc *pd;
+    int i;
+
+    assert(flags > 0 && flags < ARRAY_SIZE(page_shared_leaves));
+    pd = page_shared_leaves[flags];
+    if (pd == NULL) {
+        pd = g_new0(PageDesc, V_L2_SIZE);
+        for (i = 0; i < V_L2_SIZE; i++) {
+            pd[i].flags = flags;
+        }
+        page_shared_leaves[flags] = pd;
+    }
+    return pd;
+}
+
+static inline bool page_leaf_is_shared(const PageDesc *pd)
+{
+    return pd->flags > 0 && pd->flags < ARRAY_SIZE(page_shared_leaves) &&
+           page_shared_leaves[pd->flags] == pd;
+}
+
+static PageDesc *page_leaf_unshare(void **lp, PageDesc *pd)
+{
+    PageDesc *copy = g_memdup(pd, sizeof(PageDesc) * V_L2_SIZE);
+    void *existing = atomic_cmpxchg(lp, pd, copy);
+
+    if (unlikely(existing != pd)) {
+        g_free(copy);
+        return existing;
+    }
+    return copy;
+}
+#else
+static inline bool page_leaf_is_shared(const PageDesc *pd)
+{
+    return false;
+}
+#endif
+
+static PageDesc *page_find_alloc(tb_page_addr_t index, int alloc)
+{
+    PageDesc *pd;
+    void **lp;
+
+    lp = page_leaf_slot(index, alloc);
+    if (lp == NULL) {
+        return NULL;
+    }
 
     pd = atomic_rcu_read(lp);
     if (pd == NULL) {
@@ -536,6 +601,11 @@ static PageDesc *page_find_alloc(tb_page_addr_t index, int alloc)
             pd = existing;
         }
     }
+#ifdef CONFIG_USER_ONLY
+    if (alloc && page_leaf_is_shared(pd)) {
+        pd = page_leaf_unshare(lp, pd);
+    }
+#endif
 
     return pd + (index & (V_L2_SIZE - 1));
 }
@@ -1132,8 +1202,12 @@ static bool tb_cmp(const void *ap, const void *bp)
 static void tb_htable_init(void)
 {
     unsigned int mode = QHT_MODE_AUTO_RESIZE;
+    int i;
 
     qht_init(&tb_ctx.htable, tb_cmp, CODE_GEN_HTABLE_SIZE, mode);
+    for (i = 0; i < TB_GEN_LOCK_SIZE; i++) {
+        qemu_mutex_init(&tb_ctx.gen_lock[i]);
+    }
 }
 
 /* Must be called before using the QEMU cpus. 'tb_size' is the size
@@ -1153,6 +1227,55 @@ void tcg_exec_init(unsigned long tb_size)
 #endif
 }
 
+/* The translation lock held by this thread, if any */
+static __thread QemuMutex *tb_gen_lock_held;
+
+/*
+ * Take the translation lock for @pc and @flags, then look the TB up
+ * again: if another vCPU translated it while we were waiting for the
+ * lock, return that TB and release the lock.  Otherwise return NULL
+ * with the lock held; it is released by tb_gen_unlock(), or by
+ * tb_gen_lock_reset() if the translation longjmps out.
+ */
+static TranslationBlock *tb_gen_lock(CPUState *cpu, target_ulong pc,
+                                     target_ulong cs_base, uint32_t flags,
+                                     uint32_t cflags)
+{
+    QemuMutex *lock;
+    TranslationBlock *tb;
+    uint32_t h;
+
+    h = qemu_xxhash4(pc, flags) & (TB_GEN_LOCK_SIZE - 1);
+    lock = &tb_ctx.gen_lock[h];
+    g_assert(tb_gen_lock_held == NULL);
+    qemu_mutex_lock(lock);
+    tb_gen_lock_held = lock;
+
+    tb = tb_htable_lookup(cpu, pc, cs_base, flags, cflags & CF_HASH_MASK);
+    if (tb) {
+        tb_gen_lock_held = NULL;
+        qemu_mutex_unlock(lock);
+        atomic_inc(&tb_ctx.tb_gen_shared_count);
+    }
+    return tb;
+}
+
+static void tb_gen_unlock(void)
+{
+    QemuMutex *lock = tb_gen_lock_held;
+
+    if (lock) {
+        tb_gen_lock_held = NULL;
+        qemu_mutex_unlock(lock);
+    }
+}
+
+/* Called from the cpu_exec longjmp path, like mmap_unlock() is. */
+void tb_gen_lock_reset(void)
+{
+    tb_gen_unlock();
+}
+
 /*
  * Allocate a new translation block. Flush the translation buffer if
  * too many translation blocks or too much generated code.
@@ -1192,6 +1315,9 @@ static void page_flush_tb_1(int level, void **lp)
     if (level == 0) {
         PageDesc *pd = *lp;
 
+        if (page_leaf_is_shared(pd)) {
+            return;
+        }
         for (i = 0; i < V_L2_SIZE; ++i) {
             page_lock(&pd[i]);
             pd[i].first_tb = (uintptr_t)NULL;
@@ -1248,6 +1374,7 @@ static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
     CPU_FOREACH(cpu) {
         cpu_tb_jmp_cache_clear(cpu);
     }
+    memset(tb_ctx.jmp_cache, 0, sizeof(tb_ctx.jmp_cache));
 
     qht_reset_size(&tb_ctx.htable, CODE_GEN_HTABLE_SIZE);
     page_flush_tb();
@@ -1444,6 +1571,8 @@ static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
         !qht_remove(&tb_ctx.htable, tb, h)) {
         return;
     }
+    atomic_cmpxchg(&tb_ctx.jmp_cache[h & (TB_JMP_CACHE_L2_SIZE - 1)],
+                   tb, NULL);
 
     /* remove the TB from the page list */
     if (rm_from_page_list) {
@@ -1691,11 +1820,19 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     cflags &= ~CF_CLUSTER_MASK;
     cflags |= cpu->cluster_index << CF_CLUSTER_SHIFT;
 
+    if (!(cflags & CF_NOCACHE)) {
+        existing_tb = tb_gen_lock(cpu, pc, cs_base, flags, cflags);
+        if (existing_tb) {
+            return existing_tb;
+        }
+    }
+
  buffer_overflow:
     tb = tb_alloc(pc);
     if (unlikely(!tb)) {
         /* flush must be done */
         tb_flush(cpu);
+        tb_gen_unlock();
         mmap_unlock();
         /* Make the execution loop process the flush as soon as possible.  */
         cpu->exception_index = EXCP_INTERRUPT;
@@ -1795,6 +1932,11 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
         qemu_log_flush();
         qemu_log_unlock();
     }
+    /* One line per TB, so that two runs can be diffed to compare code size */
+    qemu_log_mask_and_addr(CPU_LOG_TB_SIZE, tb->pc,
+                           "TB size: pc=" TARGET_FMT_lx " guest=%u insns=%u "
+                           "host=%d search=%d\n", tb->pc, tb->size,
+                           tb->icount, gen_code_size, search_size);
 #endif
 
     atomic_set(&tcg_ctx->code_gen_ptr, (void *)
@@ -1828,6 +1970,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
      * TB visible in a consistent state.
      */
     existing_tb = tb_link_page(tb, phys_pc, phys_page2);
+    tb_gen_unlock();
     /* if the TB already exists, discard what we just translated */
     if (unlikely(existing_tb != tb)) {
         uintptr_t orig_aligned = (uintptr_t)gen_code_buf;
@@ -1985,10 +2128,18 @@ void tb_invalidate_phys_range(target_ulong start, target_ulong end)
     for (next = (start & TARGET_PAGE_MASK) + TARGET_PAGE_SIZE;
          start < end;
          start = next, next += TARGET_PAGE_SIZE) {
-        PageDesc *pd = page_find(start >> TARGET_PAGE_BITS);
+        tb_page_addr_t index = start >> TARGET_PAGE_BITS;
+        PageDesc *pd = page_find(index);
         tb_page_addr_t bound = MIN(next, end);
 
-        if (pd == NULL) {
+        if (pd == NULL ||
+            page_leaf_is_shared(pd - (index & (V_L2_SIZE - 1)))) {
+            /* No code in the whole leaf, skip to the next one */
+            next = (index | (V_L2_SIZE - 1)) + 1;
+            next <<= TARGET_PAGE_BITS;
+            if (next <= start) {
+                break;
+            }
             continue;
         }
         tb_invalidate_phys_page_range__locked(pages, pd, start, bound, 0);
@@ -2290,6 +2441,7 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
     struct tb_tree_stats tst = {};
     struct qht_stats hst;
     size_t nb_tbs, flush_full, flush_part, flush_elide;
+    size_t l2_hits, l2_misses, l1_misses;
 
     tcg_tb_foreach(tb_tree_stats_iter, &tst);
     nb_tbs = tst.nb_tbs;
@@ -2325,6 +2477,14 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
     cpu_fprintf(f, "TB flush count      %u\n",
                 atomic_read(&tb_ctx.tb_flush_count));
     cpu_fprintf(f, "TB invalidate count %zu\n", tcg_tb_phys_invalidate_count());
+    cpu_fprintf(f, "TB shared count     %zu\n",
+                atomic_read(&tb_ctx.tb_gen_shared_count));
+
+    tcg_tb_jmp_cache_l2_counts(&l2_hits, &l2_misses);
+    l1_misses = l2_hits + l2_misses;
+    cpu_fprintf(f, "TB L1 cache misses  %zu\n", l1_misses);
+    cpu_fprintf(f, "TB L2 cache hits    %zu (%zu%%)\n", l2_hits,
+                l1_misses ? (l2_hits * 100) / l1_misses : 0);
 
     tlb_flush_counts(&flush_full, &flush_part, &flush_elide);
     cpu_fprintf(f, "TLB full flushes    %zu\n", flush_full);
@@ -2472,10 +2632,18 @@ int page_get_flags(target_ulong address)
 
 /* Modify the flags of a page and invalidate the code if necessary.
    The flag PAGE_WRITE_ORG is positioned automatically depending
-   on PAGE_WRITE.  The mmap_lock should already be held.  */
+   on PAGE_WRITE.  The mmap_lock should already be held.
+
+   Guest programs map and unmap large ranges, so the range is walked
+   one leaf of the page table at a time.  No PageDesc is allocated just
+   to clear the flags of pages that were never mapped, and leaves that
+   are covered entirely and hold no code use a shared leaf.  This makes
+   each update cheaper, but mmap and translation still serialize on
+   mmap_lock.  */
 void page_set_flags(target_ulong start, target_ulong end, int flags)
 {
-    target_ulong addr, len;
+    tb_page_addr_t index;
+    target_ulong npages, n, i;
 
     /* This function should never be called with addresses outside the
        guest address space.  If this assert fires, it probably indicates
@@ -2493,27 +2661,44 @@ void page_set_flags(target_ulong start, target_ulong end, int flags)
         flags |= PAGE_WRITE_ORG;
     }
 
-    for (addr = start, len = end - start;
-         len != 0;
-         len -= TARGET_PAGE_SIZE, addr += TARGET_PAGE_SIZE) {
-        PageDesc *p = page_find_alloc(addr >> TARGET_PAGE_BITS, 1);
-
-        /* If the write protection bit is set, then we invalidate
-           the code inside.  */
-        if (!(p->flags & PAGE_WRITE) &&
-            (flags & PAGE_WRITE) &&
-            p->first_tb) {
-            tb_invalidate_phys_page(addr, 0);
+    index = start >> TARGET_PAGE_BITS;
+    for (npages = (end - start) >> TARGET_PAGE_BITS; npages; npages -= n) {
+        void **lp = page_leaf_slot(index, flags != 0);
+        PageDesc *p = lp ? atomic_rcu_read(lp) : NULL;
+
+        n = MIN(V_L2_SIZE - (index & (V_L2_SIZE - 1)), npages);
+        if (n == V_L2_SIZE && flags < ARRAY_SIZE(page_shared_leaves) &&
+            (p == NULL || page_leaf_is_shared(p))) {
+            if (lp) {
+                atomic_rcu_set(lp, flags ? page_shared_leaf(flags) : NULL);
+            }
+            index += n;
+            continue;
+        }
+        p = page_find_alloc(index, flags != 0 || p != NULL);
+        if (!p) {
+            index += n;
+            continue;
+        }
+        for (i = 0; i < n; i++, p++, index++) {
+            /* If the write protection bit is set, then we invalidate
+               the code inside.  */
+            if (!(p->flags & PAGE_WRITE) &&
+                (flags & PAGE_WRITE) &&
+                p->first_tb) {
+                tb_invalidate_phys_page(index << TARGET_PAGE_BITS, 0);
+            }
+            p->flags = flags;
         }
-        p->flags = flags;
     }
 }
 
 int page_check_range(target_ulong start, target_ulong len, int flags)
 {
-    PageDesc *p;
+    PageDesc *p = NULL;
     target_ulong end;
     target_ulong addr;
+    target_ulong n = 0;
 
     /* This function should never be called with addresses outside the
        guest address space.  If this assert fires, it probably indicates
@@ -2536,10 +2721,14 @@ int page_check_range(target_ulong start, target_ulong len, int flags)
 
     for (addr = start, len = end - start;
          len != 0;
-         len -= TARGET_PAGE_SIZE, addr += TARGET_PAGE_SIZE) {
-        p = page_find(addr >> TARGET_PAGE_BITS);
-        if (!p) {
-            return -1;
+         len -= TARGET_PAGE_SIZE, addr += TARGET_PAGE_SIZE, p++, n--) {
+        /* Look the page table up once per leaf */
+        if (n == 0) {
+            p = page_find(addr >> TARGET_PAGE_BITS);
+            if (!p) {
+                return -1;
+            }
+            n = V_L2_SIZE - ((addr >> TARGET_PAGE_BITS) & (V_L2_SIZE - 1));
         }
         if (!(p->flags & PAGE_VALID)) {
             return -1;
@@ -19,6 +19,7 @@
 #include "qemu/config-file.h"
 #include "qom/object_interfaces.h"
 #include "qemu/mmap-alloc.h"
+#include "qemu/error-report.h"
 
 #ifdef CONFIG_NUMA
 #include <numaif.h>
@@ -209,6 +210,15 @@ static void host_memory_backend_set_dump(Object *obj, bool value, Error **errp)
     }
 }
 
+/* The number of bits of host_nodes to consider, 0 if none is set */
+static unsigned long host_memory_backend_maxnode(HostMemoryBackend *backend)
+{
+    unsigned long lastbit = find_last_bit(backend->host_nodes, MAX_NODES);
+
+    /* lastbit == MAX_NODES means maxnode = 0 */
+    return (lastbit + 1) % (MAX_NODES + 1);
+}
+
 static bool host_memory_backend_get_prealloc(Object *obj, Error **errp)
 {
     HostMemoryBackend *backend = MEMORY_BACKEND(obj);
@@ -240,7 +250,8 @@ static void host_memory_backend_set_prealloc(Object *obj, bool value,
         void *ptr = memory_region_get_ram_ptr(&backend->mr);
         uint64_t sz = memory_region_size(&backend->mr);
 
-        os_mem_prealloc(fd, ptr, sz, smp_cpus, &local_err);
+        os_mem_prealloc(fd, ptr, sz, smp_cpus, backend->host_nodes,
+                        host_memory_backend_maxnode(backend), &local_err);
         if (local_err) {
             error_propagate(errp, local_err);
             return;
@@ -249,6 +260,64 @@ static void host_memory_backend_set_prealloc(Object *obj, bool value,
     }
 }
 
+static bool host_memory_backend_get_prealloc_async(Object *obj, Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+    return backend->prealloc_async;
+}
+
+static void host_memory_backend_set_prealloc_async(Object *obj, bool value,
+                                                   Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+    if (host_memory_backend_mr_inited(backend)) {
+        error_setg(errp, "cannot change property value");
+        return;
+    }
+    backend->prealloc_async = value;
+}
+
+static void host_memory_backend_get_prealloc_progress(Object *obj, Visitor *v,
+                                                      const char *name,
+                                                      void *opaque,
+                                                      Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+    uint8_t value = 0;
+
+    if (backend->prealloc_ctx) {
+        value = os_mem_prealloc_progress(backend->prealloc_ctx);
+    } else if (host_memory_backend_mr_inited(backend) &&
+               (backend->prealloc || backend->force_prealloc)) {
+        value = 100;
+    }
+    visit_type_uint8(v, name, &value, errp);
+}
+
+static void host_memory_backend_prealloc_wait(HostMemoryBackend *backend,
+                                              Error **errp)
+{
+    os_mem_prealloc_wait(backend->prealloc_ctx, errp);
+    backend->prealloc_ctx = NULL;
+    qemu_remove_machine_init_done_notifier(&backend->prealloc_done);
+}
+
+/* The guest must not run before its memory is preallocated */
+static void host_memory_backend_prealloc_done(Notifier *notifier, void *data)
+{
+    HostMemoryBackend *backend = container_of(notifier, HostMemoryBackend,
+                                              prealloc_done);
+    Error *local_err = NULL;
+
+    host_memory_backend_prealloc_wait(backend, &local_err);
+    if (local_err) {
+        error_report_err(local_err);
+        exit(1);
+    }
+}
+
 static void host_memory_backend_init(Object *obj)
 {
     HostMemoryBackend *backend = MEMORY_BACKEND(obj);
@@ -330,9 +399,7 @@ host_memory_backend_memory_complete(UserCreatable *uc, Error **errp)
             qemu_madvise(ptr, sz, QEMU_MADV_DONTDUMP);
         }
 #ifdef CONFIG_NUMA
-        unsigned long lastbit = find_last_bit(backend->host_nodes, MAX_NODES);
-        /* lastbit == MAX_NODES means maxnode = 0 */
-        unsigned long maxnode = (lastbit + 1) % (MAX_NODES + 1);
+        unsigned long maxnode = host_memory_backend_maxnode(backend);
         /* ensure policy won't be ignored in case memory is preallocated
          * before mbind(). note: MPOL_MF_STRICT is ignored on hugepages so
          * this doesn't catch hugepage case. */
@@ -373,10 +440,25 @@ host_memory_backend_memory_complete(UserCreatable *uc, Error **errp)
          * specified NUMA policy in place.
          */
         if (backend->prealloc) {
-            os_mem_prealloc(memory_region_get_fd(&backend->mr), ptr, sz,
-                            smp_cpus, &local_err);
-            if (local_err) {
-                goto out;
+            int fd = memory_region_get_fd(&backend->mr);
+            unsigned long maxnode = host_memory_backend_maxnode(backend);
+
+            /* Let the rest of the machine be created in the meanwhile */
+            if (backend->prealloc_async && !machine_init_done) {
+                backend->prealloc_ctx =
+                    os_mem_prealloc_async(fd, ptr, sz, smp_cpus,
+                                          backend->host_nodes, maxnode);
+            }
+            if (backend->prealloc_ctx) {
+                backend->prealloc_done.notify =
+                    host_memory_backend_prealloc_done;
+                qemu_add_machine_init_done_notifier(&backend->prealloc_done);
+            } else {
+                os_mem_prealloc(fd, ptr, sz, smp_cpus, backend->host_nodes,
+                                maxnode, &local_err);
+                if (local_err) {
+                    goto out;
+                }
             }
         }
     }
@@ -387,7 +469,9 @@ out:
 static bool
 host_memory_backend_can_be_deleted(UserCreatable *uc)
 {
-    if (host_memory_backend_is_mapped(MEMORY_BACKEND(uc))) {
+    HostMemoryBackend *backend = MEMORY_BACKEND(uc);
+
+    if (host_memory_backend_is_mapped(backend) || backend->prealloc_ctx) {
         return false;
     } else {
         return true;
@@ -452,6 +536,17 @@ host_memory_backend_class_init(ObjectClass *oc, void *data)
         host_memory_backend_set_prealloc, &error_abort);
     object_class_property_set_description(oc, "prealloc",
         "Preallocate memory", &error_abort);
+    object_class_property_add_bool(oc, "prealloc-async",
+        host_memory_backend_get_prealloc_async,
+        host_memory_backend_set_prealloc_async, &error_abort);
+    object_class_property_set_description(oc, "prealloc-async",
+        "Preallocate memory while the rest of the machine is created",
+        &error_abort);
+    object_class_property_add(oc, "prealloc-progress", "uint8",
+        host_memory_backend_get_prealloc_progress,
+        NULL, NULL, NULL, &error_abort);
+    object_class_property_set_description(oc, "prealloc-progress",
+        "Percentage of the memory preallocated so far", &error_abort);
     object_class_property_add(oc, "size", "int",
         host_memory_backend_get_size,
         host_memory_backend_set_size,
@@ -80,6 +80,16 @@ struct BlockBackend {
     VMChangeStateEntry *vmsh;
     bool force_allow_inactivate;
 
+    /* See blk_set_multiqueue() */
+    bool multiqueue;
+    Error *multiqueue_blocker;
+
+    /* AIO requests of multiqueue BlockBackends wait here while drained.
+     * quiesce_counter is only changed with queued_requests_lock held.
+     */
+    QemuMutex queued_requests_lock;
+    CoQueue queued_requests;
+
     /* Number of in-flight aio requests.  BlockDriverState also counts
      * in-flight requests but aio requests can exist even when blk->root is
      * NULL, so we cannot rely on its counter for that case.
@@ -332,6 +342,9 @@ BlockBackend *blk_new(uint64_t perm, uint64_t shared_perm)
     notifier_list_init(&blk->insert_bs_notifiers);
     QLIST_INIT(&blk->aio_notifiers);
 
+    qemu_mutex_init(&blk->queued_requests_lock);
+    qemu_co_queue_init(&blk->queued_requests);
+
     QTAILQ_INSERT_TAIL(&block_backends, blk, link);
     return blk;
 }
@@ -412,6 +425,7 @@ static void blk_delete(BlockBackend *blk)
     QTAILQ_REMOVE(&block_backends, blk, link);
     drive_info_del(blk->legacy_dinfo);
     block_acct_cleanup(&blk->stats);
+    qemu_mutex_destroy(&blk->queued_requests_lock);
     g_free(blk);
 }
 
@@ -765,6 +779,7 @@ void blk_remove_bs(BlockBackend *blk)
     ThrottleGroupMember *tgm = &blk->public.throttle_group_member;
     BlockDriverState *bs;
 
+    blk_set_multiqueue(blk, false, &error_abort);
     notifier_list_notify(&blk->remove_bs_notifiers, blk);
     if (tgm->throttle_state) {
         bs = blk_bs(blk);
@@ -1051,7 +1066,7 @@ bool blk_iostatus_is_enabled(const BlockBackend *blk)
 
 BlockDeviceIoStatus blk_iostatus(const BlockBackend *blk)
 {
-    return blk->iostatus;
+    return atomic_read(&blk->iostatus);
 }
 
 void blk_iostatus_disable(BlockBackend *blk)
@@ -1063,7 +1078,7 @@ void blk_iostatus_reset(BlockBackend *blk)
 {
     if (blk_iostatus_is_enabled(blk)) {
         BlockDriverState *bs = blk_bs(blk);
-        blk->iostatus = BLOCK_DEVICE_IO_STATUS_OK;
+        atomic_set(&blk->iostatus, BLOCK_DEVICE_IO_STATUS_OK);
         if (bs && bs->job) {
             block_job_iostatus_reset(bs->job);
         }
@@ -1072,11 +1087,15 @@ void blk_iostatus_reset(BlockBackend *blk)
 
 void blk_iostatus_set_err(BlockBackend *blk, int error)
 {
+    BlockDeviceIoStatus new_status = error == ENOSPC ?
+                                     BLOCK_DEVICE_IO_STATUS_NOSPACE :
+                                     BLOCK_DEVICE_IO_STATUS_FAILED;
+
     assert(blk_iostatus_is_enabled(blk));
-    if (blk->iostatus == BLOCK_DEVICE_IO_STATUS_OK) {
-        blk->iostatus = error == ENOSPC ? BLOCK_DEVICE_IO_STATUS_NOSPACE :
-                                          BLOCK_DEVICE_IO_STATUS_FAILED;
-    }
+
+    /* Requests of multiqueue BlockBackends fail in several IOThreads at
+     * once; only the first error is recorded */
+    atomic_cmpxchg(&blk->iostatus, BLOCK_DEVICE_IO_STATUS_OK, new_status);
 }
 
 void blk_set_allow_write_beyond_eof(BlockBackend *blk, bool allow)
@@ -1273,6 +1292,40 @@ static void blk_dec_in_flight(BlockBackend *blk)
     aio_wait_kick();
 }
 
+/*
+ * The AioContext in which AIO requests of @blk run and complete.  For
+ * multiqueue BlockBackends, this is the AioContext of the submitter.
+ */
+static AioContext *blk_aio_request_context(BlockBackend *blk)
+{
+    if (blk->multiqueue) {
+        return qemu_get_current_aio_context();
+    }
+    return blk_get_aio_context(blk);
+}
+
+/*
+ * Requests of multiqueue BlockBackends can be submitted from AioContexts
+ * that bdrv_drained_begin() does not quiesce; hold them back until the
+ * drained section ends.  The caller holds an in-flight reference, which
+ * is dropped while waiting so that draining can complete.
+ */
+static void coroutine_fn blk_wait_while_drained(BlockBackend *blk)
+{
+    if (!blk->multiqueue) {
+        return;
+    }
+
+    qemu_mutex_lock(&blk->queued_requests_lock);
+    while (blk->quiesce_counter) {
+        blk_dec_in_flight(blk);
+        qemu_co_queue_wait(&blk->queued_requests,
+                           &blk->queued_requests_lock);
+        blk_inc_in_flight(blk);
+    }
+    qemu_mutex_unlock(&blk->queued_requests_lock);
+}
+
 static void error_callback_bh(void *opaque)
 {
     struct BlockBackendAIOCB *acb = opaque;
@@ -1293,7 +1346,8 @@ BlockAIOCB *blk_abort_aio_request(BlockBackend *blk,
     acb->blk = blk;
     acb->ret = ret;
 
-    aio_bh_schedule_oneshot(blk_get_aio_context(blk), error_callback_bh, acb);
+    aio_bh_schedule_oneshot(blk_aio_request_context(blk),
+                            error_callback_bh, acb);
     return &acb->common;
 }
 
@@ -1329,6 +1383,7 @@ static BlockAIOCB *blk_aio_prwv(BlockBackend *blk, int64_t offset, int bytes,
                                 BdrvRequestFlags flags,
                                 BlockCompletionFunc *cb, void *opaque)
 {
+    AioContext *ctx = blk_aio_request_context(blk);
     BlkAioEmAIOCB *acb;
     Coroutine *co;
 
@@ -1345,12 +1400,11 @@ static BlockAIOCB *blk_aio_prwv(BlockBackend *blk, int64_t offset, int bytes,
     acb->has_returned = false;
 
     co = qemu_coroutine_create(co_entry, acb);
-    bdrv_coroutine_enter(blk_bs(blk), co);
+    aio_co_enter(ctx, co);
 
     acb->has_returned = true;
     if (acb->rwco.ret != NOT_DONE) {
-        aio_bh_schedule_oneshot(blk_get_aio_context(blk),
-                                blk_aio_complete_bh, acb);
+        aio_bh_schedule_oneshot(ctx, blk_aio_complete_bh, acb);
     }
 
     return &acb->common;
@@ -1363,6 +1417,7 @@ static void blk_aio_read_entry(void *opaque)
     QEMUIOVector *qiov = rwco->iobuf;
 
     assert(qiov->size == acb->bytes);
+    blk_wait_while_drained(rwco->blk);
     rwco->ret = blk_co_preadv(rwco->blk, rwco->offset, acb->bytes,
                               qiov, rwco->flags);
     blk_aio_complete(acb);
@@ -1375,6 +1430,7 @@ static void blk_aio_write_entry(void *opaque)
     QEMUIOVector *qiov = rwco->iobuf;
 
     assert(!qiov || qiov->size == acb->bytes);
+    blk_wait_while_drained(rwco->blk);
     rwco->ret = blk_co_pwritev(rwco->blk, rwco->offset, acb->bytes,
                                qiov, rwco->flags);
     blk_aio_complete(acb);
@@ -1456,6 +1512,7 @@ static void blk_aio_flush_entry(void *opaque)
     BlkAioEmAIOCB *acb = opaque;
     BlkRwCo *rwco = &acb->rwco;
 
+    blk_wait_while_drained(rwco->blk);
     rwco->ret = blk_co_flush(rwco->blk);
     blk_aio_complete(acb);
 }
@@ -1471,6 +1528,7 @@ static void blk_aio_pdiscard_entry(void *opaque)
     BlkAioEmAIOCB *acb = opaque;
     BlkRwCo *rwco = &acb->rwco;
 
+    blk_wait_while_drained(rwco->blk);
     rwco->ret = blk_co_pdiscard(rwco->blk, rwco->offset, acb->bytes);
     blk_aio_complete(acb);
 }
@@ -1522,6 +1580,7 @@ static void blk_aio_ioctl_entry(void *opaque)
     BlkAioEmAIOCB *acb = opaque;
     BlkRwCo *rwco = &acb->rwco;
 
+    blk_wait_while_drained(rwco->blk);
     rwco->ret = blk_co_ioctl(rwco->blk, rwco->offset, rwco->iobuf);
 
     blk_aio_complete(acb);
@@ -1870,6 +1929,86 @@ void blk_set_aio_context(BlockBackend *blk, AioContext *new_context)
     }
 }
 
+static bool blk_node_supports_multiqueue(BlockDriverState *bs)
+{
+    BdrvChild *child;
+
+    if (!bs->drv || !bs->drv->supports_multiqueue) {
+        return false;
+    }
+    QLIST_FOREACH(child, &bs->children, next) {
+        if (!blk_node_supports_multiqueue(child->bs)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void blk_node_set_multiqueue(BlockDriverState *bs, bool enable)
+{
+    BdrvChild *child;
+
+    if (enable) {
+        atomic_inc(&bs->multiqueue);
+    } else {
+        assert(bs->multiqueue > 0);
+        atomic_dec(&bs->multiqueue);
+    }
+    QLIST_FOREACH(child, &bs->children, next) {
+        blk_node_set_multiqueue(child->bs, enable);
+    }
+}
+
+/*
+ * Enable or disable multiqueue mode.  In multiqueue mode, AIO requests run
+ * and complete in the AioContext of the thread that submits them, rather
+ * than in the AioContext of the root node, so that devices can submit
+ * requests from several IOThreads in parallel.
+ *
+ * This requires every node below @blk to support it, and the graph must
+ * not change while multiqueue mode is enabled; all operations on the root
+ * node are blocked until it is disabled again.  The caller must make sure
+ * that no requests are submitted from other AioContexts when disabling it.
+ */
+int blk_set_multiqueue(BlockBackend *blk, bool enable, Error **errp)
+{
+    BlockDriverState *bs = blk_bs(blk);
+
+    if (enable == blk->multiqueue) {
+        return 0;
+    }
+
+    if (enable) {
+        if (!bs || !blk_node_supports_multiqueue(bs)) {
+            error_setg(errp, "Multiqueue is only supported with the raw "
+                       "format on top of files and host devices");
+            return -ENOTSUP;
+        }
+        if (blk->public.throttle_group_member.throttle_state) {
+            /* Throttle groups run their timers in a single AioContext */
+            error_setg(errp, "Multiqueue is not supported with I/O "
+                       "throttling");
+            return -ENOTSUP;
+        }
+        error_setg(&blk->multiqueue_blocker,
+                   "Block device is used by several IOThreads");
+        bdrv_op_block_all(bs, blk->multiqueue_blocker);
+        blk_node_set_multiqueue(bs, true);
+    } else {
+        blk_node_set_multiqueue(bs, false);
+        bdrv_op_unblock_all(bs, blk->multiqueue_blocker);
+        error_free(blk->multiqueue_blocker);
+        blk->multiqueue_blocker = NULL;
+    }
+    blk->multiqueue = enable;
+    return 0;
+}
+
+bool blk_is_multiqueue(BlockBackend *blk)
+{
+    return blk->multiqueue;
+}
+
 void blk_add_aio_context_notifier(BlockBackend *blk,
         void (*attached_aio_context)(AioContext *new_context, void *opaque),
         void (*detach_aio_context)(void *opaque), void *opaque)
@@ -2153,8 +2292,13 @@ void blk_io_limits_update_group(BlockBackend *blk, const char *group)
 static void blk_root_drained_begin(BdrvChild *child)
 {
     BlockBackend *blk = child->opaque;
+    int quiesce_counter;
+
+    qemu_mutex_lock(&blk->queued_requests_lock);
+    quiesce_counter = ++blk->quiesce_counter;
+    qemu_mutex_unlock(&blk->queued_requests_lock);
 
-    if (++blk->quiesce_counter == 1) {
+    if (quiesce_counter == 1) {
         if (blk->dev_ops && blk->dev_ops->drained_begin) {
             blk->dev_ops->drained_begin(blk->dev_opaque);
         }
@@ -2183,11 +2327,19 @@ static void blk_root_drained_end(BdrvChild *child)
     assert(blk->public.throttle_group_member.io_limits_disabled);
     atomic_dec(&blk->public.throttle_group_member.io_limits_disabled);
 
+    qemu_mutex_lock(&blk->queued_requests_lock);
     if (--blk->quiesce_counter == 0) {
+        qemu_mutex_unlock(&blk->queued_requests_lock);
         if (blk->dev_ops && blk->dev_ops->drained_end) {
             blk->dev_ops->drained_end(blk->dev_opaque);
         }
+        qemu_mutex_lock(&blk->queued_requests_lock);
+        while (qemu_co_enter_next(&blk->queued_requests,
+                                  &blk->queued_requests_lock)) {
+            /* Resume all queued requests */
+        }
     }
+    qemu_mutex_unlock(&blk->queued_requests_lock);
 }
 
 void blk_register_buf(BlockBackend *blk, void *host, size_t size)
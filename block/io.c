@@ -597,6 +597,7 @@ static void tracked_request_end(BdrvTrackedRequest *req)
 
     qemu_co_mutex_lock(&req->bs->reqs_lock);
     QLIST_REMOVE(req, list);
+    interval_tree_remove(&req->bs->overlap_tree, &req->overlap_node);
     qemu_co_queue_restart_all(&req->wait_queue);
     qemu_co_mutex_unlock(&req->bs->reqs_lock);
 }
@@ -624,25 +625,44 @@ static void tracked_request_begin(BdrvTrackedRequest *req,
     };
 
     qemu_co_queue_init(&req->wait_queue);
+    req->overlap_node.start = offset;
+    req->overlap_node.end = offset + bytes;
 
     qemu_co_mutex_lock(&bs->reqs_lock);
     QLIST_INSERT_HEAD(&bs->tracked_requests, req, list);
+    interval_tree_insert(&bs->overlap_tree, &req->overlap_node);
     qemu_co_mutex_unlock(&bs->reqs_lock);
 }
 
-static void mark_request_serialising(BdrvTrackedRequest *req, uint64_t align)
+static void coroutine_fn mark_request_serialising(BdrvTrackedRequest *req,
+                                                  uint64_t align)
 {
+    BlockDriverState *bs = req->bs;
     int64_t overlap_offset = req->offset & ~(align - 1);
     uint64_t overlap_bytes = ROUND_UP(req->offset + req->bytes, align)
                                - overlap_offset;
 
     if (!req->serialising) {
-        atomic_inc(&req->bs->serialising_in_flight);
+        atomic_inc(&bs->serialising_in_flight);
         req->serialising = true;
     }
 
-    req->overlap_offset = MIN(req->overlap_offset, overlap_offset);
-    req->overlap_bytes = MAX(req->overlap_bytes, overlap_bytes);
+    overlap_offset = MIN(req->overlap_offset, overlap_offset);
+    overlap_bytes = MAX(req->overlap_bytes, overlap_bytes);
+    if (overlap_offset == req->overlap_offset &&
+        overlap_bytes == req->overlap_bytes) {
+        return;
+    }
+
+    /* The overlap range is the key in overlap_tree, move the request */
+    qemu_co_mutex_lock(&bs->reqs_lock);
+    interval_tree_remove(&bs->overlap_tree, &req->overlap_node);
+    req->overlap_offset = overlap_offset;
+    req->overlap_bytes = overlap_bytes;
+    req->overlap_node.start = overlap_offset;
+    req->overlap_node.end = overlap_offset + overlap_bytes;
+    interval_tree_insert(&bs->overlap_tree, &req->overlap_node);
+    qemu_co_mutex_unlock(&bs->reqs_lock);
 }
 
 static bool is_request_serialising_and_aligned(BdrvTrackedRequest *req)
@@ -690,18 +710,30 @@ static int bdrv_get_cluster_size(BlockDriverState *bs)
     }
 }
 
-static bool tracked_request_overlaps(BdrvTrackedRequest *req,
-                                     int64_t offset, uint64_t bytes)
+/*
+ * Called for each request that overlaps @opaque; return true if @opaque
+ * has to wait for it.
+ */
+static bool tracked_request_blocks(IntervalTreeNode *node, void *opaque)
 {
-    /*        aaaa   bbbb */
-    if (offset >= req->overlap_offset + req->overlap_bytes) {
-        return false;
-    }
-    /* bbbb   aaaa        */
-    if (req->overlap_offset >= offset + bytes) {
+    BdrvTrackedRequest *self = opaque;
+    BdrvTrackedRequest *req = container_of(node, BdrvTrackedRequest,
+                                           overlap_node);
+
+    if (req == self || (!req->serialising && !self->serialising)) {
         return false;
     }
-    return true;
+
+    /* Hitting this means there was a reentrant request, for
+     * example, a block driver issuing nested requests.  This must
+     * never happen since it means deadlock.
+     */
+    assert(qemu_coroutine_self() != req->co);
+
+    /* If the request is already (indirectly) waiting for us, or
+     * will wait for us as soon as it wakes up, then just go on
+     * (instead of producing a deadlock in the former case). */
+    return !req->waiting_for;
 }
 
 void bdrv_inc_in_flight(BlockDriverState *bs)
@@ -723,7 +755,7 @@ void bdrv_dec_in_flight(BlockDriverState *bs)
 static bool coroutine_fn wait_serialising_requests(BdrvTrackedRequest *self)
 {
     BlockDriverState *bs = self->bs;
-    BdrvTrackedRequest *req;
+    IntervalTreeNode *node;
     bool retry;
     bool waited = false;
 
@@ -734,31 +766,18 @@ static bool coroutine_fn wait_serialising_requests(BdrvTrackedRequest *self)
     do {
         retry = false;
         qemu_co_mutex_lock(&bs->reqs_lock);
-        QLIST_FOREACH(req, &bs->tracked_requests, list) {
-            if (req == self || (!req->serialising && !self->serialising)) {
-                continue;
-            }
-            if (tracked_request_overlaps(req, self->overlap_offset,
-                                         self->overlap_bytes))
-            {
-                /* Hitting this means there was a reentrant request, for
-                 * example, a block driver issuing nested requests.  This must
-                 * never happen since it means deadlock.
-                 */
-                assert(qemu_coroutine_self() != req->co);
-
-                /* If the request is already (indirectly) waiting for us, or
-                 * will wait for us as soon as it wakes up, then just go on
-                 * (instead of producing a deadlock in the former case). */
-                if (!req->waiting_for) {
-                    self->waiting_for = req;
-                    qemu_co_queue_wait(&req->wait_queue, &bs->reqs_lock);
-                    self->waiting_for = NULL;
-                    retry = true;
-                    waited = true;
-                    break;
-                }
-            }
+        node = interval_tree_find(&bs->overlap_tree, self->overlap_offset,
+                                  self->overlap_offset + self->overlap_bytes,
+                                  tracked_request_blocks, self);
+        if (node) {
+            BdrvTrackedRequest *req = container_of(node, BdrvTrackedRequest,
+                                                   overlap_node);
+
+            self->waiting_for = req;
+            qemu_co_queue_wait(&req->wait_queue, &bs->reqs_lock);
+            self->waiting_for = NULL;
+            retry = true;
+            waited = true;
         }
         qemu_co_mutex_unlock(&bs->reqs_lock);
     } while (retry);
@@ -2938,14 +2957,15 @@ void bdrv_add_before_write_notifier(BlockDriverState *bs,
 
 void bdrv_io_plug(BlockDriverState *bs)
 {
+    BlockDriver *drv = bs->drv;
     BdrvChild *child;
 
     QLIST_FOREACH(child, &bs->children, next) {
         bdrv_io_plug(child->bs);
     }
 
-    if (atomic_fetch_inc(&bs->io_plugged) == 0) {
-        BlockDriver *drv = bs->drv;
+    if (atomic_fetch_inc(&bs->io_plugged) == 0 ||
+        (drv && drv->supports_multiqueue)) {
         if (drv && drv->bdrv_io_plug) {
             drv->bdrv_io_plug(bs);
         }
@@ -2954,11 +2974,12 @@ void bdrv_io_plug(BlockDriverState *bs)
 
 void bdrv_io_unplug(BlockDriverState *bs)
 {
+    BlockDriver *drv = bs->drv;
     BdrvChild *child;
 
     assert(bs->io_plugged);
-    if (atomic_fetch_dec(&bs->io_plugged) == 1) {
-        BlockDriver *drv = bs->drv;
+    if (atomic_fetch_dec(&bs->io_plugged) == 1 ||
+        (drv && drv->supports_multiqueue)) {
         if (drv && drv->bdrv_io_unplug) {
             drv->bdrv_io_unplug(bs);
         }
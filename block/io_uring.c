@@ -0,0 +1,494 @@
+/*
+ * Linux io_uring support.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include <liburing.h>
+#include "qemu-common.h"
+#include "block/aio.h"
+#include "qemu/queue.h"
+#include "block/block.h"
+#include "block/raw-aio.h"
+#include "qemu/coroutine.h"
+#include "qapi/error.h"
+#include "trace.h"
+
+/* io_uring ring size */
+#define MAX_ENTRIES 128
+
+/* Number of files that can be registered with the ring */
+#define MAX_FIXED_FILES 64
+
+typedef struct LuringAIOCB {
+    Coroutine *co;
+    struct io_uring_sqe sqeq;
+    ssize_t ret;
+    QEMUIOVector *qiov;
+    bool is_read;
+    QSIMPLEQ_ENTRY(LuringAIOCB) next;
+
+    /*
+     * Buffered reads may return short even before EOF.  The rest of the
+     * request is then resubmitted with resubmit_qiov, which covers the
+     * part of @qiov that has not been read yet.
+     */
+    int total_read;
+    QEMUIOVector resubmit_qiov;
+} LuringAIOCB;
+
+typedef struct LuringQueue {
+    int plugged;
+    /* Requests in submit_queue */
+    unsigned int in_queue;
+    /* Requests copied to the submission ring that the kernel has not taken */
+    unsigned int in_ring;
+    unsigned int in_flight;
+    bool blocked;
+    QSIMPLEQ_HEAD(, LuringAIOCB) submit_queue;
+} LuringQueue;
+
+struct LuringState {
+    AioContext *aio_context;
+
+    struct io_uring ring;
+
+    /* io queue for submit at batch.  Protected by AioContext lock. */
+    LuringQueue io_q;
+
+    /* I/O completion processing.  Only runs in I/O thread.  */
+    QEMUBH *completion_bh;
+
+    /*
+     * File descriptors registered with the ring, -1 for free slots.
+     * Requests on registered files save the kernel an fget/fput pair.
+     */
+    int fixed_files[MAX_FIXED_FILES];
+    bool has_fixed_files;
+};
+
+static void ioq_submit(LuringState *s);
+
+/* Queue a request again, e.g. after -EAGAIN or a short read */
+static void luring_resubmit(LuringState *s, LuringAIOCB *luringcb)
+{
+    QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
+    s->io_q.in_queue++;
+}
+
+static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
+                                       int nread)
+{
+    QEMUIOVector *resubmit_qiov = &luringcb->resubmit_qiov;
+    struct io_uring_sqe *sqe = &luringcb->sqeq;
+    size_t remaining;
+
+    trace_luring_resubmit_short_read(s, luringcb, nread);
+
+    luringcb->total_read += nread;
+    remaining = luringcb->qiov->size - luringcb->total_read;
+
+    if (resubmit_qiov->iov == NULL) {
+        qemu_iovec_init(resubmit_qiov, luringcb->qiov->niov);
+    } else {
+        qemu_iovec_reset(resubmit_qiov);
+    }
+    qemu_iovec_concat(resubmit_qiov, luringcb->qiov, luringcb->total_read,
+                      remaining);
+
+    sqe->addr = (uintptr_t)resubmit_qiov->iov;
+    sqe->len = resubmit_qiov->niov;
+    sqe->off += nread;
+
+    luring_resubmit(s, luringcb);
+}
+
+/*
+ * Completes an io_uring request: turns the result into an error code, or
+ * resubmits the rest of the request, and wakes up the coroutine.
+ */
+static void luring_process_completion(LuringState *s, LuringAIOCB *luringcb,
+                                      int ret)
+{
+    QEMUIOVector *qiov = luringcb->qiov;
+
+    if (ret == -EINTR || ret == -EAGAIN) {
+        luring_resubmit(s, luringcb);
+        return;
+    }
+
+    if (ret >= 0 && qiov) {
+        if (luringcb->total_read + ret == qiov->size) {
+            ret = 0;
+        } else if (!luringcb->is_read) {
+            ret = -ENOSPC;
+        } else if (ret > 0) {
+            luring_resubmit_short_read(s, luringcb, ret);
+            return;
+        } else {
+            /* Short reads mean EOF, pad with zeros. */
+            qemu_iovec_memset(qiov, luringcb->total_read, 0,
+                              qiov->size - luringcb->total_read);
+        }
+    } else if (ret > 0) {
+        ret = 0;
+    }
+
+    if (luringcb->resubmit_qiov.iov != NULL) {
+        qemu_iovec_destroy(&luringcb->resubmit_qiov);
+    }
+
+    luringcb->ret = ret;
+    /* If the coroutine is already entered it must be in ioq_submit() and
+     * will notice luringcb->ret has been filled in when it eventually runs
+     * later.  Coroutines cannot be entered recursively so avoid doing
+     * that!
+     */
+    if (!qemu_coroutine_entered(luringcb->co)) {
+        aio_co_wake(luringcb->co);
+    }
+}
+
+/**
+ * luring_process_completions:
+ * @s: AIO state
+ *
+ * Fetches completed I/O requests and invokes their callbacks.
+ *
+ * Each completion is consumed from the ring before its callback runs,
+ * so a callback can invoke aio_poll() and process the next completions
+ * in a nested event loop.  The BH makes sure that completions are not
+ * forgotten if a nested event loop returns before this one is done.
+ */
+static void luring_process_completions(LuringState *s)
+{
+    struct io_uring_cqe *cqe;
+
+    /* Reschedule so nested event loops see currently pending completions */
+    qemu_bh_schedule(s->completion_bh);
+
+    while (io_uring_peek_cqe(&s->ring, &cqe) == 0 && cqe) {
+        LuringAIOCB *luringcb = io_uring_cqe_get_data(cqe);
+        int ret = cqe->res;
+
+        io_uring_cqe_seen(&s->ring, cqe);
+
+        /* Change counters one-by-one because we can be nested. */
+        s->io_q.in_flight--;
+        trace_luring_process_completion(s, luringcb, ret);
+        luring_process_completion(s, luringcb, ret);
+    }
+
+    qemu_bh_cancel(s->completion_bh);
+}
+
+static void luring_process_completions_and_submit(LuringState *s)
+{
+    aio_context_acquire(s->aio_context);
+    luring_process_completions(s);
+
+    if (!s->io_q.plugged && s->io_q.in_queue + s->io_q.in_ring > 0) {
+        ioq_submit(s);
+    }
+    aio_context_release(s->aio_context);
+}
+
+static void qemu_luring_completion_bh(void *opaque)
+{
+    LuringState *s = opaque;
+
+    luring_process_completions_and_submit(s);
+}
+
+static void qemu_luring_completion_cb(void *opaque)
+{
+    LuringState *s = opaque;
+
+    luring_process_completions_and_submit(s);
+}
+
+static bool qemu_luring_poll_cb(void *opaque)
+{
+    LuringState *s = opaque;
+    struct io_uring_cqe *cqe;
+
+    if (io_uring_peek_cqe(&s->ring, &cqe) != 0 || !cqe) {
+        return false;
+    }
+
+    luring_process_completions_and_submit(s);
+    return true;
+}
+
+static void ioq_init(LuringQueue *io_q)
+{
+    QSIMPLEQ_INIT(&io_q->submit_queue);
+    io_q->plugged = 0;
+    io_q->in_queue = 0;
+    io_q->in_ring = 0;
+    io_q->in_flight = 0;
+    io_q->blocked = false;
+}
+
+/* Fail the requests that have not been copied to the submission ring */
+static void ioq_fail_queued(LuringState *s, int ret)
+{
+    LuringAIOCB *luringcb;
+
+    while ((luringcb = QSIMPLEQ_FIRST(&s->io_q.submit_queue))) {
+        QSIMPLEQ_REMOVE_HEAD(&s->io_q.submit_queue, next);
+        s->io_q.in_queue--;
+        if (luringcb->resubmit_qiov.iov != NULL) {
+            qemu_iovec_destroy(&luringcb->resubmit_qiov);
+        }
+        luringcb->ret = ret;
+        if (!qemu_coroutine_entered(luringcb->co)) {
+            aio_co_wake(luringcb->co);
+        }
+    }
+}
+
+/*
+ * Moves as many queued requests as fit into the submission ring, and
+ * submits them all with a single system call.
+ *
+ * When the kernel takes none of them, the requests already in the ring
+ * stay there and go with the next submission.  If the kernel is only
+ * short of resources, that submission is retried when a request
+ * completes, or from the completion BH if none is in flight.  Any other
+ * error fails the requests that are still queued; those in the ring
+ * belong to the kernel once published, and are left to it.
+ */
+static void ioq_submit(LuringState *s)
+{
+    int ret = 0;
+    LuringAIOCB *luringcb, *luringcb_next;
+
+    while (s->io_q.in_queue + s->io_q.in_ring > 0) {
+        QSIMPLEQ_FOREACH_SAFE(luringcb, &s->io_q.submit_queue, next,
+                              luringcb_next) {
+            struct io_uring_sqe *sqe = io_uring_get_sqe(&s->ring);
+
+            if (!sqe) {
+                break;
+            }
+            *sqe = luringcb->sqeq;
+            QSIMPLEQ_REMOVE_HEAD(&s->io_q.submit_queue, next);
+            s->io_q.in_queue--;
+            s->io_q.in_ring++;
+        }
+
+        ret = io_uring_submit(&s->ring);
+        trace_luring_io_uring_submit(s, ret);
+        if (ret <= 0) {
+            break;
+        }
+        s->io_q.in_flight += ret;
+        s->io_q.in_ring -= ret;
+    }
+
+    if (ret < 0 && ret != -EAGAIN && ret != -EBUSY && ret != -EINTR) {
+        ioq_fail_queued(s, ret);
+        /* Let the next request try again, rather than queue up behind */
+        s->io_q.blocked = false;
+    } else {
+        s->io_q.blocked = (s->io_q.in_queue + s->io_q.in_ring > 0);
+    }
+
+    if (s->io_q.in_flight) {
+        /* We can try to complete something just right away if there are
+         * still requests in-flight. */
+        luring_process_completions(s);
+
+        /* Some of them may have been queued again, submit them later */
+        if (s->io_q.in_queue > 0 && !s->io_q.blocked) {
+            qemu_bh_schedule(s->completion_bh);
+        }
+    } else if (s->io_q.blocked) {
+        /* No completion is going to retry the submission */
+        qemu_bh_schedule(s->completion_bh);
+    }
+}
+
+void luring_io_plug(BlockDriverState *bs, LuringState *s)
+{
+    trace_luring_io_plug(s);
+    s->io_q.plugged++;
+}
+
+void luring_io_unplug(BlockDriverState *bs, LuringState *s)
+{
+    assert(s->io_q.plugged);
+    trace_luring_io_unplug(s, s->io_q.blocked, s->io_q.plugged,
+                           s->io_q.in_queue, s->io_q.in_flight);
+    if (--s->io_q.plugged == 0 &&
+        !s->io_q.blocked && s->io_q.in_queue + s->io_q.in_ring > 0) {
+        ioq_submit(s);
+    }
+}
+
+/* Return the slot of @fd in the registered files, or -1 */
+static int luring_fixed_file(LuringState *s, int fd)
+{
+    int i, free_slot = -1;
+
+    if (!s->has_fixed_files) {
+        return -1;
+    }
+    for (i = 0; i < MAX_FIXED_FILES; i++) {
+        if (s->fixed_files[i] == fd) {
+            return i;
+        }
+        if (s->fixed_files[i] == -1 && free_slot == -1) {
+            free_slot = i;
+        }
+    }
+    if (free_slot == -1 ||
+        io_uring_register_files_update(&s->ring, free_slot, &fd, 1) != 1) {
+        return -1;
+    }
+    s->fixed_files[free_slot] = fd;
+    return free_slot;
+}
+
+void luring_unregister_fd(LuringState *s, int fd)
+{
+    int unused = -1;
+    int i;
+
+    for (i = 0; i < MAX_FIXED_FILES; i++) {
+        if (s->fixed_files[i] == fd) {
+            io_uring_register_files_update(&s->ring, i, &unused, 1);
+            s->fixed_files[i] = -1;
+            return;
+        }
+    }
+}
+
+static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
+                            uint64_t offset, int type, bool fixed)
+{
+    struct io_uring_sqe *sqe = &luringcb->sqeq;
+    int slot;
+
+    switch (type) {
+    case QEMU_AIO_WRITE:
+        io_uring_prep_writev(sqe, fd, luringcb->qiov->iov,
+                             luringcb->qiov->niov, offset);
+        break;
+    case QEMU_AIO_READ:
+        io_uring_prep_readv(sqe, fd, luringcb->qiov->iov,
+                            luringcb->qiov->niov, offset);
+        break;
+    case QEMU_AIO_FLUSH:
+        io_uring_prep_fsync(sqe, fd, IORING_FSYNC_DATASYNC);
+        break;
+    default:
+        fprintf(stderr, "%s: invalid AIO request type 0x%x.\n",
+                        __func__, type);
+        return -EIO;
+    }
+
+    slot = fixed ? luring_fixed_file(s, fd) : -1;
+    if (slot >= 0) {
+        sqe->fd = slot;
+        sqe->flags |= IOSQE_FIXED_FILE;
+    }
+    io_uring_sqe_set_data(sqe, luringcb);
+
+    QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
+    s->io_q.in_queue++;
+    trace_luring_do_submit(s, s->io_q.blocked, s->io_q.plugged,
+                           s->io_q.in_queue, s->io_q.in_flight);
+    if (!s->io_q.blocked &&
+        (!s->io_q.plugged ||
+         s->io_q.in_flight + s->io_q.in_queue + s->io_q.in_ring >=
+         MAX_ENTRIES)) {
+        ioq_submit(s);
+    }
+
+    return 0;
+}
+
+int coroutine_fn luring_co_submit(BlockDriverState *bs, LuringState *s, int fd,
+                                  uint64_t offset, QEMUIOVector *qiov,
+                                  int type)
+{
+    bool fixed;
+    int ret;
+    LuringAIOCB luringcb = {
+        .co         = qemu_coroutine_self(),
+        .ret        = -EINPROGRESS,
+        .qiov       = qiov,
+        .is_read    = (type == QEMU_AIO_READ),
+    };
+
+    trace_luring_co_submit(bs, s, &luringcb, fd, offset,
+                           qiov ? qiov->size : 0, type);
+    /*
+     * Multiqueue BlockBackends submit from several AioContexts, but only
+     * the ring of the node's own AioContext is told when the file is
+     * closed; don't leave stale registrations in the others.
+     */
+    fixed = bs && bdrv_get_aio_context(bs) == s->aio_context;
+    ret = luring_do_submit(fd, &luringcb, s, offset, type, fixed);
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (luringcb.ret == -EINPROGRESS) {
+        qemu_coroutine_yield();
+    }
+    return luringcb.ret;
+}
+
+void luring_detach_aio_context(LuringState *s, AioContext *old_context)
+{
+    aio_set_fd_handler(old_context, s->ring.ring_fd, false,
+                       NULL, NULL, NULL, s);
+    qemu_bh_delete(s->completion_bh);
+    s->aio_context = NULL;
+}
+
+void luring_attach_aio_context(LuringState *s, AioContext *new_context)
+{
+    s->aio_context = new_context;
+    s->completion_bh = aio_bh_new(new_context, qemu_luring_completion_bh, s);
+    aio_set_fd_handler(s->aio_context, s->ring.ring_fd, false,
+                       qemu_luring_completion_cb, NULL,
+                       qemu_luring_poll_cb, s);
+}
+
+LuringState *luring_init(Error **errp)
+{
+    int rc, i;
+    LuringState *s = g_new0(LuringState, 1);
+
+    trace_luring_init_state(s, sizeof(*s));
+
+    rc = io_uring_queue_init(MAX_ENTRIES, &s->ring, 0);
+    if (rc < 0) {
+        error_setg_errno(errp, -rc, "failed to init linux io_uring ring");
+        g_free(s);
+        return NULL;
+    }
+
+    ioq_init(&s->io_q);
+
+    /* Sparse file tables need Linux 5.5; without them, don't use any */
+    for (i = 0; i < MAX_FIXED_FILES; i++) {
+        s->fixed_files[i] = -1;
+    }
+    s->has_fixed_files = io_uring_register_files(&s->ring, s->fixed_files,
+                                                 MAX_FIXED_FILES) == 0;
+
+    return s;
+}
+
+void luring_cleanup(LuringState *s)
+{
+    io_uring_queue_exit(&s->ring);
+    trace_luring_cleanup_state(s);
+    g_free(s);
+}
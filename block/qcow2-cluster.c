@@ -201,6 +201,7 @@ int qcow2_grow_l1_table(BlockDriverState *bs, uint64_t min_size,
  *          table to load.
  * @l2_offset: Offset to the L2 table in the image file.
  * @l2_slice: Location to store the pointer to the L2 slice.
+ * @nowait: Fail with -EAGAIN instead of loading the slice from the file.
  *
  * Loads a L2 slice into memory (L2 slices are the parts of L2 tables
  * that are loaded by the qcow2 cache). If the slice is in the cache,
@@ -208,12 +209,17 @@ int qcow2_grow_l1_table(BlockDriverState *bs, uint64_t min_size,
  * file.
  */
 static int l2_load(BlockDriverState *bs, uint64_t offset,
-                   uint64_t l2_offset, uint64_t **l2_slice)
+                   uint64_t l2_offset, uint64_t **l2_slice, bool nowait)
 {
     BDRVQcow2State *s = bs->opaque;
-    int start_of_slice = sizeof(uint64_t) *
+    int start_of_slice = l2_entry_size(s) *
         (offset_to_l2_index(s, offset) - offset_to_l2_slice_index(s, offset));
 
+    if (nowait) {
+        return qcow2_cache_get_nowait(s->l2_table_cache,
+                                      l2_offset + start_of_slice,
+                                      (void **)l2_slice);
+    }
     return qcow2_cache_get(bs, s->l2_table_cache, l2_offset + start_of_slice,
                            (void **)l2_slice);
 }
@@ -279,7 +285,7 @@ static int l2_allocate(BlockDriverState *bs, int l1_index)
 
     /* allocate a new l2 entry */
 
-    l2_offset = qcow2_alloc_clusters(bs, s->l2_size * sizeof(uint64_t));
+    l2_offset = qcow2_alloc_clusters(bs, s->l2_size * l2_entry_size(s));
     if (l2_offset < 0) {
         ret = l2_offset;
         goto fail;
@@ -300,7 +306,7 @@ static int l2_allocate(BlockDriverState *bs, int l1_index)
 
     /* allocate a new entry in the l2 cache */
 
-    slice_size2 = s->l2_slice_size * sizeof(uint64_t);
+    slice_size2 = s->l2_slice_size * l2_entry_size(s);
     n_slices = s->cluster_size / slice_size2;
 
     trace_qcow2_l2_allocate_get_empty(bs, l1_index);
@@ -364,7 +370,7 @@ fail:
     }
     s->l1_table[l1_index] = old_l2_offset;
     if (l2_offset > 0) {
-        qcow2_free_clusters(bs, l2_offset, s->l2_size * sizeof(uint64_t),
+        qcow2_free_clusters(bs, l2_offset, s->l2_size * l2_entry_size(s),
                             QCOW2_DISCARD_ALWAYS);
     }
     return ret;
@@ -377,13 +383,13 @@ fail:
  * as contiguous. (This allows it, for example, to stop at the first compressed
  * cluster which may require a different handling)
  */
-static int count_contiguous_clusters(int nb_clusters, int cluster_size,
-        uint64_t *l2_slice, uint64_t stop_flags)
+static int count_contiguous_clusters(BDRVQcow2State *s, int nb_clusters,
+        uint64_t *l2_slice, int l2_index, uint64_t stop_flags)
 {
     int i;
     QCow2ClusterType first_cluster_type;
     uint64_t mask = stop_flags | L2E_OFFSET_MASK | QCOW_OFLAG_COMPRESSED;
-    uint64_t first_entry = be64_to_cpu(l2_slice[0]);
+    uint64_t first_entry = get_l2_entry(s, l2_slice, l2_index);
     uint64_t offset = first_entry & mask;
 
     if (!offset) {
@@ -396,8 +402,8 @@ static int count_contiguous_clusters(int nb_clusters, int cluster_size,
            first_cluster_type == QCOW2_CLUSTER_ZERO_ALLOC);
 
     for (i = 0; i < nb_clusters; i++) {
-        uint64_t l2_entry = be64_to_cpu(l2_slice[i]) & mask;
-        if (offset + (uint64_t) i * cluster_size != l2_entry) {
+        uint64_t l2_entry = get_l2_entry(s, l2_slice, l2_index + i) & mask;
+        if (offset + (uint64_t) i * s->cluster_size != l2_entry) {
             break;
         }
     }
@@ -406,27 +412,100 @@ static int count_contiguous_clusters(int nb_clusters, int cluster_size,
 }
 
 /*
- * Checks how many consecutive unallocated clusters in a given L2
- * slice have the same cluster type.
+ * Returns the number of subclusters, starting at @sc_from, of the cluster
+ * described by @l2_entry and @l2_bitmap that have the same type as
+ * subcluster @sc_from.  The type is stored in *type.
+ *
+ * Returns -EINVAL if the entry is invalid.
  */
-static int count_contiguous_clusters_unallocated(int nb_clusters,
-                                                 uint64_t *l2_slice,
-                                                 QCow2ClusterType wanted_type)
+static int get_subcluster_range_type(BDRVQcow2State *s, uint64_t l2_entry,
+                                     uint64_t l2_bitmap, unsigned sc_from,
+                                     QCow2SubclusterType *type)
 {
-    int i;
+    uint32_t val;
 
-    assert(wanted_type == QCOW2_CLUSTER_ZERO_PLAIN ||
-           wanted_type == QCOW2_CLUSTER_UNALLOCATED);
-    for (i = 0; i < nb_clusters; i++) {
-        uint64_t entry = be64_to_cpu(l2_slice[i]);
-        QCow2ClusterType type = qcow2_get_cluster_type(entry);
+    *type = qcow2_get_subcluster_type(s, l2_entry, l2_bitmap, sc_from);
+
+    if (*type == QCOW2_SUBCLUSTER_INVALID) {
+        return -EINVAL;
+    } else if (!has_subclusters(s) || *type == QCOW2_SUBCLUSTER_COMPRESSED) {
+        return s->subclusters_per_cluster - sc_from;
+    }
+
+    switch (*type) {
+    case QCOW2_SUBCLUSTER_NORMAL:
+        val = l2_bitmap | QCOW_OFLAG_SUB_ALLOC_RANGE(0, sc_from);
+        return cto32(val) - sc_from;
 
-        if (type != wanted_type) {
+    case QCOW2_SUBCLUSTER_ZERO_PLAIN:
+    case QCOW2_SUBCLUSTER_ZERO_ALLOC:
+        val = (l2_bitmap | QCOW_OFLAG_SUB_ZERO_RANGE(0, sc_from)) >> 32;
+        return cto32(val) - sc_from;
+
+    case QCOW2_SUBCLUSTER_UNALLOCATED_PLAIN:
+    case QCOW2_SUBCLUSTER_UNALLOCATED_ALLOC:
+        val = ((l2_bitmap >> 32) | l2_bitmap)
+              & ~QCOW_OFLAG_SUB_ALLOC_RANGE(0, sc_from);
+        return ctz32(val) - sc_from;
+
+    default:
+        abort();
+    }
+}
+
+/*
+ * Checks how many subclusters, starting at subcluster @sc_index of the
+ * cluster at @l2_index and looking at no more than @nb_clusters clusters,
+ * have the same type as the first one.  Allocated subclusters must also be
+ * contiguous in the image file.  Compressed clusters are counted one by one.
+ *
+ * Returns 0 if the first cluster has an invalid entry; a run of subclusters
+ * stops before any other invalid entry.
+ */
+static int count_contiguous_subclusters(BDRVQcow2State *s, int nb_clusters,
+                                        unsigned sc_index, uint64_t *l2_slice,
+                                        int l2_index)
+{
+    int i, count = 0;
+    bool check_offset = false;
+    uint64_t expected_offset = 0;
+    QCow2SubclusterType expected_type = QCOW2_SUBCLUSTER_NORMAL, type;
+
+    assert(l2_index + nb_clusters <= s->l2_slice_size);
+
+    for (i = 0; i < nb_clusters; i++) {
+        unsigned first_sc = (i == 0) ? sc_index : 0;
+        uint64_t l2_entry = get_l2_entry(s, l2_slice, l2_index + i);
+        uint64_t l2_bitmap = get_l2_bitmap(s, l2_slice, l2_index + i);
+        int ret = get_subcluster_range_type(s, l2_entry, l2_bitmap, first_sc,
+                                            &type);
+        if (ret < 0) {
+            break;
+        }
+        if (i == 0) {
+            if (type == QCOW2_SUBCLUSTER_COMPRESSED) {
+                return ret;
+            }
+            expected_type = type;
+            expected_offset = l2_entry & L2E_OFFSET_MASK;
+            check_offset = (type == QCOW2_SUBCLUSTER_NORMAL ||
+                            type == QCOW2_SUBCLUSTER_ZERO_ALLOC);
+        } else if (type != expected_type) {
+            break;
+        } else if (check_offset) {
+            expected_offset += s->cluster_size;
+            if (expected_offset != (l2_entry & L2E_OFFSET_MASK)) {
+                break;
+            }
+        }
+        count += ret;
+        /* The type changes within this cluster */
+        if (first_sc + ret < s->subclusters_per_cluster) {
             break;
         }
     }
 
-    return i;
+    return count;
 }
 
 static int coroutine_fn do_perform_cow_read(BlockDriverState *bs,
@@ -512,29 +591,36 @@ static int coroutine_fn do_perform_cow_write(BlockDriverState *bs,
 /*
  * get_cluster_offset
  *
- * For a given offset of the virtual disk, find the cluster type and offset in
- * the qcow2 file. The offset is stored in *cluster_offset.
+ * For a given offset of the virtual disk, find the subcluster type and the
+ * offset of the cluster in the qcow2 file. The offset is stored in
+ * *cluster_offset; it is 0 for subclusters that do not read from the image
+ * file.
  *
  * On entry, *bytes is the maximum number of contiguous bytes starting at
  * offset that we are interested in.
  *
  * On exit, *bytes is the number of bytes starting at offset that have the same
- * cluster type and (if applicable) are stored contiguously in the image file.
- * Compressed clusters are always returned one by one.
+ * subcluster type and (if applicable) are stored contiguously in the image
+ * file. Compressed clusters are always returned one by one.
  *
- * Returns the cluster type (QCOW2_CLUSTER_*) on success, -errno in error
+ * With @nowait, the function never yields: it fails with -EAGAIN if the L2
+ * slice is not cached or if it finds a corrupted entry, which can only be
+ * reported by yielding.
+ *
+ * Returns the subcluster type (QCOW2_SUBCLUSTER_*) on success, -errno in error
  * cases.
  */
-int qcow2_get_cluster_offset(BlockDriverState *bs, uint64_t offset,
-                             unsigned int *bytes, uint64_t *cluster_offset)
+static int get_cluster_offset(BlockDriverState *bs, uint64_t offset,
+                              unsigned int *bytes, uint64_t *cluster_offset,
+                              bool nowait)
 {
     BDRVQcow2State *s = bs->opaque;
-    unsigned int l2_index;
-    uint64_t l1_index, l2_offset, *l2_slice;
-    int c;
+    unsigned int l2_index, sc_index;
+    uint64_t l1_index, l2_offset, *l2_slice, l2_entry, l2_bitmap;
+    int sc;
     unsigned int offset_in_cluster;
     uint64_t bytes_available, bytes_needed, nb_clusters;
-    QCow2ClusterType type;
+    QCow2SubclusterType type;
     int ret;
 
     offset_in_cluster = offset_into_cluster(s, offset);
@@ -557,17 +643,20 @@ int qcow2_get_cluster_offset(BlockDriverState *bs, uint64_t offset,
 
     l1_index = offset_to_l1_index(s, offset);
     if (l1_index >= s->l1_size) {
-        type = QCOW2_CLUSTER_UNALLOCATED;
+        type = QCOW2_SUBCLUSTER_UNALLOCATED_PLAIN;
         goto out;
     }
 
     l2_offset = s->l1_table[l1_index] & L1E_OFFSET_MASK;
     if (!l2_offset) {
-        type = QCOW2_CLUSTER_UNALLOCATED;
+        type = QCOW2_SUBCLUSTER_UNALLOCATED_PLAIN;
         goto out;
     }
 
     if (offset_into_cluster(s, l2_offset)) {
+        if (nowait) {
+            return -EAGAIN;
+        }
         qcow2_signal_corruption(bs, true, -1, -1, "L2 table offset %#" PRIx64
                                 " unaligned (L1 index: %#" PRIx64 ")",
                                 l2_offset, l1_index);
@@ -576,7 +665,7 @@ int qcow2_get_cluster_offset(BlockDriverState *bs, uint64_t offset,
 
     /* load the l2 slice in memory */
 
-    ret = l2_load(bs, offset, l2_offset, &l2_slice);
+    ret = l2_load(bs, offset, l2_offset, &l2_slice, nowait);
     if (ret < 0) {
         return ret;
     }
@@ -584,7 +673,9 @@ int qcow2_get_cluster_offset(BlockDriverState *bs, uint64_t offset,
     /* find the cluster offset for the given disk offset */
 
     l2_index = offset_to_l2_slice_index(s, offset);
-    *cluster_offset = be64_to_cpu(l2_slice[l2_index]);
+    sc_index = offset_to_sc_index(s, offset);
+    l2_entry = get_l2_entry(s, l2_slice, l2_index);
+    l2_bitmap = get_l2_bitmap(s, l2_slice, l2_index);
 
     nb_clusters = size_to_clusters(s, bytes_needed);
     /* bytes_needed <= *bytes + offset_in_cluster, both of which are unsigned
@@ -592,9 +683,13 @@ int qcow2_get_cluster_offset(BlockDriverState *bs, uint64_t offset,
      * true */
     assert(nb_clusters <= INT_MAX);
 
-    type = qcow2_get_cluster_type(*cluster_offset);
-    if (s->qcow_version < 3 && (type == QCOW2_CLUSTER_ZERO_PLAIN ||
-                                type == QCOW2_CLUSTER_ZERO_ALLOC)) {
+    type = qcow2_get_subcluster_type(s, l2_entry, l2_bitmap, sc_index);
+    if (s->qcow_version < 3 && (type == QCOW2_SUBCLUSTER_ZERO_PLAIN ||
+                                type == QCOW2_SUBCLUSTER_ZERO_ALLOC)) {
+        if (nowait) {
+            ret = -EAGAIN;
+            goto fail;
+        }
         qcow2_signal_corruption(bs, true, -1, -1, "Zero cluster entry found"
                                 " in pre-v3 image (L2 offset: %#" PRIx64
                                 ", L2 index: %#x)", l2_offset, l2_index);
@@ -602,25 +697,32 @@ int qcow2_get_cluster_offset(BlockDriverState *bs, uint64_t offset,
         goto fail;
     }
     switch (type) {
-    case QCOW2_CLUSTER_COMPRESSED:
-        /* Compressed clusters can only be processed one by one */
-        c = 1;
-        *cluster_offset &= L2E_COMPRESSED_OFFSET_SIZE_MASK;
+    case QCOW2_SUBCLUSTER_INVALID:
+        if (nowait) {
+            ret = -EAGAIN;
+            goto fail;
+        }
+        qcow2_signal_corruption(bs, true, -1, -1, "Invalid cluster entry found"
+                                " (L2 offset: %#" PRIx64 ", L2 index: %#x)",
+                                l2_offset, l2_index);
+        ret = -EIO;
+        goto fail;
+    case QCOW2_SUBCLUSTER_COMPRESSED:
+        *cluster_offset = l2_entry & L2E_COMPRESSED_OFFSET_SIZE_MASK;
         break;
-    case QCOW2_CLUSTER_ZERO_PLAIN:
-    case QCOW2_CLUSTER_UNALLOCATED:
-        /* how many empty clusters ? */
-        c = count_contiguous_clusters_unallocated(nb_clusters,
-                                                  &l2_slice[l2_index], type);
+    case QCOW2_SUBCLUSTER_ZERO_PLAIN:
+    case QCOW2_SUBCLUSTER_UNALLOCATED_PLAIN:
+    case QCOW2_SUBCLUSTER_UNALLOCATED_ALLOC:
         *cluster_offset = 0;
         break;
-    case QCOW2_CLUSTER_ZERO_ALLOC:
-    case QCOW2_CLUSTER_NORMAL:
-        /* how many allocated clusters ? */
-        c = count_contiguous_clusters(nb_clusters, s->cluster_size,
-                                      &l2_slice[l2_index], QCOW_OFLAG_ZERO);
-        *cluster_offset &= L2E_OFFSET_MASK;
+    case QCOW2_SUBCLUSTER_ZERO_ALLOC:
+    case QCOW2_SUBCLUSTER_NORMAL:
+        *cluster_offset = l2_entry & L2E_OFFSET_MASK;
         if (offset_into_cluster(s, *cluster_offset)) {
+            if (nowait) {
+                ret = -EAGAIN;
+                goto fail;
+            }
             qcow2_signal_corruption(bs, true, -1, -1,
                                     "Cluster allocation offset %#"
                                     PRIx64 " unaligned (L2 offset: %#" PRIx64
@@ -634,9 +736,14 @@ int qcow2_get_cluster_offset(BlockDriverState *bs, uint64_t offset,
         abort();
     }
 
+    /* how many subclusters of the same type ? */
+    sc = count_contiguous_subclusters(s, nb_clusters, sc_index,
+                                      l2_slice, l2_index);
+    assert(sc > 0);
+
     qcow2_cache_put(s->l2_table_cache, (void **) &l2_slice);
 
-    bytes_available = (int64_t)c * s->cluster_size;
+    bytes_available = ((int64_t)sc + sc_index) << s->subcluster_bits;
 
 out:
     if (bytes_available > bytes_needed) {
@@ -656,6 +763,25 @@ fail:
     return ret;
 }
 
+int qcow2_get_cluster_offset(BlockDriverState *bs, uint64_t offset,
+                             unsigned int *bytes, uint64_t *cluster_offset)
+{
+    return get_cluster_offset(bs, offset, bytes, cluster_offset, false);
+}
+
+/*
+ * Like qcow2_get_cluster_offset(), but returns -EAGAIN if the lookup would
+ * have to yield.  The caller need not hold s->lock: qcow2 requests all run
+ * in the AioContext of the node, so nothing else can touch the metadata
+ * while the lookup runs.
+ */
+int qcow2_get_cluster_offset_nowait(BlockDriverState *bs, uint64_t offset,
+                                    unsigned int *bytes,
+                                    uint64_t *cluster_offset)
+{
+    return get_cluster_offset(bs, offset, bytes, cluster_offset, true);
+}
+
 /*
  * get_cluster_table
  *
@@ -704,7 +830,7 @@ static int get_cluster_table(BlockDriverState *bs, uint64_t offset,
 
         /* Then decrease the refcount of the old table */
         if (l2_offset) {
-            qcow2_free_clusters(bs, l2_offset, s->l2_size * sizeof(uint64_t),
+            qcow2_free_clusters(bs, l2_offset, s->l2_size * l2_entry_size(s),
                                 QCOW2_DISCARD_OTHER);
         }
 
@@ -714,7 +840,7 @@ static int get_cluster_table(BlockDriverState *bs, uint64_t offset,
     }
 
     /* load the l2 slice in memory */
-    ret = l2_load(bs, offset, l2_offset, &l2_slice);
+    ret = l2_load(bs, offset, l2_offset, &l2_slice, false);
     if (ret < 0) {
         return ret;
     }
@@ -759,7 +885,7 @@ uint64_t qcow2_alloc_compressed_cluster_offset(BlockDriverState *bs,
 
     /* Compression can't overwrite anything. Fail if the cluster was already
      * allocated. */
-    cluster_offset = be64_to_cpu(l2_slice[l2_index]);
+    cluster_offset = get_l2_entry(s, l2_slice, l2_index);
     if (cluster_offset & L2E_OFFSET_MASK) {
         qcow2_cache_put(s->l2_table_cache, (void **) &l2_slice);
         return 0;
@@ -783,7 +909,10 @@ uint64_t qcow2_alloc_compressed_cluster_offset(BlockDriverState *bs,
 
     BLKDBG_EVENT(bs->file, BLKDBG_L2_UPDATE_COMPRESSED);
     qcow2_cache_entry_mark_dirty(s->l2_table_cache, l2_slice);
-    l2_slice[l2_index] = cpu_to_be64(cluster_offset);
+    set_l2_entry(s, l2_slice, l2_index, cluster_offset);
+    if (has_subclusters(s)) {
+        set_l2_bitmap(s, l2_slice, l2_index, 0);
+    }
     qcow2_cache_put(s->l2_table_cache, (void **) &l2_slice);
 
     return cluster_offset;
@@ -964,12 +1093,32 @@ int qcow2_alloc_cluster_link_l2(BlockDriverState *bs, QCowL2Meta *m)
          * cluster the second one has to do RMW (which is done above by
          * perform_cow()), update l2 table with its cluster pointer and free
          * old cluster. This is what this loop does */
-        if (l2_slice[l2_index + i] != 0) {
-            old_cluster[j++] = l2_slice[l2_index + i];
+        uint64_t old_entry = get_l2_entry(s, l2_slice, l2_index + i);
+
+        if (old_entry != 0) {
+            old_cluster[j++] = old_entry;
         }
 
-        l2_slice[l2_index + i] = cpu_to_be64((cluster_offset +
-                    (i << s->cluster_bits)) | QCOW_OFLAG_COPIED);
+        set_l2_entry(s, l2_slice, l2_index + i, (cluster_offset +
+                     (i << s->cluster_bits)) | QCOW_OFLAG_COPIED);
+
+        /* Mark the subclusters that we have written to as allocated */
+        if (has_subclusters(s)) {
+            uint64_t l2_bitmap = get_l2_bitmap(s, l2_slice, l2_index + i);
+            uint64_t written_from = m->cow_start.offset;
+            uint64_t written_to = m->cow_end.offset + m->cow_end.nb_bytes;
+            int first_sc, last_sc;
+
+            written_from = MAX(written_from, (uint64_t) i << s->cluster_bits);
+            written_to = MIN(written_to,
+                             (uint64_t) (i + 1) << s->cluster_bits);
+            assert(written_from < written_to);
+            first_sc = offset_to_sc_index(s, written_from);
+            last_sc = offset_to_sc_index(s, written_to - 1);
+            l2_bitmap |= QCOW_OFLAG_SUB_ALLOC_RANGE(first_sc, last_sc + 1);
+            l2_bitmap &= ~QCOW_OFLAG_SUB_ZERO_RANGE(first_sc, last_sc + 1);
+            set_l2_bitmap(s, l2_slice, l2_index + i, l2_bitmap);
+        }
      }
 
 
@@ -983,7 +1132,7 @@ int qcow2_alloc_cluster_link_l2(BlockDriverState *bs, QCowL2Meta *m)
      */
     if (!m->keep_old_clusters && j != 0) {
         for (i = 0; i < j; i++) {
-            qcow2_free_any_clusters(bs, be64_to_cpu(old_cluster[i]), 1,
+            qcow2_free_any_clusters(bs, old_cluster[i], 1,
                                     QCOW2_DISCARD_NEVER);
         }
     }
@@ -1001,6 +1150,11 @@ err:
 void qcow2_alloc_cluster_abort(BlockDriverState *bs, QCowL2Meta *m)
 {
     BDRVQcow2State *s = bs->opaque;
+
+    /* Reused clusters are still referenced by the L2 table */
+    if (m->keep_old_clusters) {
+        return;
+    }
     qcow2_free_clusters(bs, m->alloc_offset, m->nb_clusters << s->cluster_bits,
                         QCOW2_DISCARD_NEVER);
 }
@@ -1016,7 +1170,7 @@ static int count_cow_clusters(BDRVQcow2State *s, int nb_clusters,
     int i;
 
     for (i = 0; i < nb_clusters; i++) {
-        uint64_t l2_entry = be64_to_cpu(l2_slice[l2_index + i]);
+        uint64_t l2_entry = get_l2_entry(s, l2_slice, l2_index + i);
         QCow2ClusterType cluster_type = qcow2_get_cluster_type(l2_entry);
 
         switch(cluster_type) {
@@ -1068,6 +1222,14 @@ static int handle_dependencies(BlockDriverState *bs, uint64_t guest_offset,
         uint64_t old_start = l2meta_cow_start(old_alloc);
         uint64_t old_end = l2meta_cow_end(old_alloc);
 
+        /* A new allocation claims its clusters as a whole, even if it only
+         * writes to some of their subclusters. Reused clusters stay where
+         * they are, so only the subclusters written to matter. */
+        if (!old_alloc->keep_old_clusters) {
+            old_start = start_of_cluster(s, old_start);
+            old_end = ROUND_UP(old_end, s->cluster_size);
+        }
+
         if (end <= old_start || start >= old_end) {
             /* No intersection */
         } else {
@@ -1103,6 +1265,44 @@ static int handle_dependencies(BlockDriverState *bs, uint64_t guest_offset,
     return 0;
 }
 
+/*
+ * Returns how many of the first @nb_clusters clusters at @l2_index have all
+ * subclusters in [@guest_offset, @guest_offset + @bytes) allocated.
+ */
+static int count_allocated_subclusters(BDRVQcow2State *s,
+                                       uint64_t guest_offset, uint64_t bytes,
+                                       int nb_clusters, uint64_t *l2_slice,
+                                       int l2_index)
+{
+    uint64_t from = offset_into_cluster(s, guest_offset);
+    uint64_t to = from + bytes;
+    int i;
+
+    for (i = 0; i < nb_clusters; i++) {
+        uint64_t cluster_start = (uint64_t) i << s->cluster_bits;
+        uint64_t cluster_end = cluster_start + s->cluster_size;
+        uint64_t l2_entry = get_l2_entry(s, l2_slice, l2_index + i);
+        uint64_t l2_bitmap = get_l2_bitmap(s, l2_slice, l2_index + i);
+        unsigned first_sc, last_sc;
+        QCow2SubclusterType type;
+        int ret;
+
+        if (to <= cluster_start) {
+            break;
+        }
+        first_sc = offset_to_sc_index(s, MAX(from, cluster_start));
+        last_sc = offset_to_sc_index(s, MIN(to, cluster_end) - 1);
+        ret = get_subcluster_range_type(s, l2_entry, l2_bitmap, first_sc,
+                                        &type);
+        if (ret < 0 || type != QCOW2_SUBCLUSTER_NORMAL ||
+            first_sc + ret <= last_sc) {
+            break;
+        }
+    }
+
+    return i;
+}
+
 /*
  * Checks how many already allocated clusters that don't require a copy on
  * write there are at the given guest_offset (up to *bytes). If
@@ -1159,7 +1359,7 @@ static int handle_copied(BlockDriverState *bs, uint64_t guest_offset,
         return ret;
     }
 
-    cluster_offset = be64_to_cpu(l2_slice[l2_index]);
+    cluster_offset = get_l2_entry(s, l2_slice, l2_index);
 
     /* Check how many clusters are already allocated and don't need COW */
     if (qcow2_get_cluster_type(cluster_offset) == QCOW2_CLUSTER_NORMAL
@@ -1186,11 +1386,22 @@ static int handle_copied(BlockDriverState *bs, uint64_t guest_offset,
 
         /* We keep all QCOW_OFLAG_COPIED clusters */
         keep_clusters =
-            count_contiguous_clusters(nb_clusters, s->cluster_size,
-                                      &l2_slice[l2_index],
+            count_contiguous_clusters(s, nb_clusters, l2_slice, l2_index,
                                       QCOW_OFLAG_COPIED | QCOW_OFLAG_ZERO);
         assert(keep_clusters <= nb_clusters);
 
+        /* Writing to subclusters that are not allocated yet needs COW and
+         * an L2 update; leave those to handle_alloc() */
+        if (has_subclusters(s)) {
+            keep_clusters = count_allocated_subclusters(s, guest_offset,
+                                                        *bytes, keep_clusters,
+                                                        l2_slice, l2_index);
+            if (keep_clusters == 0) {
+                ret = 0;
+                goto out;
+            }
+        }
+
         *bytes = MIN(*bytes,
                  keep_clusters * s->cluster_size
                  - offset_into_cluster(s, guest_offset));
@@ -1261,6 +1472,52 @@ static int do_alloc_cluster_offset(BlockDriverState *bs, uint64_t guest_offset,
     }
 }
 
+/*
+ * [*from, *to) is the part of one cluster that an allocating write request
+ * writes to; both offsets are relative to the cluster at @l2_index. Widen
+ * it to the area that must be written to the host cluster, i.e. add the
+ * copy on write regions:
+ *
+ * - If the old cluster has data of its own that moves to the new cluster,
+ *   the whole cluster is copied.
+ * - Otherwise, only the subclusters touched by the request are completed.
+ *   In a reused cluster (@keep_old), subclusters that are allocated already
+ *   need no copy at all.
+ *
+ * Without subclusters, this always covers whole clusters.
+ */
+static void cow_subclusters(BDRVQcow2State *s, uint64_t *l2_slice,
+                            int l2_index, bool keep_old,
+                            uint64_t *from, uint64_t *to)
+{
+    int i = *from >> s->cluster_bits;
+    uint64_t cluster_start = (uint64_t) i << s->cluster_bits;
+    uint64_t l2_entry = get_l2_entry(s, l2_slice, l2_index + i);
+    uint64_t l2_bitmap = get_l2_bitmap(s, l2_slice, l2_index + i);
+
+    assert(*from < *to && *to <= cluster_start + s->cluster_size);
+
+    if (!keep_old &&
+        (l2_entry & (L2E_OFFSET_MASK | QCOW_OFLAG_COMPRESSED))) {
+        *from = cluster_start;
+        *to = cluster_start + s->cluster_size;
+        return;
+    }
+
+    if (!keep_old ||
+        qcow2_get_subcluster_type(s, l2_entry, l2_bitmap,
+                                  offset_to_sc_index(s, *from))
+        != QCOW2_SUBCLUSTER_NORMAL) {
+        *from = QEMU_ALIGN_DOWN(*from, s->subcluster_size);
+    }
+    if (!keep_old ||
+        qcow2_get_subcluster_type(s, l2_entry, l2_bitmap,
+                                  offset_to_sc_index(s, *to - 1))
+        != QCOW2_SUBCLUSTER_NORMAL) {
+        *to = QEMU_ALIGN_UP(*to, s->subcluster_size);
+    }
+}
+
 /*
  * Allocates new clusters for an area that either is yet unallocated or needs a
  * copy on write. If *host_offset is non-zero, clusters are only allocated if
@@ -1289,6 +1546,7 @@ static int handle_alloc(BlockDriverState *bs, uint64_t guest_offset,
     uint64_t *l2_slice;
     uint64_t entry;
     uint64_t nb_clusters;
+    QCow2ClusterType type;
     int ret;
     bool keep_old_clusters = false;
 
@@ -1315,11 +1573,27 @@ static int handle_alloc(BlockDriverState *bs, uint64_t guest_offset,
         return ret;
     }
 
-    entry = be64_to_cpu(l2_slice[l2_index]);
+    entry = get_l2_entry(s, l2_slice, l2_index);
+    type = qcow2_get_cluster_type(entry);
+
+    if (qcow2_get_subcluster_type(s, entry, get_l2_bitmap(s, l2_slice, l2_index),
+                                  0) == QCOW2_SUBCLUSTER_INVALID) {
+        qcow2_signal_corruption(bs, true, -1, -1, "Invalid cluster entry "
+                                "found (guest offset: %#" PRIx64 ")",
+                                guest_offset);
+        ret = -EIO;
+        goto fail;
+    }
 
     /* For the moment, overwrite compressed clusters one by one */
     if (entry & QCOW_OFLAG_COMPRESSED) {
         nb_clusters = 1;
+    } else if (has_subclusters(s) && type == QCOW2_CLUSTER_NORMAL &&
+               (entry & QCOW_OFLAG_COPIED)) {
+        /* handle_copied() left this cluster alone because some of the
+         * subclusters that we write to are not allocated yet */
+        nb_clusters = count_contiguous_clusters(s, nb_clusters, l2_slice,
+                                                l2_index, QCOW_OFLAG_COPIED);
     } else {
         nb_clusters = count_cow_clusters(s, nb_clusters, l2_slice, l2_index);
     }
@@ -1329,10 +1603,9 @@ static int handle_alloc(BlockDriverState *bs, uint64_t guest_offset,
      * wrong with our code. */
     assert(nb_clusters > 0);
 
-    if (qcow2_get_cluster_type(entry) == QCOW2_CLUSTER_ZERO_ALLOC &&
-        (entry & QCOW_OFLAG_COPIED) &&
-        (!*host_offset ||
-         start_of_cluster(s, *host_offset) == (entry & L2E_OFFSET_MASK)))
+    if ((type == QCOW2_CLUSTER_ZERO_ALLOC ||
+         (has_subclusters(s) && type == QCOW2_CLUSTER_NORMAL)) &&
+        (entry & QCOW_OFLAG_COPIED))
     {
         int preallocated_nb_clusters;
 
@@ -1345,24 +1618,35 @@ static int handle_alloc(BlockDriverState *bs, uint64_t guest_offset,
             goto fail;
         }
 
-        /* Try to reuse preallocated zero clusters; contiguous normal clusters
-         * would be fine, too, but count_cow_clusters() above has limited
-         * nb_clusters already to a range of COW clusters */
-        preallocated_nb_clusters =
-            count_contiguous_clusters(nb_clusters, s->cluster_size,
-                                      &l2_slice[l2_index], QCOW_OFLAG_COPIED);
-        assert(preallocated_nb_clusters > 0);
-
-        nb_clusters = preallocated_nb_clusters;
-        alloc_cluster_offset = entry & L2E_OFFSET_MASK;
-
-        /* We want to reuse these clusters, so qcow2_alloc_cluster_link_l2()
-         * should not free them. */
-        keep_old_clusters = true;
+        if (*host_offset &&
+            start_of_cluster(s, *host_offset) != (entry & L2E_OFFSET_MASK)) {
+            /* Other requests may be writing to the allocated subclusters of
+             * this cluster, so it must not be moved; it will be handled in
+             * the next round.  A preallocated zero cluster can be replaced
+             * by a newly allocated one. */
+            if (type == QCOW2_CLUSTER_NORMAL) {
+                qcow2_cache_put(s->l2_table_cache, (void **) &l2_slice);
+                *bytes = 0;
+                return 0;
+            }
+        } else {
+            /* Try to reuse preallocated zero clusters; contiguous normal
+             * clusters would be fine, too, but count_cow_clusters() above has
+             * limited nb_clusters already to a range of COW clusters */
+            preallocated_nb_clusters =
+                count_contiguous_clusters(s, nb_clusters, l2_slice, l2_index,
+                                          QCOW_OFLAG_COPIED);
+            assert(preallocated_nb_clusters > 0);
+
+            nb_clusters = preallocated_nb_clusters;
+            alloc_cluster_offset = entry & L2E_OFFSET_MASK;
+
+            /* We want to reuse these clusters, so
+             * qcow2_alloc_cluster_link_l2() should not free them. */
+            keep_old_clusters = true;
+        }
     }
 
-    qcow2_cache_put(s->l2_table_cache, (void **) &l2_slice);
-
     if (!alloc_cluster_offset) {
         /* Allocate, if necessary at a given offset in the image file */
         alloc_cluster_offset = start_of_cluster(s, *host_offset);
@@ -1374,6 +1658,7 @@ static int handle_alloc(BlockDriverState *bs, uint64_t guest_offset,
 
         /* Can't extend contiguous allocation */
         if (nb_clusters == 0) {
+            qcow2_cache_put(s->l2_table_cache, (void **) &l2_slice);
             *bytes = 0;
             return 0;
         }
@@ -1403,12 +1688,26 @@ static int handle_alloc(BlockDriverState *bs, uint64_t guest_offset,
      * nb_bytes: The number of bytes from the start of the first
      * newly allocated cluster to the end of the area that the write
      * request actually writes to (excluding COW at the end)
+     *
+     * cow_start_from, cow_end_to: The area that is written to the new
+     * clusters, including COW (see cow_subclusters())
      */
     uint64_t requested_bytes = *bytes + offset_into_cluster(s, guest_offset);
     int avail_bytes = MIN(INT_MAX, nb_clusters << s->cluster_bits);
     int nb_bytes = MIN(requested_bytes, avail_bytes);
+    uint64_t cow_start_from = offset_into_cluster(s, guest_offset);
+    uint64_t cow_start_to = MIN(nb_bytes, s->cluster_size);
+    uint64_t cow_end_from = MAX(cow_start_from,
+                                start_of_cluster(s, nb_bytes - 1));
+    uint64_t cow_end_to = nb_bytes;
     QCowL2Meta *old_m = *m;
 
+    cow_subclusters(s, l2_slice, l2_index, keep_old_clusters,
+                    &cow_start_from, &cow_start_to);
+    cow_subclusters(s, l2_slice, l2_index, keep_old_clusters,
+                    &cow_end_from, &cow_end_to);
+    qcow2_cache_put(s->l2_table_cache, (void **) &l2_slice);
+
     *m = g_malloc0(sizeof(**m));
 
     **m = (QCowL2Meta) {
@@ -1421,12 +1720,12 @@ static int handle_alloc(BlockDriverState *bs, uint64_t guest_offset,
         .keep_old_clusters  = keep_old_clusters,
 
         .cow_start = {
-            .offset     = 0,
-            .nb_bytes   = offset_into_cluster(s, guest_offset),
+            .offset     = cow_start_from,
+            .nb_bytes   = offset_into_cluster(s, guest_offset) - cow_start_from,
         },
         .cow_end = {
             .offset     = nb_bytes,
-            .nb_bytes   = avail_bytes - nb_bytes,
+            .nb_bytes   = cow_end_to - nb_bytes,
         },
     };
     qemu_co_queue_init(&(*m)->dependent_requests);
@@ -1439,6 +1738,7 @@ static int handle_alloc(BlockDriverState *bs, uint64_t guest_offset,
     return 1;
 
 fail:
+    qcow2_cache_put(s->l2_table_cache, (void **) &l2_slice);
     if (*m && (*m)->nb_clusters > 0) {
         QLIST_REMOVE(*m, next_in_flight);
     }
@@ -1597,8 +1897,10 @@ static int discard_in_l2_slice(BlockDriverState *bs, uint64_t offset,
 
     for (i = 0; i < nb_clusters; i++) {
         uint64_t old_l2_entry;
+        uint64_t old_l2_bitmap;
 
-        old_l2_entry = be64_to_cpu(l2_slice[l2_index + i]);
+        old_l2_entry = get_l2_entry(s, l2_slice, l2_index + i);
+        old_l2_bitmap = get_l2_bitmap(s, l2_slice, l2_index + i);
 
         /*
          * If full_discard is false, make sure that a discarded area reads back
@@ -1615,7 +1917,14 @@ static int discard_in_l2_slice(BlockDriverState *bs, uint64_t offset,
          */
         switch (qcow2_get_cluster_type(old_l2_entry)) {
         case QCOW2_CLUSTER_UNALLOCATED:
-            if (full_discard || !bs->backing) {
+            if (has_subclusters(s)) {
+                /* Subclusters may still read as zeroes */
+                if (full_discard ? !old_l2_bitmap
+                                 : (!bs->backing ||
+                                    old_l2_bitmap == QCOW_L2_BITMAP_ALL_ZEROES)) {
+                    continue;
+                }
+            } else if (full_discard || !bs->backing) {
                 continue;
             }
             break;
@@ -1637,10 +1946,14 @@ static int discard_in_l2_slice(BlockDriverState *bs, uint64_t offset,
 
         /* First remove L2 entries */
         qcow2_cache_entry_mark_dirty(s->l2_table_cache, l2_slice);
-        if (!full_discard && s->qcow_version >= 3) {
-            l2_slice[l2_index + i] = cpu_to_be64(QCOW_OFLAG_ZERO);
+        if (has_subclusters(s)) {
+            set_l2_entry(s, l2_slice, l2_index + i, 0);
+            set_l2_bitmap(s, l2_slice, l2_index + i,
+                          full_discard ? 0 : QCOW_L2_BITMAP_ALL_ZEROES);
+        } else if (!full_discard && s->qcow_version >= 3) {
+            set_l2_entry(s, l2_slice, l2_index + i, QCOW_OFLAG_ZERO);
         } else {
-            l2_slice[l2_index + i] = cpu_to_be64(0);
+            set_l2_entry(s, l2_slice, l2_index + i, 0);
         }
 
         /* Then decrease the refcount */
@@ -1720,24 +2033,36 @@ static int zero_in_l2_slice(BlockDriverState *bs, uint64_t offset,
         uint64_t old_offset;
         QCow2ClusterType cluster_type;
 
-        old_offset = be64_to_cpu(l2_slice[l2_index + i]);
+        old_offset = get_l2_entry(s, l2_slice, l2_index + i);
 
         /*
          * Minimize L2 changes if the cluster already reads back as
          * zeroes with correct allocation.
          */
         cluster_type = qcow2_get_cluster_type(old_offset);
-        if (cluster_type == QCOW2_CLUSTER_ZERO_PLAIN ||
-            (cluster_type == QCOW2_CLUSTER_ZERO_ALLOC && !unmap)) {
+        if (has_subclusters(s)) {
+            if (get_l2_bitmap(s, l2_slice, l2_index + i) ==
+                QCOW_L2_BITMAP_ALL_ZEROES &&
+                (cluster_type == QCOW2_CLUSTER_UNALLOCATED || !unmap)) {
+                continue;
+            }
+        } else if (cluster_type == QCOW2_CLUSTER_ZERO_PLAIN ||
+                   (cluster_type == QCOW2_CLUSTER_ZERO_ALLOC && !unmap)) {
             continue;
         }
 
         qcow2_cache_entry_mark_dirty(s->l2_table_cache, l2_slice);
         if (cluster_type == QCOW2_CLUSTER_COMPRESSED || unmap) {
-            l2_slice[l2_index + i] = cpu_to_be64(QCOW_OFLAG_ZERO);
+            set_l2_entry(s, l2_slice, l2_index + i,
+                         has_subclusters(s) ? 0 : QCOW_OFLAG_ZERO);
             qcow2_free_any_clusters(bs, old_offset, 1, QCOW2_DISCARD_REQUEST);
-        } else {
-            l2_slice[l2_index + i] |= cpu_to_be64(QCOW_OFLAG_ZERO);
+        } else if (!has_subclusters(s)) {
+            set_l2_entry(s, l2_slice, l2_index + i,
+                         old_offset | QCOW_OFLAG_ZERO);
+        }
+        if (has_subclusters(s)) {
+            set_l2_bitmap(s, l2_slice, l2_index + i,
+                          QCOW_L2_BITMAP_ALL_ZEROES);
         }
     }
 
@@ -1810,6 +2135,9 @@ static int expand_zero_clusters_in_l1(BlockDriverState *bs, uint64_t *l1_table,
     int ret;
     int i, j;
 
+    /* Extended L2 entries have no zero clusters and can't be downgraded */
+    assert(!has_subclusters(s));
+
     slice_size2 = s->l2_slice_size * sizeof(uint64_t);
     n_slices = s->cluster_size / slice_size2;
 
@@ -25,31 +25,58 @@
 #include "hw/virtio/virtio-bus.h"
 #include "qom/object_interfaces.h"
 
+/* An IOThread and the virtqueues that it processes */
+typedef struct VirtIOBlockDataPlaneThread {
+    VirtIOBlockDataPlane *s;
+    IOThread *iothread;
+    AioContext *ctx;
+    QEMUBH *bh;                     /* bh for guest notification */
+    unsigned long *batch_notify_vqs;
+} VirtIOBlockDataPlaneThread;
+
 struct VirtIOBlockDataPlane {
     bool starting;
     bool stopping;
 
     VirtIOBlkConf *conf;
     VirtIODevice *vdev;
-    QEMUBH *bh;                     /* bh for guest notification */
-    unsigned long *batch_notify_vqs;
     bool batch_notifications;
 
     /* Note that these EventNotifiers are assigned by value.  This is
      * fine as long as you do not call event_notifier_cleanup on them
      * (because you don't own the file descriptor or handle; you just
      * use it).
+     *
+     * Virtqueue i is processed by threads[i % active_threads].  The
+     * BlockBackend lives in the AioContext of threads[0]; the others are
+     * only used if the BlockBackend can be put in multiqueue mode.
      */
-    IOThread *iothread;
-    AioContext *ctx;
+    VirtIOBlockDataPlaneThread *threads;
+    unsigned nthreads;
+    unsigned active_threads;
 };
 
+static VirtIOBlockDataPlaneThread *vq_thread(VirtIOBlockDataPlane *s,
+                                             unsigned vq_idx)
+{
+    return &s->threads[vq_idx % s->active_threads];
+}
+
+AioContext *virtio_blk_data_plane_get_vq_context(VirtIOBlockDataPlane *s,
+                                                 VirtQueue *vq)
+{
+    return vq_thread(s, virtio_get_queue_index(vq))->ctx;
+}
+
 /* Raise an interrupt to signal guest, if necessary */
 void virtio_blk_data_plane_notify(VirtIOBlockDataPlane *s, VirtQueue *vq)
 {
     if (s->batch_notifications) {
-        set_bit(virtio_get_queue_index(vq), s->batch_notify_vqs);
-        qemu_bh_schedule(s->bh);
+        unsigned vq_idx = virtio_get_queue_index(vq);
+        VirtIOBlockDataPlaneThread *t = vq_thread(s, vq_idx);
+
+        set_bit_atomic(vq_idx, t->batch_notify_vqs);
+        qemu_bh_schedule(t->bh);
     } else {
         virtio_notify_irqfd(s->vdev, vq);
     }
@@ -57,19 +84,16 @@ void virtio_blk_data_plane_notify(VirtIOBlockDataPlane *s, VirtQueue *vq)
 
 static void notify_guest_bh(void *opaque)
 {
-    VirtIOBlockDataPlane *s = opaque;
+    VirtIOBlockDataPlaneThread *t = opaque;
+    VirtIOBlockDataPlane *s = t->s;
     unsigned nvqs = s->conf->num_queues;
-    unsigned long bitmap[BITS_TO_LONGS(nvqs)];
     unsigned j;
 
-    memcpy(bitmap, s->batch_notify_vqs, sizeof(bitmap));
-    memset(s->batch_notify_vqs, 0, sizeof(bitmap));
-
-    for (j = 0; j < nvqs; j += BITS_PER_LONG) {
-        unsigned long bits = bitmap[j];
+    for (j = 0; j < BITS_TO_LONGS(nvqs); j++) {
+        unsigned long bits = atomic_xchg(&t->batch_notify_vqs[j], 0);
 
         while (bits != 0) {
-            unsigned i = j + ctzl(bits);
+            unsigned i = j * BITS_PER_LONG + ctzl(bits);
             VirtQueue *vq = virtio_get_queue(s->vdev, i);
 
             virtio_notify_irqfd(s->vdev, vq);
@@ -87,10 +111,26 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
     VirtIOBlockDataPlane *s;
     BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
     VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    unsigned nthreads = MAX(conf->num_iothreads, 1);
+    unsigned i;
 
     *dataplane = NULL;
 
-    if (conf->iothread) {
+    if (conf->num_iothreads) {
+        if (conf->iothread) {
+            error_setg(errp, "iothread and iothreads are mutually exclusive");
+            return false;
+        }
+        for (i = 0; i < conf->num_iothreads; i++) {
+            if (!conf->iothreads[i] || !iothread_by_id(conf->iothreads[i])) {
+                error_setg(errp, "iothreads[%u]: IOThread '%s' not found", i,
+                           conf->iothreads[i] ? conf->iothreads[i] : "");
+                return false;
+            }
+        }
+    }
+
+    if (conf->iothread || conf->num_iothreads) {
         if (!k->set_guest_notifiers || !k->ioeventfd_assign) {
             error_setg(errp,
                        "device is incompatible with iothread "
@@ -118,16 +158,28 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
     s = g_new0(VirtIOBlockDataPlane, 1);
     s->vdev = vdev;
     s->conf = conf;
-
-    if (conf->iothread) {
-        s->iothread = conf->iothread;
-        object_ref(OBJECT(s->iothread));
-        s->ctx = iothread_get_aio_context(s->iothread);
-    } else {
-        s->ctx = qemu_get_aio_context();
+    s->threads = g_new0(VirtIOBlockDataPlaneThread, nthreads);
+    s->nthreads = nthreads;
+    s->active_threads = 1;
+
+    for (i = 0; i < nthreads; i++) {
+        VirtIOBlockDataPlaneThread *t = &s->threads[i];
+
+        t->s = s;
+        if (conf->num_iothreads) {
+            t->iothread = iothread_by_id(conf->iothreads[i]);
+        } else {
+            t->iothread = conf->iothread;
+        }
+        if (t->iothread) {
+            object_ref(OBJECT(t->iothread));
+            t->ctx = iothread_get_aio_context(t->iothread);
+        } else {
+            t->ctx = qemu_get_aio_context();
+        }
+        t->bh = aio_bh_new(t->ctx, notify_guest_bh, t);
+        t->batch_notify_vqs = bitmap_new(conf->num_queues);
     }
-    s->bh = aio_bh_new(s->ctx, notify_guest_bh, s);
-    s->batch_notify_vqs = bitmap_new(conf->num_queues);
 
     *dataplane = s;
 
@@ -138,6 +190,7 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
 void virtio_blk_data_plane_destroy(VirtIOBlockDataPlane *s)
 {
     VirtIOBlock *vblk;
+    unsigned i;
 
     if (!s) {
         return;
@@ -145,11 +198,16 @@ void virtio_blk_data_plane_destroy(VirtIOBlockDataPlane *s)
 
     vblk = VIRTIO_BLK(s->vdev);
     assert(!vblk->dataplane_started);
-    g_free(s->batch_notify_vqs);
-    qemu_bh_delete(s->bh);
-    if (s->iothread) {
-        object_unref(OBJECT(s->iothread));
+    for (i = 0; i < s->nthreads; i++) {
+        VirtIOBlockDataPlaneThread *t = &s->threads[i];
+
+        g_free(t->batch_notify_vqs);
+        qemu_bh_delete(t->bh);
+        if (t->iothread) {
+            object_unref(OBJECT(t->iothread));
+        }
     }
+    g_free(s->threads);
     g_free(s);
 }
 
@@ -173,6 +231,7 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
     VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
     unsigned i;
     unsigned nvqs = s->conf->num_queues;
+    Error *local_err = NULL;
     int r;
 
     if (vblk->dataplane_started || s->starting) {
@@ -212,7 +271,15 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
     vblk->dataplane_started = true;
     trace_virtio_blk_data_plane_start(s);
 
-    blk_set_aio_context(s->conf->conf.blk, s->ctx);
+    blk_set_aio_context(s->conf->conf.blk, s->threads[0].ctx);
+
+    /* Process virtqueues in several IOThreads if the block layer can */
+    s->active_threads = MIN(s->nthreads, nvqs);
+    if (s->active_threads > 1 &&
+        blk_set_multiqueue(s->conf->conf.blk, true, &local_err) < 0) {
+        warn_reportf_err(local_err, "virtio-blk: using a single IOThread: ");
+        s->active_threads = 1;
+    }
 
     /* Kick right away to begin processing requests already in vring */
     for (i = 0; i < nvqs; i++) {
@@ -222,14 +289,15 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
     }
 
     /* Get this show started by hooking up our callbacks */
-    aio_context_acquire(s->ctx);
     for (i = 0; i < nvqs; i++) {
         VirtQueue *vq = virtio_get_queue(s->vdev, i);
+        AioContext *ctx = vq_thread(s, i)->ctx;
 
-        virtio_queue_aio_set_host_notifier_handler(vq, s->ctx,
+        aio_context_acquire(ctx);
+        virtio_queue_aio_set_host_notifier_handler(vq, ctx,
                 virtio_blk_data_plane_handle_output);
+        aio_context_release(ctx);
     }
-    aio_context_release(s->ctx);
     return 0;
 
   fail_guest_notifiers:
@@ -245,13 +313,16 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
  */
 static void virtio_blk_data_plane_stop_bh(void *opaque)
 {
-    VirtIOBlockDataPlane *s = opaque;
+    VirtIOBlockDataPlaneThread *t = opaque;
+    VirtIOBlockDataPlane *s = t->s;
     unsigned i;
 
     for (i = 0; i < s->conf->num_queues; i++) {
         VirtQueue *vq = virtio_get_queue(s->vdev, i);
 
-        virtio_queue_aio_set_host_notifier_handler(vq, s->ctx, NULL);
+        if (vq_thread(s, i) == t) {
+            virtio_queue_aio_set_host_notifier_handler(vq, t->ctx, NULL);
+        }
     }
 }
 
@@ -278,13 +349,22 @@ void virtio_blk_data_plane_stop(VirtIODevice *vdev)
     s->stopping = true;
     trace_virtio_blk_data_plane_stop(s);
 
-    aio_context_acquire(s->ctx);
-    aio_wait_bh_oneshot(s->ctx, virtio_blk_data_plane_stop_bh, s);
+    for (i = 0; i < s->active_threads; i++) {
+        VirtIOBlockDataPlaneThread *t = &s->threads[i];
+
+        aio_context_acquire(t->ctx);
+        aio_wait_bh_oneshot(t->ctx, virtio_blk_data_plane_stop_bh, t);
+        aio_context_release(t->ctx);
+    }
+
+    aio_context_acquire(s->threads[0].ctx);
 
     /* Drain and switch bs back to the QEMU main loop */
     blk_set_aio_context(s->conf->conf.blk, qemu_get_aio_context());
+    blk_set_multiqueue(s->conf->conf.blk, false, &error_abort);
+    s->active_threads = 1;
 
-    aio_context_release(s->ctx);
+    aio_context_release(s->threads[0].ctx);
 
     for (i = 0; i < nvqs; i++) {
         virtio_bus_set_host_notifier(VIRTIO_BUS(qbus), i, false);
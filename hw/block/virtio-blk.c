@@ -48,6 +48,18 @@ static void virtio_blk_free_request(VirtIOBlockReq *req)
     g_free(req);
 }
 
+/*
+ * The AioContext whose lock protects @vq.  With several IOThreads, each
+ * virtqueue is processed by one of them, and requests complete there too.
+ */
+static AioContext *virtio_blk_vq_aio_context(VirtIOBlock *s, VirtQueue *vq)
+{
+    if (s->dataplane_started && !s->dataplane_disabled) {
+        return virtio_blk_data_plane_get_vq_context(s->dataplane, vq);
+    }
+    return blk_get_aio_context(s->blk);
+}
+
 static void virtio_blk_req_complete(VirtIOBlockReq *req, unsigned char status)
 {
     VirtIOBlock *s = req->dev;
@@ -71,11 +83,17 @@ static int virtio_blk_handle_rw_error(VirtIOBlockReq *req, int error,
     BlockErrorAction action = blk_get_error_action(s->blk, is_read, error);
 
     if (action == BLOCK_ERROR_ACTION_STOP) {
+        VirtIOBlockReq *old;
+
         /* Break the link as the next request is going to be parsed from the
          * ring again. Otherwise we may end up doing a double completion! */
         req->mr_next = NULL;
-        req->next = s->rq;
-        s->rq = req;
+
+        /* Requests of different virtqueues may fail concurrently */
+        do {
+            old = atomic_read(&s->rq);
+            req->next = old;
+        } while (atomic_cmpxchg(&s->rq, old, req) != old);
     } else if (action == BLOCK_ERROR_ACTION_REPORT) {
         virtio_blk_req_complete(req, VIRTIO_BLK_S_IOERR);
         block_acct_failed(blk_get_stats(s->blk), &req->acct);
@@ -91,8 +109,10 @@ static void virtio_blk_rw_complete(void *opaque, int ret)
     VirtIOBlockReq *next = opaque;
     VirtIOBlock *s = next->dev;
     VirtIODevice *vdev = VIRTIO_DEVICE(s);
+    /* Merged requests always come from the same virtqueue */
+    AioContext *ctx = virtio_blk_vq_aio_context(s, next->vq);
 
-    aio_context_acquire(blk_get_aio_context(s->conf.conf.blk));
+    aio_context_acquire(ctx);
     while (next) {
         VirtIOBlockReq *req = next;
         next = req->mr_next;
@@ -125,15 +145,16 @@ static void virtio_blk_rw_complete(void *opaque, int ret)
         block_acct_done(blk_get_stats(req->dev->blk), &req->acct);
         virtio_blk_free_request(req);
     }
-    aio_context_release(blk_get_aio_context(s->conf.conf.blk));
+    aio_context_release(ctx);
 }
 
 static void virtio_blk_flush_complete(void *opaque, int ret)
 {
     VirtIOBlockReq *req = opaque;
     VirtIOBlock *s = req->dev;
+    AioContext *ctx = virtio_blk_vq_aio_context(s, req->vq);
 
-    aio_context_acquire(blk_get_aio_context(s->conf.conf.blk));
+    aio_context_acquire(ctx);
     if (ret) {
         if (virtio_blk_handle_rw_error(req, -ret, 0)) {
             goto out;
@@ -145,7 +166,7 @@ static void virtio_blk_flush_complete(void *opaque, int ret)
     virtio_blk_free_request(req);
 
 out:
-    aio_context_release(blk_get_aio_context(s->conf.conf.blk));
+    aio_context_release(ctx);
 }
 
 #ifdef __linux__
@@ -163,6 +184,7 @@ static void virtio_blk_ioctl_complete(void *opaque, int status)
     VirtIODevice *vdev = VIRTIO_DEVICE(s);
     struct virtio_scsi_inhdr *scsi;
     struct sg_io_hdr *hdr;
+    AioContext *ctx;
 
     scsi = (void *)req->elem.in_sg[req->elem.in_num - 2].iov_base;
 
@@ -192,10 +214,11 @@ static void virtio_blk_ioctl_complete(void *opaque, int status)
     virtio_stl_p(vdev, &scsi->data_len, hdr->dxfer_len);
 
 out:
-    aio_context_acquire(blk_get_aio_context(s->conf.conf.blk));
+    ctx = virtio_blk_vq_aio_context(s, req->vq);
+    aio_context_acquire(ctx);
     virtio_blk_req_complete(req, status);
     virtio_blk_free_request(req);
-    aio_context_release(blk_get_aio_context(s->conf.conf.blk));
+    aio_context_release(ctx);
     g_free(ioctl_req);
 }
 
@@ -591,11 +614,12 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
 
 bool virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
 {
+    AioContext *ctx = virtio_blk_vq_aio_context(s, vq);
     VirtIOBlockReq *req;
     MultiReqBuffer mrb = {};
     bool progress = false;
 
-    aio_context_acquire(blk_get_aio_context(s->blk));
+    aio_context_acquire(ctx);
     blk_io_plug(s->blk);
 
     do {
@@ -618,7 +642,7 @@ bool virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
     }
 
     blk_io_unplug(s->blk);
-    aio_context_release(blk_get_aio_context(s->blk));
+    aio_context_release(ctx);
     return progress;
 }
 
@@ -646,24 +670,38 @@ static void virtio_blk_handle_output(VirtIODevice *vdev, VirtQueue *vq)
 static void virtio_blk_dma_restart_bh(void *opaque)
 {
     VirtIOBlock *s = opaque;
-    VirtIOBlockReq *req = s->rq;
+    VirtIOBlockReq *req;
     MultiReqBuffer mrb = {};
+    AioContext *ctx;
+    int ret;
 
     qemu_bh_delete(s->bh);
     s->bh = NULL;
 
-    s->rq = NULL;
+    req = atomic_xchg(&s->rq, NULL);
 
     aio_context_acquire(blk_get_aio_context(s->conf.conf.blk));
     while (req) {
         VirtIOBlockReq *next = req->next;
-        if (virtio_blk_handle_request(req, &mrb)) {
+
+        /* Completions run under the lock of the virtqueue's AioContext */
+        if (mrb.num_reqs && mrb.reqs[0]->vq != req->vq) {
+            virtio_blk_submit_multireq(s->blk, &mrb);
+        }
+        ctx = virtio_blk_vq_aio_context(s, req->vq);
+        aio_context_acquire(ctx);
+        ret = virtio_blk_handle_request(req, &mrb);
+        aio_context_release(ctx);
+        if (ret) {
             /* Device is now broken and won't do any processing until it gets
              * reset. Already queued requests will be lost: let's purge them.
              */
             while (req) {
                 next = req->next;
+                ctx = virtio_blk_vq_aio_context(s, req->vq);
+                aio_context_acquire(ctx);
                 virtqueue_detach_element(req->vq, &req->elem, 0);
+                aio_context_release(ctx);
                 virtio_blk_free_request(req);
                 req = next;
             }
@@ -1023,6 +1061,8 @@ static Property virtio_blk_properties[] = {
     DEFINE_PROP_UINT16("queue-size", VirtIOBlock, conf.queue_size, 128),
     DEFINE_PROP_LINK("iothread", VirtIOBlock, conf.iothread, TYPE_IOTHREAD,
                      IOThread *),
+    DEFINE_PROP_ARRAY("iothreads", VirtIOBlock, conf.num_iothreads,
+                      conf.iothreads, qdev_prop_string, char *),
     DEFINE_PROP_END_OF_LIST(),
 };
 
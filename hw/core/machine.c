@@ -228,6 +228,64 @@ static void machine_set_kvm_shadow_mem(Object *obj, Visitor *v,
     ms->kvm_shadow_mem = value;
 }
 
+static void machine_get_kvm_dirty_ring_size(Object *obj, Visitor *v,
+                                            const char *name, void *opaque,
+                                            Error **errp)
+{
+    MachineState *ms = MACHINE(obj);
+    uint32_t value = ms->kvm_dirty_ring_size;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void machine_set_kvm_dirty_ring_size(Object *obj, Visitor *v,
+                                            const char *name, void *opaque,
+                                            Error **errp)
+{
+    MachineState *ms = MACHINE(obj);
+    Error *error = NULL;
+    uint32_t value;
+
+    visit_type_uint32(v, name, &value, &error);
+    if (error) {
+        error_propagate(errp, error);
+        return;
+    }
+    if (value & (value - 1)) {
+        error_setg(errp, "dirty ring size must be a power of two");
+        return;
+    }
+
+    ms->kvm_dirty_ring_size = value;
+}
+
+static void machine_get_kvm_coalesced_mmio_poll_us(Object *obj, Visitor *v,
+                                                   const char *name,
+                                                   void *opaque, Error **errp)
+{
+    MachineState *ms = MACHINE(obj);
+    uint32_t value = ms->kvm_coalesced_mmio_poll_us;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void machine_set_kvm_coalesced_mmio_poll_us(Object *obj, Visitor *v,
+                                                   const char *name,
+                                                   void *opaque, Error **errp)
+{
+    MachineState *ms = MACHINE(obj);
+    Error *error = NULL;
+    uint32_t value;
+
+    visit_type_uint32(v, name, &value, &error);
+    if (error) {
+        error_propagate(errp, error);
+        return;
+    }
+
+    ms->kvm_coalesced_mmio_poll_us = value;
+}
+
 static char *machine_get_kernel(Object *obj, Error **errp)
 {
     MachineState *ms = MACHINE(obj);
@@ -677,6 +735,21 @@ static void machine_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "kvm-shadow-mem",
         "KVM shadow MMU size", &error_abort);
 
+    object_class_property_add(oc, "kvm-dirty-ring-size", "uint32",
+        machine_get_kvm_dirty_ring_size, machine_set_kvm_dirty_ring_size,
+        NULL, NULL, &error_abort);
+    object_class_property_set_description(oc, "kvm-dirty-ring-size",
+        "Number of entries of the per-vCPU KVM dirty rings (0 = disabled)",
+        &error_abort);
+
+    object_class_property_add(oc, "kvm-coalesced-mmio-poll-us", "uint32",
+        machine_get_kvm_coalesced_mmio_poll_us,
+        machine_set_kvm_coalesced_mmio_poll_us,
+        NULL, NULL, &error_abort);
+    object_class_property_set_description(oc, "kvm-coalesced-mmio-poll-us",
+        "Period in microseconds of the KVM coalesced MMIO drain thread "
+        "(0 = disabled)", &error_abort);
+
     object_class_property_add_str(oc, "kernel",
         machine_get_kernel, machine_set_kernel, &error_abort);
     object_class_property_set_description(oc, "kernel",
@@ -834,6 +907,16 @@ int machine_kvm_shadow_mem(MachineState *machine)
     return machine->kvm_shadow_mem;
 }
 
+uint32_t machine_kvm_dirty_ring_size(MachineState *machine)
+{
+    return machine->kvm_dirty_ring_size;
+}
+
+uint32_t machine_kvm_coalesced_mmio_poll_us(MachineState *machine)
+{
+    return machine->kvm_coalesced_mmio_poll_us;
+}
+
 int machine_phandle_start(MachineState *machine)
 {
     return machine->phandle_start;
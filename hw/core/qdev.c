@@ -34,6 +34,7 @@
 #include "qapi/visitor.h"
 #include "qemu/error-report.h"
 #include "qemu/option.h"
+#include "qemu/main-loop.h"
 #include "hw/hotplug.h"
 #include "hw/boards.h"
 #include "hw/sysbus.h"
@@ -946,6 +947,7 @@ static void device_initfn(Object *obj)
 
     dev->instance_id_alias = -1;
     dev->realized = false;
+    qemu_rec_mutex_init(&dev->lock);
 
     object_property_add_bool(obj, "realized",
                              device_get_realized, device_set_realized, NULL);
@@ -1020,6 +1022,7 @@ static void device_finalize(Object *obj)
     }
 
     qemu_opts_del(dev->opts);
+    qemu_rec_mutex_destroy(&dev->lock);
 }
 
 static void device_class_base_init(ObjectClass *class, void *data)
@@ -1096,7 +1099,39 @@ void device_reset(DeviceState *dev)
     DeviceClass *klass = DEVICE_GET_CLASS(dev);
 
     if (klass->reset) {
+        qdev_lock(dev);
         klass->reset(dev);
+        qdev_unlock(dev);
+    }
+}
+
+void qdev_lock(DeviceState *dev)
+{
+    qemu_rec_mutex_lock(&dev->lock);
+}
+
+void qdev_unlock(DeviceState *dev)
+{
+    qemu_rec_mutex_unlock(&dev->lock);
+}
+
+bool qdev_lock_with_iothread(DeviceState *dev)
+{
+    bool unlock_iothread = false;
+
+    if (!qemu_mutex_iothread_locked()) {
+        qemu_mutex_lock_iothread();
+        unlock_iothread = true;
+    }
+    qdev_lock(dev);
+    return unlock_iothread;
+}
+
+void qdev_unlock_with_iothread(DeviceState *dev, bool unlock_iothread)
+{
+    qdev_unlock(dev);
+    if (unlock_iothread) {
+        qemu_mutex_unlock_iothread();
     }
 }
 
@@ -213,6 +213,7 @@ static void q35_host_initfn(Object *obj)
 
     memory_region_init_io(&phb->conf_mem, obj, &pci_host_conf_le_ops, phb,
                           "pci-conf-idx", 4);
+    memory_region_clear_global_locking(&phb->conf_mem);
     memory_region_init_io(&phb->data_mem, obj, &pci_host_data_le_ops, phb,
                           "pci-conf-data", 4);
 
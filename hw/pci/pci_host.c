@@ -145,6 +145,11 @@ uint32_t pci_data_read(PCIBus *s, uint32_t addr, int len)
     return val;
 }
 
+/*
+ * The configuration address register only latches a value, so hosts may
+ * dispatch it without the BQL.  The data port, which accesses the devices,
+ * still needs the BQL.
+ */
 static void pci_host_config_write(void *opaque, hwaddr addr,
                                   uint64_t val, unsigned len)
 {
@@ -155,14 +160,14 @@ static void pci_host_config_write(void *opaque, hwaddr addr,
     if (addr != 0 || len != 4) {
         return;
     }
-    s->config_reg = val;
+    atomic_set(&s->config_reg, val);
 }
 
 static uint64_t pci_host_config_read(void *opaque, hwaddr addr,
                                      unsigned len)
 {
     PCIHostState *s = opaque;
-    uint32_t val = s->config_reg;
+    uint32_t val = atomic_read(&s->config_reg);
 
     PCI_DPRINTF("%s addr " TARGET_FMT_plx " len %d val %"PRIx32"\n",
                 __func__, addr, len, val);
@@ -173,21 +178,26 @@ static void pci_host_data_write(void *opaque, hwaddr addr,
                                 uint64_t val, unsigned len)
 {
     PCIHostState *s = opaque;
+    uint32_t config_reg = atomic_read(&s->config_reg);
+
     PCI_DPRINTF("write addr " TARGET_FMT_plx " len %d val %x\n",
                 addr, len, (unsigned)val);
-    if (s->config_reg & (1u << 31))
-        pci_data_write(s->bus, s->config_reg | (addr & 3), val, len);
+    if (config_reg & (1u << 31)) {
+        pci_data_write(s->bus, config_reg | (addr & 3), val, len);
+    }
 }
 
 static uint64_t pci_host_data_read(void *opaque,
                                    hwaddr addr, unsigned len)
 {
     PCIHostState *s = opaque;
+    uint32_t config_reg = atomic_read(&s->config_reg);
     uint32_t val;
-    if (!(s->config_reg & (1U << 31))) {
+
+    if (!(config_reg & (1U << 31))) {
         return 0xffffffff;
     }
-    val = pci_data_read(s->bus, s->config_reg | (addr & 3), len);
+    val = pci_data_read(s->bus, config_reg | (addr & 3), len);
     PCI_DPRINTF("read addr " TARGET_FMT_plx " len %d val %x\n",
                 addr, len, val);
     return val;
@@ -355,10 +355,12 @@ static const VMStateDescription vmstate_hpet = {
 static void hpet_timer(void *opaque)
 {
     HPETTimer *t = opaque;
-    uint64_t diff;
+    uint64_t diff, period, cur_tick;
 
-    uint64_t period = t->period;
-    uint64_t cur_tick = hpet_get_ticks(t->state);
+    qdev_lock(DEVICE(t->state));
+
+    period = t->period;
+    cur_tick = hpet_get_ticks(t->state);
 
     if (timer_is_periodic(t) && period != 0) {
         if (t->config & HPET_TN_32BIT) {
@@ -382,6 +384,8 @@ static void hpet_timer(void *opaque)
         }
     }
     update_irq(t, 1);
+
+    qdev_unlock(DEVICE(t->state));
 }
 
 static void hpet_set_timer(HPETTimer *t)
@@ -428,10 +432,8 @@ static uint32_t hpet_ram_readw(void *opaque, hwaddr addr)
 }
 #endif
 
-static uint64_t hpet_ram_read(void *opaque, hwaddr addr,
-                              unsigned size)
+static uint64_t hpet_ram_read_locked(HPETState *s, hwaddr addr)
 {
-    HPETState *s = opaque;
     uint64_t cur_tick, index;
 
     DPRINTF("qemu: Enter hpet_ram_readl at %" PRIx64 "\n", addr);
@@ -500,16 +502,33 @@ static uint64_t hpet_ram_read(void *opaque, hwaddr addr,
     return 0;
 }
 
-static void hpet_ram_write(void *opaque, hwaddr addr,
-                           uint64_t value, unsigned size)
+/*
+ * The HPET registers are dispatched without the BQL, so that guests can
+ * read the main counter from several vCPUs at once.  Reads only need the
+ * device lock; writes may arm timers and raise interrupts, and take the
+ * BQL as well.  Timer callbacks and the legacy IRQ inputs run under the
+ * BQL and take the device lock.
+ */
+static uint64_t hpet_ram_read(void *opaque, hwaddr addr,
+                              unsigned size)
 {
-    int i;
     HPETState *s = opaque;
+    uint64_t val;
+
+    qdev_lock(DEVICE(s));
+    val = hpet_ram_read_locked(s, addr);
+    qdev_unlock(DEVICE(s));
+    return val;
+}
+
+static void hpet_ram_write_locked(HPETState *s, hwaddr addr, uint64_t value)
+{
+    int i;
     uint64_t old_val, new_val, val, index;
 
     DPRINTF("qemu: Enter hpet_ram_writel at %" PRIx64 " = %#x\n", addr, value);
     index = addr;
-    old_val = hpet_ram_read(opaque, addr, 4);
+    old_val = hpet_ram_read_locked(s, addr);
     new_val = value;
 
     /*address range of all TN regs*/
@@ -668,6 +687,17 @@ static void hpet_ram_write(void *opaque, hwaddr addr,
     }
 }
 
+static void hpet_ram_write(void *opaque, hwaddr addr,
+                           uint64_t value, unsigned size)
+{
+    HPETState *s = opaque;
+    bool unlock_iothread;
+
+    unlock_iothread = qdev_lock_with_iothread(DEVICE(s));
+    hpet_ram_write_locked(s, addr, value);
+    qdev_unlock_with_iothread(DEVICE(s), unlock_iothread);
+}
+
 static const MemoryRegionOps hpet_ram_ops = {
     .read = hpet_ram_read,
     .write = hpet_ram_write,
@@ -714,6 +744,7 @@ static void hpet_handle_legacy_irq(void *opaque, int n, int level)
 {
     HPETState *s = HPET(opaque);
 
+    qdev_lock(DEVICE(s));
     if (n == HPET_LEGACY_PIT_INT) {
         if (!hpet_in_legacy_mode(s)) {
             qemu_set_irq(s->irqs[0], level);
@@ -724,6 +755,7 @@ static void hpet_handle_legacy_irq(void *opaque, int n, int level)
             qemu_set_irq(s->irqs[RTC_ISA_IRQ], level);
         }
     }
+    qdev_unlock(DEVICE(s));
 }
 
 static void hpet_init(Object *obj)
@@ -733,6 +765,7 @@ static void hpet_init(Object *obj)
 
     /* HPET Area */
     memory_region_init_io(&s->iomem, obj, &hpet_ram_ops, s, "hpet", HPET_LEN);
+    memory_region_clear_global_locking(&s->iomem);
     sysbus_init_mmio(sbd, &s->iomem);
 }
 
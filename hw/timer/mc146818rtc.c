@@ -476,7 +476,8 @@ static void cmos_ioport_write(void *opaque, hwaddr addr,
     bool update_periodic_timer;
 
     if ((addr & 1) == 0) {
-        s->cmos_index = data & 0x7f;
+        /* May run without the BQL, see rtc_realizefn() */
+        atomic_set(&s->cmos_index, data & 0x7f);
     } else {
         CMOS_DPRINTF("cmos: write index=0x%02x val=0x%02" PRIx64 "\n",
                      s->cmos_index, data);
@@ -996,6 +997,12 @@ static void rtc_realizefn(DeviceState *dev, Error **errp)
     memory_region_set_flush_coalesced(&s->io);
     memory_region_init_io(&s->coalesced_io, OBJECT(s), &cmos_ops,
                           s, "rtc-index", 1);
+    /*
+     * The index port only latches cmos_index, which the data port reads
+     * after flushing the coalesced writes; it does not need the BQL, so
+     * KVM can drain its writes without it.
+     */
+    memory_region_clear_global_locking(&s->coalesced_io);
     memory_region_add_subregion(&s->io, 0, &s->coalesced_io);
     memory_region_add_coalescing(&s->coalesced_io, 0, 1);
 
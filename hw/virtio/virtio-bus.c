@@ -300,9 +300,16 @@ void virtio_bus_cleanup_host_notifier(VirtioBusState *bus, int n)
 
     /* Test and clear notifier after disabling event,
      * in case poll callback didn't have time to run.
+     *
+     * virtio_queue_notify_unlocked() sets the notifier under the device
+     * lock, so hold it across the read and the cleanup: a kick that
+     * comes in between would otherwise be lost with the notifier.  Later
+     * kicks find no AioContext handler and go through the BQL.
      */
+    qdev_lock(DEVICE(vdev));
     virtio_queue_host_notifier_read(notifier);
     event_notifier_cleanup(notifier);
+    qdev_unlock(DEVICE(vdev));
 }
 
 static char *virtio_bus_get_dev_path(DeviceState *dev)
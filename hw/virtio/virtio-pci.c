@@ -22,6 +22,7 @@
 #include "hw/pci/pci.h"
 #include "qapi/error.h"
 #include "qemu/error-report.h"
+#include "qemu/main-loop.h"
 #include "hw/pci/msi.h"
 #include "hw/pci/msix.h"
 #include "hw/loader.h"
@@ -1297,27 +1298,39 @@ static uint64_t virtio_pci_notify_read(void *opaque, hwaddr addr,
     return 0;
 }
 
+/*
+ * The notify regions are dispatched without the BQL: queues handled in
+ * an AioContext are kicked directly, the others need the BQL.
+ */
+static void virtio_pci_queue_notify(VirtIODevice *vdev, unsigned queue)
+{
+    if (queue >= VIRTIO_QUEUE_MAX ||
+        virtio_queue_notify_unlocked(vdev, queue)) {
+        return;
+    }
+
+    if (qemu_mutex_iothread_locked()) {
+        virtio_queue_notify(vdev, queue);
+    } else {
+        qemu_mutex_lock_iothread();
+        virtio_queue_notify(vdev, queue);
+        qemu_mutex_unlock_iothread();
+    }
+}
+
 static void virtio_pci_notify_write(void *opaque, hwaddr addr,
                                     uint64_t val, unsigned size)
 {
     VirtIODevice *vdev = opaque;
     VirtIOPCIProxy *proxy = VIRTIO_PCI(DEVICE(vdev)->parent_bus->parent);
-    unsigned queue = addr / virtio_pci_queue_mem_mult(proxy);
 
-    if (queue < VIRTIO_QUEUE_MAX) {
-        virtio_queue_notify(vdev, queue);
-    }
+    virtio_pci_queue_notify(vdev, addr / virtio_pci_queue_mem_mult(proxy));
 }
 
 static void virtio_pci_notify_write_pio(void *opaque, hwaddr addr,
                                         uint64_t val, unsigned size)
 {
-    VirtIODevice *vdev = opaque;
-    unsigned queue = val;
-
-    if (queue < VIRTIO_QUEUE_MAX) {
-        virtio_queue_notify(vdev, queue);
-    }
+    virtio_pci_queue_notify(opaque, val);
 }
 
 static uint64_t virtio_pci_isr_read(void *opaque, hwaddr addr,
@@ -1445,12 +1458,14 @@ static void virtio_pci_modern_regions_init(VirtIOPCIProxy *proxy)
                           virtio_bus_get_device(&proxy->bus),
                           "virtio-pci-notify",
                           proxy->notify.size);
+    memory_region_clear_global_locking(&proxy->notify.mr);
 
     memory_region_init_io(&proxy->notify_pio.mr, OBJECT(proxy),
                           &notify_pio_ops,
                           virtio_bus_get_device(&proxy->bus),
                           "virtio-pci-notify-pio",
                           proxy->notify_pio.size);
+    memory_region_clear_global_locking(&proxy->notify_pio.mr);
 }
 
 static void virtio_pci_modern_region_map(VirtIOPCIProxy *proxy,
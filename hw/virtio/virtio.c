@@ -1558,6 +1558,33 @@ void virtio_queue_notify(VirtIODevice *vdev, int n)
     }
 }
 
+/*
+ * Notify queue @n from a thread that may not hold the BQL.  This only
+ * works for queues that are handled in an AioContext, whose host notifier
+ * can be set from any thread.  Returns false if the caller must take the
+ * BQL and use virtio_queue_notify() instead.
+ *
+ * The device lock keeps the host notifier alive: it is held by
+ * virtio_bus_cleanup_host_notifier() when the notifier is torn down,
+ * after the AioContext handler has been removed.
+ */
+bool virtio_queue_notify_unlocked(VirtIODevice *vdev, int n)
+{
+    VirtQueue *vq = &vdev->vq[n];
+    bool ret = true;
+
+    qdev_lock(DEVICE(vdev));
+    if (!atomic_read(&vq->handle_aio_output)) {
+        ret = false;
+    } else if (likely(vq->vring.desc && !vdev->broken)) {
+        /* Racy, but the queue is checked again when it is processed */
+        trace_virtio_queue_notify(vdev, vq - vdev->vq, vq);
+        event_notifier_set(&vq->host_notifier);
+    }
+    qdev_unlock(DEVICE(vdev));
+    return ret;
+}
+
 uint16_t virtio_queue_vector(VirtIODevice *vdev, int n)
 {
     return n < VIRTIO_QUEUE_MAX ? vdev->vq[n].vector :
@@ -2448,7 +2475,7 @@ void virtio_queue_aio_set_host_notifier_handler(VirtQueue *vq, AioContext *ctx,
                                                 VirtIOHandleAIOOutput handle_output)
 {
     if (handle_output) {
-        vq->handle_aio_output = handle_output;
+        atomic_set(&vq->handle_aio_output, handle_output);
         aio_set_event_notifier(ctx, &vq->host_notifier, true,
                                virtio_queue_host_notifier_aio_read,
                                virtio_queue_host_notifier_aio_poll);
@@ -2460,7 +2487,7 @@ void virtio_queue_aio_set_host_notifier_handler(VirtQueue *vq, AioContext *ctx,
         /* Test and clear notifier before after disabling event,
          * in case poll callback didn't have time to run. */
         virtio_queue_host_notifier_aio_read(&vq->host_notifier);
-        vq->handle_aio_output = NULL;
+        atomic_set(&vq->handle_aio_output, NULL);
     }
 }
 
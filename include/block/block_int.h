@@ -32,6 +32,7 @@
 #include "qemu/stats64.h"
 #include "qemu/timer.h"
 #include "qemu/hbitmap.h"
+#include "qemu/interval-tree.h"
 #include "block/snapshot.h"
 #include "qemu/main-loop.h"
 #include "qemu/throttle.h"
@@ -51,6 +52,7 @@
 #define BLOCK_OPT_SUBFMT            "subformat"
 #define BLOCK_OPT_COMPAT_LEVEL      "compat"
 #define BLOCK_OPT_LAZY_REFCOUNTS    "lazy_refcounts"
+#define BLOCK_OPT_EXTL2             "extended_l2"
 #define BLOCK_OPT_ADAPTER_TYPE      "adapter_type"
 #define BLOCK_OPT_REDUNDANCY        "redundancy"
 #define BLOCK_OPT_NOCOW             "nocow"
@@ -77,6 +79,8 @@ typedef struct BdrvTrackedRequest {
     uint64_t overlap_bytes;
 
     QLIST_ENTRY(BdrvTrackedRequest) list;
+    /* [overlap_offset, overlap_offset + overlap_bytes) in overlap_tree */
+    IntervalTreeNode overlap_node;
     Coroutine *co; /* owner, used for deadlock detection */
     CoQueue wait_queue; /* coroutines blocked on this request */
 
@@ -118,6 +122,15 @@ struct BlockDriver {
     /* Set if a driver can support backing files */
     bool supports_backing;
 
+    /*
+     * Set if the driver's I/O callbacks may run concurrently in several
+     * AioContexts, as they do below a multiqueue BlockBackend.  Such
+     * drivers keep per-AioContext I/O state, so .bdrv_io_plug and
+     * .bdrv_io_unplug are called for every (nested) plug and unplug, from
+     * the AioContext that does it.
+     */
+    bool supports_multiqueue;
+
     /* For handling image reopen for split or non-split files */
     int (*bdrv_reopen_prepare)(BDRVReopenState *reopen_state,
                                BlockReopenQueue *queue, Error **errp);
@@ -321,6 +334,7 @@ struct BlockDriver {
     int (*bdrv_get_info)(BlockDriverState *bs, BlockDriverInfo *bdi);
     ImageInfoSpecific *(*bdrv_get_specific_info)(BlockDriverState *bs,
                                                  Error **errp);
+    BlockStatsSpecific *(*bdrv_get_specific_stats)(BlockDriverState *bs);
 
     int coroutine_fn (*bdrv_save_vmstate)(BlockDriverState *bs,
                                           QEMUIOVector *qiov,
@@ -800,6 +814,11 @@ struct BlockDriverState {
     */
     unsigned io_plugged;
 
+    /* Number of multiqueue BlockBackends above this node, see
+     * blk_set_multiqueue().  Accessed with atomic ops.
+     */
+    unsigned int multiqueue;
+
     /* do we need to tell the quest if we have a volatile write cache? */
     int enable_write_cache;
 
@@ -812,6 +831,8 @@ struct BlockDriverState {
     /* Protected by reqs_lock.  */
     CoMutex reqs_lock;
     QLIST_HEAD(, BdrvTrackedRequest) tracked_requests;
+    /* The same requests, indexed by overlap range for serialisation */
+    IntervalTreeRoot overlap_tree;
     CoQueue flush_queue;                  /* Serializing flush queue */
     bool active_flush_req;                /* Flush request in flight? */
 
@@ -139,15 +139,40 @@ typedef struct CPUTLBWindow {
     size_t max_entries;
 } CPUTLBWindow;
 
+#define CPU_TLB_LARGE_PAGES 8
+
+/**
+ * struct CPUTLBLargePage
+ * @vaddr: virtual address of the large page, aligned to @size
+ * @size: size of the large page; 0 if the slot is unused
+ *
+ * A large page installed with tlb_set_page_with_attrs().  The size
+ * passed there only describes the scope of a flush: it does not mean
+ * that the page is physically contiguous (e.g. with two-stage
+ * translation), so it is never used to derive tlb entries for the
+ * other pages in the range.
+ */
+typedef struct CPUTLBLargePage {
+    target_ulong vaddr;
+    target_ulong size;
+} CPUTLBLargePage;
+
 typedef struct CPUTLBDesc {
     /*
      * Describe a region covering all of the large pages allocated
-     * into the tlb.  When any page within this region is flushed,
-     * we must flush the entire tlb.  The region is matched if
-     * (addr & large_page_mask) == large_page_addr.
+     * into the tlb that are no longer in @large_pages.  When any page
+     * within this region is flushed, we must flush the entire tlb.
+     * The region is matched if (addr & large_page_mask) == large_page_addr.
      */
     target_ulong large_page_addr;
     target_ulong large_page_mask;
+    /*
+     * The most recently installed large pages.  When a page within one
+     * of them is flushed, only the entries of that large page are.
+     */
+    CPUTLBLargePage large_pages[CPU_TLB_LARGE_PAGES];
+    /* The next index to use in @large_pages.  */
+    size_t lp_index;
     /* The next index to use in the tlb victim table.  */
     size_t vindex;
     CPUTLBWindow window;
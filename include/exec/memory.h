@@ -414,6 +414,15 @@ struct MemoryListener {
     void (*log_stop)(MemoryListener *listener, MemoryRegionSection *section,
                      int old, int new);
     void (*log_sync)(MemoryListener *listener, MemoryRegionSection *section);
+    /* Synchronize the dirty log of every section at once, for listeners
+     * that cannot do it per section.  Used instead of log_sync.
+     */
+    void (*log_sync_global)(MemoryListener *listener);
+    /* Re-arm dirty logging of @section, whose dirty state was fetched by
+     * log_sync; only needed when log_sync does not do it by itself.
+     * May be called without the BQL, e.g. from the migration thread.
+     */
+    void (*log_clear)(MemoryListener *listener, MemoryRegionSection *section);
     void (*log_global_start)(MemoryListener *listener);
     void (*log_global_stop)(MemoryListener *listener);
     void (*eventfd_add)(MemoryListener *listener, MemoryRegionSection *section,
@@ -434,6 +443,11 @@ struct MemoryListener {
 /**
  * AddressSpace: describes a mapping of addresses to #MemoryRegion objects
  */
+/* Default limit of the bounce buffers of an address space, one page as
+ * was the case when there was a single global bounce buffer.
+ */
+#define DEFAULT_MAX_BOUNCE_BUFFER_SIZE 4096
+
 struct AddressSpace {
     /* All fields are private. */
     struct rcu_head rcu;
@@ -447,6 +461,13 @@ struct AddressSpace {
     struct MemoryRegionIoeventfd *ioeventfds;
     QTAILQ_HEAD(, MemoryListener) listeners;
     QTAILQ_ENTRY(AddressSpace) address_spaces_link;
+
+    /* Maximum and current bytes of bounce buffers for address_space_map() */
+    size_t max_bounce_buffer_size;
+    size_t bounce_buffer_size;
+    /* Callbacks to invoke when bounce buffer space frees up */
+    QemuMutex map_client_list_lock;
+    QLIST_HEAD(, AddressSpaceMapClient) map_client_list;
 };
 
 typedef struct AddressSpaceDispatch AddressSpaceDispatch;
@@ -1344,6 +1365,23 @@ bool memory_region_snapshot_get_dirty(MemoryRegion *mr,
 void memory_region_reset_dirty(MemoryRegion *mr, hwaddr addr,
                                hwaddr size, unsigned client);
 
+/**
+ * memory_region_clear_dirty_bitmap: Re-arm dirty logging for a range of
+ *                                   pages in the accelerator.
+ *
+ * Some accelerators, such as KVM with manual dirty log protection, do not
+ * start tracking writes again when their dirty log is synchronized.  Call
+ * this function for a range whose dirty information has been consumed,
+ * before reading its contents, so that later writes are logged again.
+ * The BQL need not be held.
+ *
+ * @mr: the region being updated.
+ * @start: the start of the subrange, relative to the start of @mr.
+ * @len: the size of the subrange.
+ */
+void memory_region_clear_dirty_bitmap(MemoryRegion *mr, hwaddr start,
+                                      hwaddr len);
+
 /**
  * memory_region_flush_rom_device: Mark a range of pages dirty and invalidate
  *                                 TBs (for self-modifying code).
@@ -2043,8 +2081,13 @@ bool address_space_access_valid(AddressSpace *as, hwaddr addr, hwaddr len,
  * May map a subset of the requested range, given by and returned in @plen.
  * May return %NULL if resources needed to perform the mapping are exhausted.
  * Use only for reads OR writes - not for read-modify-write operations.
- * Use cpu_register_map_client() to know when retrying the map operation is
- * likely to succeed.
+ * Use address_space_register_map_client() to know when retrying the map
+ * operation is likely to succeed.
+ *
+ * Regions that are not directly accessible, such as MMIO, are accessed
+ * through a bounce buffer.  The total size of the bounce buffers of each
+ * address space is limited by its max_bounce_buffer_size, so a mapping of
+ * such a region may be shorter than requested.
  *
  * @as: #AddressSpace to be accessed
  * @addr: address within that address space
@@ -2069,6 +2112,27 @@ void *address_space_map(AddressSpace *as, hwaddr addr,
 void address_space_unmap(AddressSpace *as, void *buffer, hwaddr len,
                          int is_write, hwaddr access_len);
 
+/* address_space_register_map_client: Register a callback to invoke when
+ * resources for address_space_map() are available again.
+ *
+ * address_space_map may fail when there are not enough resources available,
+ * such as when bounce buffer memory would exceed the limit.  The callback can
+ * be used to retry the address_space_map operation.  Note that the callback
+ * gets automatically removed after firing.
+ *
+ * @as: #AddressSpace to be accessed
+ * @bh: callback to invoke when address_space_map() retry is appropriate
+ */
+void address_space_register_map_client(AddressSpace *as, QEMUBH *bh);
+
+/* address_space_unregister_map_client: Unregister a callback that was
+ * previously registered with address_space_register_map_client.
+ *
+ * @as: #AddressSpace to be accessed
+ * @bh: callback to unregister
+ */
+void address_space_unregister_map_client(AddressSpace *as, QEMUBH *bh);
+
 
 /* Internal functions, part of the implementation of address_space_read.  */
 MemTxResult address_space_read_full(AddressSpace *as, hwaddr addr,
@@ -26,6 +26,12 @@
 #define CODE_GEN_HTABLE_BITS     15
 #define CODE_GEN_HTABLE_SIZE     (1 << CODE_GEN_HTABLE_BITS)
 
+#define TB_GEN_LOCK_BITS         6
+#define TB_GEN_LOCK_SIZE         (1 << TB_GEN_LOCK_BITS)
+
+#define TB_JMP_CACHE_L2_BITS     16
+#define TB_JMP_CACHE_L2_SIZE     (1 << TB_JMP_CACHE_L2_BITS)
+
 typedef struct TranslationBlock TranslationBlock;
 typedef struct TBContext TBContext;
 
@@ -33,8 +39,27 @@ struct TBContext {
 
     struct qht htable;
 
+    /*
+     * Second-level jump cache, looked up on a miss in a vCPU's
+     * tb_jmp_cache before walking @htable.  It is indexed by the same
+     * hash as @htable, which depends on the physical PC, so that it can
+     * be shared by all vCPUs regardless of their guest page tables.
+     * Entries are set and cleared with atomics; they are validated with
+     * the same comparison as @htable entries, so a stale entry can only
+     * cause a miss.
+     */
+    TranslationBlock *jmp_cache[TB_JMP_CACHE_L2_SIZE];
+
+    /*
+     * Serialize translations of the same (pc, flags) pair, so that
+     * vCPUs missing on the same code wait for the first translation
+     * instead of duplicating it.
+     */
+    QemuMutex gen_lock[TB_GEN_LOCK_SIZE];
+
     /* statistics */
     unsigned tb_flush_count;
+    size_t tb_gen_shared_count;
 };
 
 extern TBContext tb_ctx;
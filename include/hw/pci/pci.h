@@ -344,6 +344,9 @@ struct PCIDevice {
     MemoryRegion rom;
     uint32_t rom_bar;
 
+    /* Limit of the bounce buffers for DMA to non-RAM, in bytes */
+    uint64_t max_bounce_buffer_size;
+
     /* INTx routing notifier */
     PCIINTxRoutingNotifier intx_routing_notifier;
 
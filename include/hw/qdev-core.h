@@ -3,6 +3,7 @@
 
 #include "qemu/queue.h"
 #include "qemu/bitmap.h"
+#include "qemu/thread.h"
 #include "qom/object.h"
 #include "hw/irq.h"
 #include "hw/hotplug.h"
@@ -131,6 +132,8 @@ struct NamedGPIOList {
 /**
  * DeviceState:
  * @realized: Indicates whether the device has been fully constructed.
+ * @lock: Protects the state of devices whose memory regions are
+ * dispatched without the BQL; see qdev_lock().
  *
  * This structure should not be accessed directly.  We declare it here
  * so that it can be embedded in individual device state structures.
@@ -152,6 +155,7 @@ struct DeviceState {
     int num_child_bus;
     int instance_id_alias;
     int alias_required_for_version;
+    QemuRecMutex lock;
 };
 
 struct DeviceListener {
@@ -418,6 +422,33 @@ const char *qdev_fw_name(DeviceState *dev);
 
 Object *qdev_get_machine(void);
 
+/*
+ * Device locking.
+ *
+ * MMIO and PIO handlers of memory regions that have been passed to
+ * memory_region_clear_global_locking() run without the BQL, possibly
+ * on several vCPU threads at once.  Such handlers protect the device
+ * state with the device lock.  Any other code that changes that state,
+ * such as timers, reset or IRQ inputs, still runs under the BQL and
+ * must take the device lock as well.  The lock is recursive.
+ *
+ * Handlers that need the BQL, e.g. to raise an interrupt or to change
+ * the memory map, use qdev_lock_with_iothread(): the BQL must always be
+ * taken before the device lock, never while holding it.
+ */
+void qdev_lock(DeviceState *dev);
+void qdev_unlock(DeviceState *dev);
+
+/**
+ * qdev_lock_with_iothread: take the BQL, unless it is already held,
+ * and then the lock of @dev.
+ *
+ * Returns: whether the BQL was taken; pass it to
+ * qdev_unlock_with_iothread().
+ */
+bool qdev_lock_with_iothread(DeviceState *dev);
+void qdev_unlock_with_iothread(DeviceState *dev, bool unlock_iothread);
+
 void object_apply_compat_props(Object *obj);
 
 /* FIXME: make this a link<> */
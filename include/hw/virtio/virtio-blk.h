@@ -34,6 +34,8 @@ struct VirtIOBlkConf
 {
     BlockConf conf;
     IOThread *iothread;
+    uint32_t num_iothreads;
+    char **iothreads;
     char *serial;
     uint32_t scsi;
     uint32_t config_wce;
@@ -0,0 +1,54 @@
+/*
+ * Intrusive interval tree
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#ifndef QEMU_INTERVAL_TREE_H
+#define QEMU_INTERVAL_TREE_H
+
+/*
+ * A treap of half-open intervals [start, end), ordered by start and
+ * augmented with the largest end in each subtree, so that the intervals
+ * overlapping a range are found in O(log n + k) expected time.
+ *
+ * Nodes are embedded in the caller's structures and must not be changed
+ * while they are in a tree; to move an interval, remove it, update it and
+ * insert it again.  Empty intervals never overlap anything.
+ *
+ * The tree does not do any locking.
+ */
+
+typedef struct IntervalTreeNode {
+    struct IntervalTreeNode *left, *right;
+    uint64_t start;
+    uint64_t end;
+    uint64_t subtree_end;
+    uint32_t priority;
+} IntervalTreeNode;
+
+typedef struct IntervalTreeRoot {
+    IntervalTreeNode *root;
+    uint32_t seed;
+} IntervalTreeRoot;
+
+/* Return true to pick @node, false to go on with the next overlapping one */
+typedef bool IntervalTreeMatchFunc(IntervalTreeNode *node, void *opaque);
+
+/* Add @node, whose start and end must already be set, to @root */
+void interval_tree_insert(IntervalTreeRoot *root, IntervalTreeNode *node);
+
+/* Remove @node, which must be in @root */
+void interval_tree_remove(IntervalTreeRoot *root, IntervalTreeNode *node);
+
+/*
+ * Return the node with the lowest start among those that overlap
+ * [@start, @end) and for which @match returns true, or NULL.  @match may
+ * be NULL to accept any overlapping node.
+ */
+IntervalTreeNode *interval_tree_find(IntervalTreeRoot *root,
+                                     uint64_t start, uint64_t end,
+                                     IntervalTreeMatchFunc *match,
+                                     void *opaque);
+
+#endif
@@ -360,6 +360,11 @@ void qemu_anon_ram_free(void *ptr, size_t size);
 #else
 #define QEMU_MADV_REMOVE QEMU_MADV_INVALID
 #endif
+#ifdef MADV_POPULATE_WRITE
+#define QEMU_MADV_POPULATE_WRITE MADV_POPULATE_WRITE
+#else
+#define QEMU_MADV_POPULATE_WRITE QEMU_MADV_INVALID
+#endif
 
 #elif defined(CONFIG_POSIX_MADVISE)
 
@@ -373,6 +378,7 @@ void qemu_anon_ram_free(void *ptr, size_t size);
 #define QEMU_MADV_HUGEPAGE  QEMU_MADV_INVALID
 #define QEMU_MADV_NOHUGEPAGE  QEMU_MADV_INVALID
 #define QEMU_MADV_REMOVE QEMU_MADV_INVALID
+#define QEMU_MADV_POPULATE_WRITE QEMU_MADV_INVALID
 
 #else /* no-op */
 
@@ -386,6 +392,7 @@ void qemu_anon_ram_free(void *ptr, size_t size);
 #define QEMU_MADV_HUGEPAGE  QEMU_MADV_INVALID
 #define QEMU_MADV_NOHUGEPAGE  QEMU_MADV_INVALID
 #define QEMU_MADV_REMOVE QEMU_MADV_INVALID
+#define QEMU_MADV_POPULATE_WRITE QEMU_MADV_INVALID
 
 #endif
 
@@ -567,9 +574,55 @@ unsigned long qemu_getauxval(unsigned long type);
 
 void qemu_set_tty_echo(int fd, bool echo);
 
+/**
+ * os_mem_prealloc:
+ * @fd: the file descriptor backing @area, or -1
+ * @area: the memory to preallocate
+ * @sz: the size of @area
+ * @smp_cpus: the number of guest CPUs, which bounds the number of threads
+ * @host_nodes: bitmap of host NUMA nodes
+ * @maxnode: the number of bits in @host_nodes, or 0
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Fault in all pages of @area, using several threads.  If @maxnode is
+ * not zero, the threads run on the CPUs of the host NUMA nodes in
+ * @host_nodes, so that the memory is not faulted in from remote nodes.
+ */
 void os_mem_prealloc(int fd, char *area, size_t sz, int smp_cpus,
+                     const unsigned long *host_nodes, unsigned long maxnode,
                      Error **errp);
 
+typedef struct MemPreallocContext MemPreallocContext;
+
+/**
+ * os_mem_prealloc_async:
+ *
+ * Like os_mem_prealloc(), but return as soon as the threads are started.
+ * This is only possible when the host can populate memory without
+ * writing to it, because the caller may already be storing data into
+ * @area.  Returns NULL if it cannot, in which case the caller should use
+ * os_mem_prealloc().
+ */
+MemPreallocContext *os_mem_prealloc_async(int fd, char *area, size_t sz,
+                                          int smp_cpus,
+                                          const unsigned long *host_nodes,
+                                          unsigned long maxnode);
+
+/**
+ * os_mem_prealloc_progress:
+ *
+ * Returns: the percentage of the memory that @ctx has populated so far.
+ */
+unsigned int os_mem_prealloc_progress(MemPreallocContext *ctx);
+
+/**
+ * os_mem_prealloc_wait:
+ *
+ * Wait for the preallocation started by os_mem_prealloc_async() to
+ * finish, and free @ctx.
+ */
+void os_mem_prealloc_wait(MemPreallocContext *ctx, Error **errp);
+
 /**
  * qemu_get_pid_name:
  * @pid: pid of a process
@@ -0,0 +1,145 @@
+/*
+ * QEMU TCG plugin support, internal interfaces
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#ifndef QEMU_PLUGIN_H
+#define QEMU_PLUGIN_H
+
+#include "qemu/qemu-plugin.h"
+#include "qemu/error-report.h"
+#include "qemu/queue.h"
+#include "qemu/option.h"
+
+/* A plugin requested on the command line, waiting to be loaded */
+struct qemu_plugin_desc {
+    char *path;
+    char **argv;
+    QTAILQ_ENTRY(qemu_plugin_desc) entry;
+    int argc;
+};
+
+typedef QTAILQ_HEAD(, qemu_plugin_desc) QemuPluginList;
+
+#ifdef CONFIG_PLUGIN
+extern QemuOptsList qemu_plugin_opts;
+
+void qemu_plugin_opt_parse(const char *optarg, QemuPluginList *head);
+int qemu_plugin_load_list(QemuPluginList *head);
+#else /* !CONFIG_PLUGIN */
+static inline void qemu_plugin_opt_parse(const char *optarg,
+                                         QemuPluginList *head)
+{
+    error_report("plugin interface not enabled in this build");
+    exit(1);
+}
+
+static inline int qemu_plugin_load_list(QemuPluginList *head)
+{
+    return 0;
+}
+#endif /* !CONFIG_PLUGIN */
+
+/* Encoding of qemu_plugin_meminfo_t */
+#define QEMU_PLUGIN_MEMINFO_SHIFT_MASK  0x3
+#define QEMU_PLUGIN_MEMINFO_SIGN        (1 << 2)
+#define QEMU_PLUGIN_MEMINFO_BE          (1 << 3)
+#define QEMU_PLUGIN_MEMINFO_STORE       (1 << 4)
+
+enum plugin_dyn_cb_type {
+    PLUGIN_CB_REGULAR,
+    PLUGIN_CB_INLINE,
+};
+
+/* A callback registered on a TB or an instruction at translation time */
+struct qemu_plugin_dyn_cb {
+    enum plugin_dyn_cb_type type;
+    /* accesses to instrument, for memory callbacks */
+    enum qemu_plugin_mem_rw rw;
+    /* the user data of regular callbacks, the target of inline ops */
+    void *userp;
+    union {
+        qemu_plugin_vcpu_udata_cb_t vcpu_udata;
+        qemu_plugin_vcpu_mem_cb_t vcpu_mem;
+    } f;
+    struct {
+        enum qemu_plugin_op op;
+        uint64_t imm;
+    } inline_insn;
+};
+
+/*
+ * A guest memory access done by the instruction being translated.
+ * @op and @vaddr are a TCGOp and a TCGTemp; they are opaque here so
+ * that this header does not depend on the target.
+ */
+struct qemu_plugin_mem_site {
+    void *op;
+    void *vaddr;
+    qemu_plugin_meminfo_t info;
+    /* index in qemu_plugin_tb.free_temps */
+    unsigned free_temps;
+};
+
+struct qemu_plugin_insn {
+    uint64_t vaddr;
+    size_t size;
+    /* the insn_start TCGOp of the instruction */
+    void *start_op;
+    /* index in qemu_plugin_tb.free_temps */
+    unsigned free_temps;
+    GArray *exec_cbs;
+    GArray *mem_cbs;
+    GArray *mem_sites;
+};
+
+/*
+ * The TB being translated.  The structure and its instructions are
+ * per translation thread and reused from one translation to the next.
+ */
+struct qemu_plugin_tb {
+    GPtrArray *insns;
+    size_t n;
+    uint64_t vaddr;
+    GArray *exec_cbs;
+    /* the TCG temps that are free where instrumentation may be inserted */
+    GArray *free_temps;
+};
+
+static inline struct qemu_plugin_insn *qemu_plugin_insn_alloc(void)
+{
+    struct qemu_plugin_insn *insn = g_new0(struct qemu_plugin_insn, 1);
+
+    insn->exec_cbs = g_array_new(false, false,
+                                 sizeof(struct qemu_plugin_dyn_cb));
+    insn->mem_cbs = g_array_new(false, false,
+                                sizeof(struct qemu_plugin_dyn_cb));
+    insn->mem_sites = g_array_new(false, false,
+                                  sizeof(struct qemu_plugin_mem_site));
+    return insn;
+}
+
+/* Return the next instruction of @tb, reset for a new translation */
+static inline struct qemu_plugin_insn *
+qemu_plugin_tb_insn_get(struct qemu_plugin_tb *tb)
+{
+    struct qemu_plugin_insn *insn;
+
+    if (unlikely(tb->n == tb->insns->len)) {
+        g_ptr_array_add(tb->insns, qemu_plugin_insn_alloc());
+    }
+    insn = g_ptr_array_index(tb->insns, tb->n++);
+    insn->vaddr = 0;
+    insn->size = 0;
+    insn->start_op = NULL;
+    g_array_set_size(insn->exec_cbs, 0);
+    g_array_set_size(insn->mem_cbs, 0);
+    g_array_set_size(insn->mem_sites, 0);
+    return insn;
+}
+
+bool qemu_plugin_tb_trans_enabled(void);
+void qemu_plugin_tb_trans_cb(struct qemu_plugin_tb *tb);
+
+#endif /* QEMU_PLUGIN_H */
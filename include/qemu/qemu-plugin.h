@@ -0,0 +1,228 @@
+/*
+ * QEMU TCG instrumentation plugin API
+ *
+ * This is the only header a plugin needs to include.  It does not
+ * depend on any other QEMU header, so that plugins can be built out of
+ * tree against an installed copy of it.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#ifndef QEMU_PLUGIN_API_H
+#define QEMU_PLUGIN_API_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#if defined _WIN32 || defined __CYGWIN__
+  #define QEMU_PLUGIN_EXPORT __declspec(dllexport)
+#else
+  #define QEMU_PLUGIN_EXPORT __attribute__((visibility("default")))
+#endif
+
+/*
+ * Version of the plugin API.  Plugins must define the
+ * qemu_plugin_version symbol to the value they were built against;
+ * QEMU refuses to load plugins whose version is outside of
+ * [QEMU_PLUGIN_MIN_VERSION, QEMU_PLUGIN_VERSION].
+ */
+#define QEMU_PLUGIN_VERSION     0
+#define QEMU_PLUGIN_MIN_VERSION 0
+
+extern QEMU_PLUGIN_EXPORT int qemu_plugin_version;
+
+typedef uint64_t qemu_plugin_id_t;
+
+typedef struct qemu_info_t {
+    /* the name of the emulated target, e.g. "aarch64" */
+    const char *target_name;
+    /* the range of API versions supported by this QEMU */
+    struct {
+        int min;
+        int cur;
+    } version;
+    /* true for system emulation, false for user-mode emulation */
+    bool system_emulation;
+} qemu_info_t;
+
+/**
+ * qemu_plugin_install() - entry point of a plugin
+ * @id: this plugin's opaque ID
+ * @info: information about the QEMU that is loading the plugin
+ * @argc: number of "arg=" options given on the command line
+ * @argv: the values of those options
+ *
+ * All plugins must export this symbol.  It is called once, before any
+ * guest code runs, and is the only place where translation and atexit
+ * callbacks can be registered.
+ *
+ * Returns 0 on success; any other value makes QEMU exit.
+ */
+QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id,
+                                           const qemu_info_t *info,
+                                           int argc, char **argv);
+
+typedef void (*qemu_plugin_udata_cb_t)(qemu_plugin_id_t id, void *userdata);
+
+/**
+ * qemu_plugin_register_atexit_cb() - called when QEMU exits
+ * @id: plugin ID
+ * @cb: callback
+ * @userdata: passed unmodified to @cb
+ *
+ * Typically used to print the statistics gathered by the plugin.
+ */
+void qemu_plugin_register_atexit_cb(qemu_plugin_id_t id,
+                                    qemu_plugin_udata_cb_t cb,
+                                    void *userdata);
+
+/*
+ * Opaque handles to the translation block and to the guest instructions
+ * being translated.  They are only valid during a translation callback.
+ */
+struct qemu_plugin_tb;
+struct qemu_plugin_insn;
+
+typedef void (*qemu_plugin_vcpu_tb_trans_cb_t)(qemu_plugin_id_t id,
+                                               struct qemu_plugin_tb *tb);
+
+/**
+ * qemu_plugin_register_vcpu_tb_trans_cb() - called at TB translation time
+ * @id: plugin ID
+ * @cb: callback
+ *
+ * @cb is called after a translation block has been translated but
+ * before host code is generated for it.  It may inspect the
+ * instructions of the TB and register execution-time callbacks on the
+ * TB or on any of its instructions.  Because guest code is cached, the
+ * callback is not called every time the code is executed.
+ */
+void qemu_plugin_register_vcpu_tb_trans_cb(qemu_plugin_id_t id,
+                                           qemu_plugin_vcpu_tb_trans_cb_t cb);
+
+typedef void (*qemu_plugin_vcpu_udata_cb_t)(unsigned int vcpu_index,
+                                            void *userdata);
+
+/**
+ * enum qemu_plugin_op - operations for inline callbacks
+ * @QEMU_PLUGIN_INLINE_ADD_U64: add an immediate to a uint64_t in memory
+ *
+ * Inline operations are emitted directly into the generated code.
+ * While only one vCPU runs at a time, the add is a plain load, add and
+ * store.  With MTTCG, when vCPUs run in parallel, it is done atomically
+ * by a call out of the generated code instead, so no update is lost but
+ * a counter shared by all vCPUs becomes contended.  Plugins that count
+ * hot events can keep one counter per vCPU to avoid that.
+ */
+enum qemu_plugin_op {
+    QEMU_PLUGIN_INLINE_ADD_U64,
+};
+
+/**
+ * qemu_plugin_register_vcpu_tb_exec_cb() - call @cb whenever @tb executes
+ * @tb: the TB being translated
+ * @cb: callback
+ * @userdata: passed unmodified to @cb
+ */
+void qemu_plugin_register_vcpu_tb_exec_cb(struct qemu_plugin_tb *tb,
+                                          qemu_plugin_vcpu_udata_cb_t cb,
+                                          void *userdata);
+
+/**
+ * qemu_plugin_register_vcpu_tb_exec_inline() - inline op on TB execution
+ * @tb: the TB being translated
+ * @op: the operation to perform
+ * @ptr: the target of the operation
+ * @imm: the immediate operand of the operation
+ */
+void qemu_plugin_register_vcpu_tb_exec_inline(struct qemu_plugin_tb *tb,
+                                              enum qemu_plugin_op op,
+                                              void *ptr, uint64_t imm);
+
+/**
+ * qemu_plugin_register_vcpu_insn_exec_cb() - call @cb before @insn executes
+ * @insn: an instruction of the TB being translated
+ * @cb: callback
+ * @userdata: passed unmodified to @cb
+ */
+void qemu_plugin_register_vcpu_insn_exec_cb(struct qemu_plugin_insn *insn,
+                                            qemu_plugin_vcpu_udata_cb_t cb,
+                                            void *userdata);
+
+/**
+ * qemu_plugin_register_vcpu_insn_exec_inline() - inline op before @insn
+ * @insn: an instruction of the TB being translated
+ * @op: the operation to perform
+ * @ptr: the target of the operation
+ * @imm: the immediate operand of the operation
+ */
+void qemu_plugin_register_vcpu_insn_exec_inline(struct qemu_plugin_insn *insn,
+                                                enum qemu_plugin_op op,
+                                                void *ptr, uint64_t imm);
+
+size_t qemu_plugin_tb_n_insns(const struct qemu_plugin_tb *tb);
+
+uint64_t qemu_plugin_tb_vaddr(const struct qemu_plugin_tb *tb);
+
+struct qemu_plugin_insn *
+qemu_plugin_tb_get_insn(const struct qemu_plugin_tb *tb, size_t idx);
+
+uint64_t qemu_plugin_insn_vaddr(const struct qemu_plugin_insn *insn);
+
+size_t qemu_plugin_insn_size(const struct qemu_plugin_insn *insn);
+
+/*
+ * Memory accesses.  A qemu_plugin_meminfo_t describes one guest memory
+ * access and is decoded with the accessors below.
+ */
+typedef uint32_t qemu_plugin_meminfo_t;
+
+enum qemu_plugin_mem_rw {
+    QEMU_PLUGIN_MEM_R = 1,
+    QEMU_PLUGIN_MEM_W,
+    QEMU_PLUGIN_MEM_RW,
+};
+
+/* log2 of the size of the access in bytes */
+unsigned int qemu_plugin_mem_size_shift(qemu_plugin_meminfo_t info);
+bool qemu_plugin_mem_is_sign_extended(qemu_plugin_meminfo_t info);
+bool qemu_plugin_mem_is_big_endian(qemu_plugin_meminfo_t info);
+bool qemu_plugin_mem_is_store(qemu_plugin_meminfo_t info);
+
+typedef void
+(*qemu_plugin_vcpu_mem_cb_t)(unsigned int vcpu_index,
+                             qemu_plugin_meminfo_t info, uint64_t vaddr,
+                             void *userdata);
+
+/**
+ * qemu_plugin_register_vcpu_mem_cb() - call @cb on memory accesses
+ * @insn: an instruction of the TB being translated
+ * @cb: callback
+ * @rw: which kind of accesses to report
+ * @userdata: passed unmodified to @cb
+ *
+ * @cb is called after each guest memory access performed by @insn
+ * that matches @rw, with the guest virtual address of the access.
+ * Atomic read-modify-write operations are reported as a read followed
+ * by a write.
+ */
+void qemu_plugin_register_vcpu_mem_cb(struct qemu_plugin_insn *insn,
+                                      qemu_plugin_vcpu_mem_cb_t cb,
+                                      enum qemu_plugin_mem_rw rw,
+                                      void *userdata);
+
+/**
+ * qemu_plugin_register_vcpu_mem_inline() - inline op on memory accesses
+ * @insn: an instruction of the TB being translated
+ * @rw: which kind of accesses to count
+ * @op: the operation to perform
+ * @ptr: the target of the operation
+ * @imm: the immediate operand of the operation
+ */
+void qemu_plugin_register_vcpu_mem_inline(struct qemu_plugin_insn *insn,
+                                          enum qemu_plugin_mem_rw rw,
+                                          enum qemu_plugin_op op, void *ptr,
+                                          uint64_t imm);
+
+#endif /* QEMU_PLUGIN_API_H */
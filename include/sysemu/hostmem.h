@@ -58,6 +58,11 @@ struct HostMemoryBackend {
     DECLARE_BITMAP(host_nodes, MAX_NODES + 1);
     HostMemPolicy policy;
 
+    /* preallocation running in the background until machine init is done */
+    bool prealloc_async;
+    MemPreallocContext *prealloc_ctx;
+    Notifier prealloc_done;
+
     MemoryRegion mr;
 };
 
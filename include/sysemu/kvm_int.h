@@ -18,13 +18,24 @@ typedef struct KVMSlot
     hwaddr start_addr;
     ram_addr_t memory_size;
     void *ram;
+    /* ram_addr_t of the start of the slot, for the dirty ring */
+    ram_addr_t ram_start_offset;
     int slot;
     int flags;
     int old_flags;
+    /* Dirty bitmap last fetched from KVM, with manual dirty log protect */
+    unsigned long *dirty_bmap;
+    /* Counted in KVMState's number of slots that log into dirty rings */
+    bool dirty_ring_logging;
 } KVMSlot;
 
 typedef struct KVMMemoryListener {
     MemoryListener listener;
+    /*
+     * Protects @slots.  Slots are changed under the BQL, but the dirty
+     * log is also synced and cleared from the migration thread.
+     */
+    QemuMutex slots_lock;
     KVMSlot *slots;
     int as_id;
 } KVMMemoryListener;
@@ -35,6 +35,7 @@
 #include "qemu/envlist.h"
 #include "elf.h"
 #include "trace/control.h"
+#include "qemu/plugin.h"
 #include "target_elf.h"
 #include "cpu_loop-common.h"
 
@@ -361,6 +362,17 @@ static void handle_arg_reserved_va(const char *arg)
     }
 }
 
+static void handle_arg_hugepage(const char *arg)
+{
+    uint64_t size;
+
+    if (qemu_strtosz(arg, NULL, &size) < 0 || size > ULONG_MAX) {
+        fprintf(stderr, "Invalid huge page threshold: %s\n", arg);
+        exit(EXIT_FAILURE);
+    }
+    mmap_hugepage_threshold = size;
+}
+
 static void handle_arg_singlestep(const char *arg)
 {
     singlestep = 1;
@@ -385,6 +397,13 @@ static void handle_arg_trace(const char *arg)
     trace_file = trace_opt_parse(arg);
 }
 
+static QemuPluginList plugins = QTAILQ_HEAD_INITIALIZER(plugins);
+
+static void handle_arg_plugin(const char *arg)
+{
+    qemu_plugin_opt_parse(arg, &plugins);
+}
+
 struct qemu_argument {
     const char *argv;
     const char *env;
@@ -419,6 +438,9 @@ static const struct qemu_argument arg_table[] = {
      "address",    "set guest_base address to 'address'"},
     {"R",          "QEMU_RESERVED_VA", true,  handle_arg_reserved_va,
      "size",       "reserve 'size' bytes for guest virtual address space"},
+    {"hugepage",   "QEMU_HUGEPAGE",    true,  handle_arg_hugepage,
+     "size",       "use huge pages for anonymous mappings of 'size' bytes "
+     "or more"},
     {"d",          "QEMU_LOG",         true,  handle_arg_log,
      "item[,...]", "enable logging of specified items "
      "(use '-d help' for a list of items)"},
@@ -436,6 +458,8 @@ static const struct qemu_argument arg_table[] = {
      "",           "Seed for pseudo-random number generator"},
     {"trace",      "QEMU_TRACE",       true,  handle_arg_trace,
      "",           "[[enable=]<pattern>][,events=<file>][,file=<file>]"},
+    {"plugin",     "QEMU_PLUGIN",      true,  handle_arg_plugin,
+     "",           "[file=]<file>[,arg=<string>]"},
     {"version",    "QEMU_VERSION",     false, handle_arg_version,
      "",           "display version information and exit"},
     {NULL, NULL, false, NULL, NULL, NULL}
@@ -634,6 +658,9 @@ int main(int argc, char **argv, char **envp)
         exit(1);
     }
     trace_init_file(trace_file);
+    if (qemu_plugin_load_list(&plugins)) {
+        exit(1);
+    }
 
     /* Zero out regs */
     memset(regs, 0, sizeof(struct target_pt_regs));
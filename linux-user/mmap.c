@@ -23,6 +23,14 @@
 
 //#define DEBUG_MMAP
 
+/*
+ * mmap_lock serializes all changes to the guest address space (mmap,
+ * munmap, mprotect, mremap, shmat, brk) with translation, which also
+ * takes it as the user-mode page lock: it protects the per-page TB lists
+ * and the write protection of code pages.  page_set_flags() is kept
+ * cheap, but it still runs, and the callers still wait, under this one
+ * lock; there is no finer-grained locking of address ranges.
+ */
 static pthread_mutex_t mmap_mutex = PTHREAD_MUTEX_INITIALIZER;
 static __thread int mmap_lock_count;
 
@@ -247,6 +255,21 @@ static abi_ulong mmap_find_vma_reserved(abi_ulong start, abi_ulong size)
     return addr;
 }
 
+/* Private anonymous mappings at least this large use huge pages */
+unsigned long mmap_hugepage_threshold;
+
+void mmap_hugepage_advise(abi_ulong start, abi_ulong len)
+{
+    abi_ulong real_start = HOST_PAGE_ALIGN(start);
+    abi_ulong real_end = (start + len) & qemu_host_page_mask;
+
+    if (mmap_hugepage_threshold && len >= mmap_hugepage_threshold &&
+        real_start < real_end) {
+        qemu_madvise(g2h(real_start), real_end - real_start,
+                     QEMU_MADV_HUGEPAGE);
+    }
+}
+
 /*
  * Find and reserve a free memory area of size 'size'. The search
  * starts at 'start'.
@@ -562,6 +585,9 @@ abi_long target_mmap(abi_ulong start, abi_ulong len, int prot,
         }
     }
  the_end1:
+    if ((flags & (MAP_ANONYMOUS | MAP_TYPE)) == (MAP_ANONYMOUS | MAP_PRIVATE)) {
+        mmap_hugepage_advise(start, len);
+    }
     page_set_flags(start, start + len, prot | PAGE_VALID);
  the_end:
 #ifdef DEBUG_MMAP
@@ -443,7 +443,9 @@ abi_long target_mremap(abi_ulong old_addr, abi_ulong old_size,
                        abi_ulong new_addr);
 extern unsigned long last_brk;
 extern abi_ulong mmap_next_start;
+extern unsigned long mmap_hugepage_threshold;
 abi_ulong mmap_find_vma(abi_ulong, abi_ulong);
+void mmap_hugepage_advise(abi_ulong start, abi_ulong len);
 void mmap_fork_start(void);
 void mmap_fork_end(int child);
 
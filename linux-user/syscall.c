@@ -928,6 +928,9 @@ abi_long do_brk(abi_ulong new_brk)
 
         target_brk = new_brk;
         brk_page = HOST_PAGE_ALIGN(target_brk);
+        /* The heap grows in small steps; advise it as a whole */
+        mmap_hugepage_advise(target_original_brk,
+                             brk_page - target_original_brk);
         DEBUGF_BRK(TARGET_ABI_FMT_lx " (mapped_addr == brk_page)\n",
             target_brk);
         return target_brk;
@@ -6058,6 +6061,102 @@ _syscall1(int, sys_setgid, gid_t, gid)
 _syscall3(int, sys_setresuid, uid_t, ruid, uid_t, euid, uid_t, suid)
 _syscall3(int, sys_setresgid, gid_t, rgid, gid_t, egid, gid_t, sgid)
 
+/*
+ * Syscalls that take and return only integers whose meaning is the same
+ * for every Linux ABI, and that need no fd translation or other
+ * bookkeeping in QEMU.  When guest and host registers have the same
+ * width, do_syscall() passes them straight to the host, bypassing the
+ * big switch in do_syscall1().  The table holds the host number plus
+ * one, indexed by the target number.
+ */
+#define SYSCALL_PASSTHROUGH_MAX 8192
+
+static uint16_t syscall_passthrough_nr[SYSCALL_PASSTHROUGH_MAX];
+
+#define SYSCALL_PASSTHROUGH(name)                                       \
+    do {                                                                \
+        QEMU_BUILD_BUG_ON(TARGET_NR_##name >= SYSCALL_PASSTHROUGH_MAX); \
+        syscall_passthrough_nr[TARGET_NR_##name] = __NR_##name + 1;     \
+    } while (0)
+
+static void syscall_passthrough_init(void)
+{
+#if TARGET_ABI_BITS == HOST_LONG_BITS
+#if defined(TARGET_NR_getpid) && defined(__NR_getpid)
+    SYSCALL_PASSTHROUGH(getpid);
+#endif
+#if defined(TARGET_NR_getppid) && defined(__NR_getppid)
+    SYSCALL_PASSTHROUGH(getppid);
+#endif
+#if defined(TARGET_NR_gettid) && defined(__NR_gettid)
+    SYSCALL_PASSTHROUGH(gettid);
+#endif
+#if defined(TARGET_NR_getpgrp) && defined(__NR_getpgrp)
+    SYSCALL_PASSTHROUGH(getpgrp);
+#endif
+#if defined(TARGET_NR_getpgid) && defined(__NR_getpgid)
+    SYSCALL_PASSTHROUGH(getpgid);
+#endif
+#if defined(TARGET_NR_getsid) && defined(__NR_getsid)
+    SYSCALL_PASSTHROUGH(getsid);
+#endif
+#if defined(TARGET_NR_setsid) && defined(__NR_setsid)
+    SYSCALL_PASSTHROUGH(setsid);
+#endif
+#if defined(TARGET_NR_setpgid) && defined(__NR_setpgid)
+    SYSCALL_PASSTHROUGH(setpgid);
+#endif
+#if defined(TARGET_NR_sched_yield) && defined(__NR_sched_yield)
+    SYSCALL_PASSTHROUGH(sched_yield);
+#endif
+#if defined(TARGET_NR_sched_getscheduler) && defined(__NR_sched_getscheduler)
+    SYSCALL_PASSTHROUGH(sched_getscheduler);
+#endif
+#if defined(TARGET_NR_sched_get_priority_max) && defined(__NR_sched_get_priority_max)
+    SYSCALL_PASSTHROUGH(sched_get_priority_max);
+#endif
+#if defined(TARGET_NR_sched_get_priority_min) && defined(__NR_sched_get_priority_min)
+    SYSCALL_PASSTHROUGH(sched_get_priority_min);
+#endif
+#if defined(TARGET_NR_sync) && defined(__NR_sync)
+    SYSCALL_PASSTHROUGH(sync);
+#endif
+#if defined(TARGET_NR_syncfs) && defined(__NR_syncfs)
+    SYSCALL_PASSTHROUGH(syncfs);
+#endif
+#if defined(TARGET_NR_fsync) && defined(__NR_fsync)
+    SYSCALL_PASSTHROUGH(fsync);
+#endif
+#if defined(TARGET_NR_fdatasync) && defined(__NR_fdatasync)
+    SYSCALL_PASSTHROUGH(fdatasync);
+#endif
+#if defined(TARGET_NR_flock) && defined(__NR_flock)
+    SYSCALL_PASSTHROUGH(flock);
+#endif
+#if defined(TARGET_NR_umask) && defined(__NR_umask)
+    SYSCALL_PASSTHROUGH(umask);
+#endif
+#if defined(TARGET_NR_fchmod) && defined(__NR_fchmod)
+    SYSCALL_PASSTHROUGH(fchmod);
+#endif
+#if defined(TARGET_NR_lseek) && defined(__NR_lseek)
+    SYSCALL_PASSTHROUGH(lseek);
+#endif
+#if defined(TARGET_NR_ftruncate) && defined(__NR_ftruncate)
+    SYSCALL_PASSTHROUGH(ftruncate);
+#endif
+#if defined(TARGET_NR_listen) && defined(__NR_listen)
+    SYSCALL_PASSTHROUGH(listen);
+#endif
+#if defined(TARGET_NR_shutdown) && defined(__NR_shutdown)
+    SYSCALL_PASSTHROUGH(shutdown);
+#endif
+#if defined(TARGET_NR_inotify_rm_watch) && defined(__NR_inotify_rm_watch)
+    SYSCALL_PASSTHROUGH(inotify_rm_watch);
+#endif
+#endif
+}
+
 void syscall_init(void)
 {
     IOCTLEntry *ie;
@@ -6108,6 +6207,8 @@ void syscall_init(void)
 #endif
         ie++;
     }
+
+    syscall_passthrough_init();
 }
 
 #if TARGET_ABI_BITS == 32
@@ -11611,6 +11712,11 @@ abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
         ret = do_syscall1(cpu_env, num, arg1, arg2, arg3, arg4,
                           arg5, arg6, arg7, arg8);
         print_syscall_ret(num, ret);
+    } else if ((unsigned)num < SYSCALL_PASSTHROUGH_MAX &&
+               syscall_passthrough_nr[num]) {
+        /* Some of them, e.g. flock, may block */
+        ret = get_errno(safe_syscall(syscall_passthrough_nr[num] - 1,
+                                     arg1, arg2, arg3, arg4, arg5, arg6));
     } else {
         ret = do_syscall1(cpu_env, num, arg1, arg2, arg3, arg4,
                           arg5, arg6, arg7, arg8);
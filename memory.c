@@ -42,6 +42,18 @@ static bool global_dirty_log = false;
 static QTAILQ_HEAD(, MemoryListener) memory_listeners
     = QTAILQ_HEAD_INITIALIZER(memory_listeners);
 
+/*
+ * memory_listeners is changed with both the BQL and this lock held, so
+ * that memory_region_clear_dirty_bitmap() can walk it from the migration
+ * thread without the BQL.
+ */
+static QemuMutex memory_listeners_lock;
+
+static void __attribute__((__constructor__)) memory_listeners_lock_init(void)
+{
+    qemu_mutex_init(&memory_listeners_lock);
+}
+
 static QTAILQ_HEAD(, AddressSpace) address_spaces
     = QTAILQ_HEAD_INITIALIZER(address_spaces);
 
@@ -317,6 +329,27 @@ static bool can_merge(FlatRange *r1, FlatRange *r2)
         && r1->nonvolatile == r2->nonvolatile;
 }
 
+/* Like flatrange_equal, but also compare the dirty logging mask.  Every
+ * attribute that listeners see must be compared, because a reused view
+ * produces no region_add/region_del for its ranges.
+ */
+static bool flatview_equal(FlatView *a, FlatView *b)
+{
+    unsigned i;
+
+    if (a->nr != b->nr) {
+        return false;
+    }
+    for (i = 0; i < a->nr; i++) {
+        if (!flatrange_equal(&a->ranges[i], &b->ranges[i])
+            || a->ranges[i].dirty_log_mask != b->ranges[i].dirty_log_mask
+            || a->ranges[i].nonvolatile != b->ranges[i].nonvolatile) {
+            return false;
+        }
+    }
+    return true;
+}
+
 /* Attempt to simplify a view by merging adjacent ranges */
 static void flatview_simplify(FlatView *view)
 {
@@ -724,8 +757,12 @@ static MemoryRegion *memory_region_get_flatview_root(MemoryRegion *mr)
     return NULL;
 }
 
-/* Render a memory topology into a list of disjoint absolute ranges. */
-static FlatView *generate_memory_topology(MemoryRegion *mr)
+/* Render a memory topology into a list of disjoint absolute ranges.
+ * If the result is the same as OLD_VIEW, the previous rendering of MR,
+ * return OLD_VIEW instead so that its dispatch tree need not be rebuilt.
+ */
+static FlatView *generate_memory_topology(MemoryRegion *mr,
+                                          FlatView *old_view)
 {
     int i;
     FlatView *view;
@@ -739,6 +776,15 @@ static FlatView *generate_memory_topology(MemoryRegion *mr)
     }
     flatview_simplify(view);
 
+    if (old_view && flatview_equal(old_view, view)) {
+        /* Never published, so there is no need to wait for RCU */
+        flatview_destroy(view);
+        trace_flatview_reuse(old_view, mr);
+        flatview_ref(old_view);
+        g_hash_table_replace(flat_views, mr, old_view);
+        return old_view;
+    }
+
     view->dispatch = address_space_dispatch_new(view);
     for (i = 0; i < view->nr; i++) {
         MemoryRegionSection mrs =
@@ -975,7 +1021,7 @@ static void flatviews_init(void)
     flat_views = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
                                        (GDestroyNotify) flatview_unref);
     if (!empty_view) {
-        empty_view = generate_memory_topology(NULL);
+        empty_view = generate_memory_topology(NULL, NULL);
         /* We keep it alive forever in the global variable.  */
         flatview_ref(empty_view);
     } else {
@@ -986,23 +1032,32 @@ static void flatviews_init(void)
 
 static void flatviews_reset(void)
 {
+    GHashTable *old_views = flat_views;
     AddressSpace *as;
 
-    if (flat_views) {
-        g_hash_table_unref(flat_views);
-        flat_views = NULL;
-    }
+    /* Keep the previous views until the new ones are rendered, so that
+     * the unchanged ones can be reused.
+     */
+    flat_views = NULL;
     flatviews_init();
 
     /* Render unique FVs */
     QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
         MemoryRegion *physmr = memory_region_get_flatview_root(as->root);
+        FlatView *old_view = NULL;
 
         if (g_hash_table_lookup(flat_views, physmr)) {
             continue;
         }
 
-        generate_memory_topology(physmr);
+        if (old_views) {
+            old_view = g_hash_table_lookup(old_views, physmr);
+        }
+        generate_memory_topology(physmr, old_view);
+    }
+
+    if (old_views) {
+        g_hash_table_unref(old_views);
     }
 }
 
@@ -1015,6 +1070,13 @@ static void address_space_set_flatview(AddressSpace *as)
     assert(new_view);
 
     if (old_view == new_view) {
+        /* The view was reused; listeners that rebuild their state on
+         * every transaction still need to see all of its sections.
+         */
+        if (!QTAILQ_EMPTY(&as->listeners)) {
+            address_space_update_topology_pass(as, old_view, new_view, false);
+            address_space_update_topology_pass(as, old_view, new_view, true);
+        }
         return;
     }
 
@@ -1057,7 +1119,7 @@ static void address_space_update_topology(AddressSpace *as)
 
     flatviews_init();
     if (!g_hash_table_lookup(flat_views, physmr)) {
-        generate_memory_topology(physmr);
+        generate_memory_topology(physmr, NULL);
     }
     address_space_set_flatview(as);
 }
@@ -2052,6 +2114,11 @@ static void memory_region_sync_dirty_bitmap(MemoryRegion *mr)
      * address space once.
      */
     QTAILQ_FOREACH(listener, &memory_listeners, link) {
+        if (listener->log_sync_global) {
+            /* Cannot be limited to @mr, sync everything */
+            listener->log_sync_global(listener);
+            continue;
+        }
         if (!listener->log_sync) {
             continue;
         }
@@ -2067,15 +2134,60 @@ static void memory_region_sync_dirty_bitmap(MemoryRegion *mr)
     }
 }
 
+void memory_region_clear_dirty_bitmap(MemoryRegion *mr, hwaddr start,
+                                      hwaddr len)
+{
+    MemoryRegionSection mrs;
+    MemoryListener *listener;
+    AddressSpace *as;
+    FlatView *view;
+    FlatRange *fr;
+    hwaddr sec_start, sec_end;
+
+    qemu_mutex_lock(&memory_listeners_lock);
+    QTAILQ_FOREACH(listener, &memory_listeners, link) {
+        if (!listener->log_clear) {
+            continue;
+        }
+        as = listener->address_space;
+        view = address_space_get_flatview(as);
+        FOR_EACH_FLAT_RANGE(fr, view) {
+            if (!fr->dirty_log_mask || fr->mr != mr) {
+                continue;
+            }
+
+            /* Clip the section to the range being cleared */
+            mrs = section_from_flat_range(fr, view);
+            sec_start = MAX(mrs.offset_within_region, start);
+            sec_end = mrs.offset_within_region + int128_get64(mrs.size);
+            sec_end = MIN(sec_end, start + len);
+            if (sec_start >= sec_end) {
+                continue;
+            }
+            mrs.offset_within_address_space +=
+                sec_start - mrs.offset_within_region;
+            mrs.offset_within_region = sec_start;
+            mrs.size = int128_make64(sec_end - sec_start);
+            listener->log_clear(listener, &mrs);
+        }
+        flatview_unref(view);
+    }
+    qemu_mutex_unlock(&memory_listeners_lock);
+}
+
 DirtyBitmapSnapshot *memory_region_snapshot_and_clear_dirty(MemoryRegion *mr,
                                                             hwaddr addr,
                                                             hwaddr size,
                                                             unsigned client)
 {
+    DirtyBitmapSnapshot *snap;
+
     assert(mr->ram_block);
     memory_region_sync_dirty_bitmap(mr);
-    return cpu_physical_memory_snapshot_and_clear_dirty(
+    snap = cpu_physical_memory_snapshot_and_clear_dirty(
                 memory_region_get_ram_addr(mr) + addr, size, client);
+    memory_region_clear_dirty_bitmap(mr, addr, size);
+    return snap;
 }
 
 bool memory_region_snapshot_get_dirty(MemoryRegion *mr, DirtyBitmapSnapshot *snap,
@@ -2122,6 +2234,7 @@ void memory_region_reset_dirty(MemoryRegion *mr, hwaddr addr,
     assert(mr->ram_block);
     cpu_physical_memory_test_and_clear_dirty(
         memory_region_get_ram_addr(mr) + addr, size, client);
+    memory_region_clear_dirty_bitmap(mr, addr, size);
 }
 
 int memory_region_get_fd(MemoryRegion *mr)
@@ -2686,6 +2799,7 @@ void memory_listener_register(MemoryListener *listener, AddressSpace *as)
 {
     MemoryListener *other = NULL;
 
+    qemu_mutex_lock(&memory_listeners_lock);
     listener->address_space = as;
     if (QTAILQ_EMPTY(&memory_listeners)
         || listener->priority >= QTAILQ_LAST(&memory_listeners)->priority) {
@@ -2698,6 +2812,7 @@ void memory_listener_register(MemoryListener *listener, AddressSpace *as)
         }
         QTAILQ_INSERT_BEFORE(other, listener, link);
     }
+    qemu_mutex_unlock(&memory_listeners_lock);
 
     if (QTAILQ_EMPTY(&as->listeners)
         || listener->priority >= QTAILQ_LAST(&as->listeners)->priority) {
@@ -2721,9 +2836,11 @@ void memory_listener_unregister(MemoryListener *listener)
     }
 
     listener_del_address_space(listener, listener->address_space);
+    qemu_mutex_lock(&memory_listeners_lock);
     QTAILQ_REMOVE(&memory_listeners, listener, link);
     QTAILQ_REMOVE(&listener->address_space->listeners, listener, link_as);
     listener->address_space = NULL;
+    qemu_mutex_unlock(&memory_listeners_lock);
 }
 
 void address_space_init(AddressSpace *as, MemoryRegion *root, const char *name)
@@ -2735,6 +2852,10 @@ void address_space_init(AddressSpace *as, MemoryRegion *root, const char *name)
     as->ioeventfds = NULL;
     QTAILQ_INIT(&as->listeners);
     QTAILQ_INSERT_TAIL(&address_spaces, as, address_spaces_link);
+    as->max_bounce_buffer_size = DEFAULT_MAX_BOUNCE_BUFFER_SIZE;
+    as->bounce_buffer_size = 0;
+    qemu_mutex_init(&as->map_client_list_lock);
+    QLIST_INIT(&as->map_client_list);
     as->name = g_strdup(name ? name : "anonymous");
     address_space_update_topology(as);
     address_space_update_ioeventfds(as);
@@ -2742,6 +2863,9 @@ void address_space_init(AddressSpace *as, MemoryRegion *root, const char *name)
 
 static void do_address_space_destroy(AddressSpace *as)
 {
+    assert(atomic_read(&as->bounce_buffer_size) == 0);
+    assert(QLIST_EMPTY(&as->map_client_list));
+    qemu_mutex_destroy(&as->map_client_list_lock);
     assert(QTAILQ_EMPTY(&as->listeners));
 
     flatview_unref(as->current_map);
@@ -1564,6 +1564,23 @@ static inline bool migration_bitmap_clear_dirty(RAMState *rs,
 {
     bool ret;
 
+    /*
+     * Re-arm dirty logging for the whole chunk before sending any of its
+     * pages, so that writes done after this point are caught by the next
+     * sync.  Doing it earlier would not be a problem, doing it later
+     * would.  Chunking keeps the cost of the first write to a page, which
+     * faults once logging is re-armed, away from pages that are not about
+     * to be sent.
+     */
+    if (rb->clear_bmap && clear_bmap_test_and_clear(rb, page)) {
+        uint8_t shift = rb->clear_bmap_shift;
+        hwaddr size = 1ULL << (TARGET_PAGE_BITS + shift);
+        hwaddr start = ((ram_addr_t)page << TARGET_PAGE_BITS) & -size;
+
+        trace_migration_bitmap_clear_dirty(rb->idstr, start, size, page);
+        memory_region_clear_dirty_bitmap(rb->mr, start, size);
+    }
+
     ret = test_and_clear_bit(page, rb->bmap);
 
     if (ret) {
@@ -1578,6 +1595,11 @@ static void migration_bitmap_sync_range(RAMState *rs, RAMBlock *rb,
     rs->migration_dirty_pages +=
         cpu_physical_memory_sync_dirty_bitmap(rb, start, length,
                                               &rs->num_dirty_pages_period);
+    if (rb->clear_bmap && length) {
+        /* Postpone re-arming dirty logging until the pages are sent */
+        clear_bmap_set(rb, start >> TARGET_PAGE_BITS,
+                       length >> TARGET_PAGE_BITS);
+    }
 }
 
 /**
@@ -2548,6 +2570,8 @@ static void ram_save_cleanup(void *opaque)
     memory_global_dirty_log_stop();
 
     RAMBLOCK_FOREACH_MIGRATABLE(block) {
+        g_free(block->clear_bmap);
+        block->clear_bmap = NULL;
         g_free(block->bmap);
         block->bmap = NULL;
         g_free(block->unsentmap);
@@ -3055,6 +3079,13 @@ static int ram_state_init(RAMState **rsp)
     return 0;
 }
 
+/*
+ * Dirty logging is re-armed in the accelerator in chunks of
+ * 2^CLEAR_BITMAP_SHIFT target pages (1 GiB with 4 KiB pages), just before
+ * the first page of the chunk is sent.
+ */
+#define CLEAR_BITMAP_SHIFT 18
+
 static void ram_list_init_bitmaps(void)
 {
     RAMBlock *block;
@@ -3066,6 +3097,9 @@ static void ram_list_init_bitmaps(void)
             pages = block->max_length >> TARGET_PAGE_BITS;
             block->bmap = bitmap_new(pages);
             bitmap_set(block->bmap, 0, pages);
+            block->clear_bmap_shift = CLEAR_BITMAP_SHIFT;
+            block->clear_bmap = bitmap_new(clear_bmap_size(pages,
+                                                           CLEAR_BITMAP_SHIFT));
             if (migrate_postcopy_ram()) {
                 block->unsentmap = bitmap_new(pages);
                 bitmap_set(block->unsentmap, 0, pages);
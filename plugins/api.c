@@ -0,0 +1,173 @@
+/*
+ * QEMU Plugin API
+ *
+ * This provides the API that is available to the plugins to interact
+ * with QEMU.  The functions are exported to plugins through
+ * plugins/qemu-plugins.symbols; keep the two in sync.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/plugin.h"
+#include "plugin.h"
+
+void qemu_plugin_register_atexit_cb(qemu_plugin_id_t id,
+                                    qemu_plugin_udata_cb_t cb,
+                                    void *userdata)
+{
+    struct qemu_plugin_ctx *ctx = plugin_id_to_ctx(id);
+
+    g_assert(ctx->installing);
+    ctx->atexit_cb = cb;
+    ctx->atexit_userp = userdata;
+}
+
+void qemu_plugin_register_vcpu_tb_trans_cb(qemu_plugin_id_t id,
+                                           qemu_plugin_vcpu_tb_trans_cb_t cb)
+{
+    struct qemu_plugin_ctx *ctx = plugin_id_to_ctx(id);
+
+    g_assert(ctx->installing);
+    ctx->tb_trans_cb = cb;
+}
+
+/*
+ * Execution-time callbacks, registered from a translation callback
+ */
+
+static void plugin_register_dyn_cb__udata(GArray *arr,
+                                          qemu_plugin_vcpu_udata_cb_t cb,
+                                          void *userdata)
+{
+    struct qemu_plugin_dyn_cb dyn_cb = {
+        .type = PLUGIN_CB_REGULAR,
+        .userp = userdata,
+        .f.vcpu_udata = cb,
+    };
+
+    g_array_append_val(arr, dyn_cb);
+}
+
+static void plugin_register_inline_op(GArray *arr, enum qemu_plugin_mem_rw rw,
+                                      enum qemu_plugin_op op, void *ptr,
+                                      uint64_t imm)
+{
+    struct qemu_plugin_dyn_cb dyn_cb = {
+        .type = PLUGIN_CB_INLINE,
+        .rw = rw,
+        .userp = ptr,
+        .inline_insn.op = op,
+        .inline_insn.imm = imm,
+    };
+
+    g_array_append_val(arr, dyn_cb);
+}
+
+void qemu_plugin_register_vcpu_tb_exec_cb(struct qemu_plugin_tb *tb,
+                                          qemu_plugin_vcpu_udata_cb_t cb,
+                                          void *userdata)
+{
+    plugin_register_dyn_cb__udata(tb->exec_cbs, cb, userdata);
+}
+
+void qemu_plugin_register_vcpu_tb_exec_inline(struct qemu_plugin_tb *tb,
+                                              enum qemu_plugin_op op,
+                                              void *ptr, uint64_t imm)
+{
+    plugin_register_inline_op(tb->exec_cbs, 0, op, ptr, imm);
+}
+
+void qemu_plugin_register_vcpu_insn_exec_cb(struct qemu_plugin_insn *insn,
+                                            qemu_plugin_vcpu_udata_cb_t cb,
+                                            void *userdata)
+{
+    plugin_register_dyn_cb__udata(insn->exec_cbs, cb, userdata);
+}
+
+void qemu_plugin_register_vcpu_insn_exec_inline(struct qemu_plugin_insn *insn,
+                                                enum qemu_plugin_op op,
+                                                void *ptr, uint64_t imm)
+{
+    plugin_register_inline_op(insn->exec_cbs, 0, op, ptr, imm);
+}
+
+void qemu_plugin_register_vcpu_mem_cb(struct qemu_plugin_insn *insn,
+                                      qemu_plugin_vcpu_mem_cb_t cb,
+                                      enum qemu_plugin_mem_rw rw,
+                                      void *userdata)
+{
+    struct qemu_plugin_dyn_cb dyn_cb = {
+        .type = PLUGIN_CB_REGULAR,
+        .rw = rw,
+        .userp = userdata,
+        .f.vcpu_mem = cb,
+    };
+
+    g_array_append_val(insn->mem_cbs, dyn_cb);
+}
+
+void qemu_plugin_register_vcpu_mem_inline(struct qemu_plugin_insn *insn,
+                                          enum qemu_plugin_mem_rw rw,
+                                          enum qemu_plugin_op op, void *ptr,
+                                          uint64_t imm)
+{
+    plugin_register_inline_op(insn->mem_cbs, rw, op, ptr, imm);
+}
+
+/*
+ * Translation block and instruction information
+ */
+
+size_t qemu_plugin_tb_n_insns(const struct qemu_plugin_tb *tb)
+{
+    return tb->n;
+}
+
+uint64_t qemu_plugin_tb_vaddr(const struct qemu_plugin_tb *tb)
+{
+    return tb->vaddr;
+}
+
+struct qemu_plugin_insn *
+qemu_plugin_tb_get_insn(const struct qemu_plugin_tb *tb, size_t idx)
+{
+    if (unlikely(idx >= tb->n)) {
+        return NULL;
+    }
+    return g_ptr_array_index(tb->insns, idx);
+}
+
+uint64_t qemu_plugin_insn_vaddr(const struct qemu_plugin_insn *insn)
+{
+    return insn->vaddr;
+}
+
+size_t qemu_plugin_insn_size(const struct qemu_plugin_insn *insn)
+{
+    return insn->size;
+}
+
+/*
+ * Memory access information
+ */
+
+unsigned int qemu_plugin_mem_size_shift(qemu_plugin_meminfo_t info)
+{
+    return info & QEMU_PLUGIN_MEMINFO_SHIFT_MASK;
+}
+
+bool qemu_plugin_mem_is_sign_extended(qemu_plugin_meminfo_t info)
+{
+    return !!(info & QEMU_PLUGIN_MEMINFO_SIGN);
+}
+
+bool qemu_plugin_mem_is_big_endian(qemu_plugin_meminfo_t info)
+{
+    return !!(info & QEMU_PLUGIN_MEMINFO_BE);
+}
+
+bool qemu_plugin_mem_is_store(qemu_plugin_meminfo_t info)
+{
+    return !!(info & QEMU_PLUGIN_MEMINFO_STORE);
+}
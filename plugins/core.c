@@ -0,0 +1,67 @@
+/*
+ * QEMU Plugin Core code
+ *
+ * This is the core code that deals with the lifetime of plugins and
+ * with the dispatch of translation-time callbacks.  The code that
+ * instruments the generated code lives in accel/tcg/plugin-gen.c.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/plugin.h"
+#include "plugin.h"
+
+struct qemu_plugin_state plugin = {
+    .ctxs = QTAILQ_HEAD_INITIALIZER(plugin.ctxs),
+};
+
+struct qemu_plugin_ctx *plugin_id_to_ctx(qemu_plugin_id_t id)
+{
+    struct qemu_plugin_ctx *ctx;
+
+    QTAILQ_FOREACH(ctx, &plugin.ctxs, entry) {
+        if (ctx->id == id) {
+            return ctx;
+        }
+    }
+    error_report("invalid plugin id %" PRIu64, id);
+    abort();
+}
+
+bool qemu_plugin_tb_trans_enabled(void)
+{
+    return plugin.tb_trans_enabled;
+}
+
+void qemu_plugin_tb_trans_cb(struct qemu_plugin_tb *tb)
+{
+    struct qemu_plugin_ctx *ctx;
+
+    QTAILQ_FOREACH(ctx, &plugin.ctxs, entry) {
+        if (ctx->tb_trans_cb) {
+            ctx->tb_trans_cb(ctx->id, tb);
+        }
+    }
+}
+
+static void plugin_atexit(void)
+{
+    struct qemu_plugin_ctx *ctx;
+
+    QTAILQ_FOREACH(ctx, &plugin.ctxs, entry) {
+        if (ctx->atexit_cb) {
+            ctx->atexit_cb(ctx->id, ctx->atexit_userp);
+        }
+    }
+}
+
+void plugin_register_atexit(void)
+{
+    static bool registered;
+
+    if (!registered) {
+        atexit(plugin_atexit);
+        registered = true;
+    }
+}
@@ -0,0 +1,185 @@
+/*
+ * QEMU Plugin Loader
+ *
+ * Parses the -plugin command line option and loads the requested
+ * plugins.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/plugin.h"
+#include "cpu.h"
+#include "plugin.h"
+
+QemuOptsList qemu_plugin_opts = {
+    .name = "plugin",
+    .implied_opt_name = "file",
+    .head = QTAILQ_HEAD_INITIALIZER(qemu_plugin_opts.head),
+    .desc = {
+        /* do our own parsing to support multiple "arg" */
+        { /* end of list */ }
+    },
+};
+
+typedef int (*qemu_plugin_install_func_t)(qemu_plugin_id_t,
+                                          const qemu_info_t *, int, char **);
+
+struct qemu_plugin_parse_arg {
+    QemuPluginList *head;
+    struct qemu_plugin_desc *curr;
+};
+
+static int plugin_add(void *opaque, const char *name, const char *value,
+                      Error **errp)
+{
+    struct qemu_plugin_parse_arg *arg = opaque;
+    struct qemu_plugin_desc *p;
+
+    if (strcmp(name, "file") == 0) {
+        if (!strcmp(value, "")) {
+            error_setg(errp, "requires a non-empty argument");
+            return 1;
+        }
+        p = g_new0(struct qemu_plugin_desc, 1);
+        p->path = g_strdup(value);
+        QTAILQ_INSERT_TAIL(arg->head, p, entry);
+        arg->curr = p;
+    } else if (strcmp(name, "arg") == 0) {
+        if (arg->curr == NULL) {
+            error_setg(errp, "missing earlier 'file=' parameter");
+            return 1;
+        }
+        p = arg->curr;
+        p->argc++;
+        p->argv = g_realloc_n(p->argv, p->argc, sizeof(char *));
+        p->argv[p->argc - 1] = g_strdup(value);
+    } else {
+        error_setg(errp, "unexpected parameter '%s'", name);
+        return 1;
+    }
+    return 0;
+}
+
+void qemu_plugin_opt_parse(const char *optarg, QemuPluginList *head)
+{
+    struct qemu_plugin_parse_arg arg;
+    QemuOpts *opts;
+
+    opts = qemu_opts_parse_noisily(&qemu_plugin_opts, optarg, true);
+    if (opts == NULL) {
+        exit(1);
+    }
+    arg.head = head;
+    arg.curr = NULL;
+    qemu_opt_foreach(opts, plugin_add, &arg, &error_fatal);
+    qemu_opts_del(opts);
+}
+
+static void plugin_desc_free(struct qemu_plugin_desc *desc)
+{
+    int i;
+
+    for (i = 0; i < desc->argc; i++) {
+        g_free(desc->argv[i]);
+    }
+    g_free(desc->argv);
+    g_free(desc->path);
+    g_free(desc);
+}
+
+static int plugin_load(struct qemu_plugin_desc *desc, const qemu_info_t *info)
+{
+    qemu_plugin_install_func_t install;
+    struct qemu_plugin_ctx *ctx;
+    gpointer sym;
+    int version;
+    int rc;
+
+    ctx = g_new0(struct qemu_plugin_ctx, 1);
+    ctx->handle = g_module_open(desc->path, G_MODULE_BIND_LOCAL);
+    if (ctx->handle == NULL) {
+        error_report("Could not load plugin %s: %s", desc->path,
+                     g_module_error());
+        goto err_dlopen;
+    }
+
+    if (!g_module_symbol(ctx->handle, "qemu_plugin_install", &sym)) {
+        error_report("Could not load plugin %s: %s", desc->path,
+                     g_module_error());
+        goto err_symbol;
+    }
+    install = (qemu_plugin_install_func_t) sym;
+
+    if (!g_module_symbol(ctx->handle, "qemu_plugin_version", &sym)) {
+        error_report("Plugin %s does not declare its API version",
+                     desc->path);
+        goto err_symbol;
+    }
+    version = *(int *)sym;
+    if (version < QEMU_PLUGIN_MIN_VERSION || version > QEMU_PLUGIN_VERSION) {
+        error_report("Plugin %s uses API version %d, but this QEMU "
+                     "supports versions %d to %d", desc->path, version,
+                     QEMU_PLUGIN_MIN_VERSION, QEMU_PLUGIN_VERSION);
+        goto err_symbol;
+    }
+
+    ctx->id = plugin.next_id++;
+    QTAILQ_INSERT_TAIL(&plugin.ctxs, ctx, entry);
+    ctx->installing = true;
+    rc = install(ctx->id, info, desc->argc, desc->argv);
+    ctx->installing = false;
+    if (rc) {
+        error_report("Plugin %s returned error code %d", desc->path, rc);
+        QTAILQ_REMOVE(&plugin.ctxs, ctx, entry);
+        goto err_symbol;
+    }
+    if (ctx->tb_trans_cb) {
+        plugin.tb_trans_enabled = true;
+    }
+    plugin_register_atexit();
+    return 0;
+
+ err_symbol:
+    g_module_close(ctx->handle);
+ err_dlopen:
+    g_free(ctx);
+    return 1;
+}
+
+/*
+ * Load the plugins in @head, removing them from the list.  Must be
+ * called before any vCPU starts executing guest code.
+ */
+int qemu_plugin_load_list(QemuPluginList *head)
+{
+    struct qemu_plugin_desc *desc, *next;
+    qemu_info_t info = {
+        .target_name = TARGET_NAME,
+        .version.min = QEMU_PLUGIN_MIN_VERSION,
+        .version.cur = QEMU_PLUGIN_VERSION,
+#ifdef CONFIG_USER_ONLY
+        .system_emulation = false,
+#else
+        .system_emulation = true,
+#endif
+    };
+
+    if (!QTAILQ_EMPTY(head) && !g_module_supported()) {
+        error_report("Plugins are not supported on this host");
+        return 1;
+    }
+
+    QTAILQ_FOREACH_SAFE(desc, head, entry, next) {
+        int err;
+
+        err = plugin_load(desc, &info);
+        if (err) {
+            return err;
+        }
+        QTAILQ_REMOVE(head, desc, entry);
+        plugin_desc_free(desc);
+    }
+    return 0;
+}
@@ -0,0 +1,41 @@
+/*
+ * Plugin Shared Internal Functions
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#ifndef PLUGIN_INTERNAL_H
+#define PLUGIN_INTERNAL_H
+
+#include <gmodule.h>
+
+/* A loaded plugin */
+struct qemu_plugin_ctx {
+    GModule *handle;
+    qemu_plugin_id_t id;
+    qemu_plugin_vcpu_tb_trans_cb_t tb_trans_cb;
+    qemu_plugin_udata_cb_t atexit_cb;
+    void *atexit_userp;
+    QTAILQ_ENTRY(qemu_plugin_ctx) entry;
+    /* set while qemu_plugin_install() runs */
+    bool installing;
+};
+
+/*
+ * Plugins are loaded, and register their translation and atexit
+ * callbacks, before any vCPU starts running.  From then on this state
+ * is only read, so it does not need a lock.
+ */
+struct qemu_plugin_state {
+    QTAILQ_HEAD(, qemu_plugin_ctx) ctxs;
+    qemu_plugin_id_t next_id;
+    bool tb_trans_enabled;
+};
+
+extern struct qemu_plugin_state plugin;
+
+struct qemu_plugin_ctx *plugin_id_to_ctx(qemu_plugin_id_t id);
+
+void plugin_register_atexit(void);
+
+#endif /* PLUGIN_INTERNAL_H */
@@ -66,6 +66,7 @@ enum {
     OPTION_SIZE = 264,
     OPTION_PREALLOCATION = 265,
     OPTION_SHRINK = 266,
+    OPTION_SERIALISE = 267,
 };
 
 typedef enum OutputFormat {
@@ -3965,6 +3966,7 @@ typedef struct BenchData {
     int n;
     int flush_interval;
     bool drain_on_flush;
+    int write_flags;
     uint8_t *buf;
     QEMUIOVector *qiov;
 
@@ -4035,7 +4037,8 @@ static void bench_cb(void *opaque, int ret)
         b->offset += b->step;
         b->offset %= b->image_size;
         if (b->write) {
-            acb = blk_aio_pwritev(b->blk, offset, b->qiov, 0, bench_cb, b);
+            acb = blk_aio_pwritev(b->blk, offset, b->qiov, b->write_flags,
+                                  bench_cb, b);
         } else {
             acb = blk_aio_preadv(b->blk, offset, b->qiov, 0, bench_cb, b);
         }
@@ -4061,6 +4064,7 @@ static int img_bench(int argc, char **argv)
     size_t step = 0;
     int flush_interval = 0;
     bool drain_on_flush = true;
+    int write_flags = 0;
     int64_t image_size;
     BlockBackend *blk = NULL;
     BenchData data = {};
@@ -4078,6 +4082,7 @@ static int img_bench(int argc, char **argv)
             {"image-opts", no_argument, 0, OPTION_IMAGE_OPTS},
             {"pattern", required_argument, 0, OPTION_PATTERN},
             {"no-drain", no_argument, 0, OPTION_NO_DRAIN},
+            {"serialise", no_argument, 0, OPTION_SERIALISE},
             {"force-share", no_argument, 0, 'U'},
             {0, 0, 0, 0}
         };
@@ -4203,6 +4208,9 @@ static int img_bench(int argc, char **argv)
         case OPTION_NO_DRAIN:
             drain_on_flush = false;
             break;
+        case OPTION_SERIALISE:
+            write_flags |= BDRV_REQ_SERIALISING;
+            break;
         case OPTION_IMAGE_OPTS:
             image_opts = true;
             break;
@@ -4219,6 +4227,11 @@ static int img_bench(int argc, char **argv)
         ret = -1;
         goto out;
     }
+    if (!is_write && write_flags) {
+        error_report("--serialise is only available in write tests");
+        ret = -1;
+        goto out;
+    }
     if (flush_interval && flush_interval < depth) {
         error_report("Flush interval can't be smaller than depth");
         ret = -1;
@@ -4249,6 +4262,7 @@ static int img_bench(int argc, char **argv)
         .write          = is_write,
         .flush_interval = flush_interval,
         .drain_on_flush = drain_on_flush,
+        .write_flags    = write_flags,
     };
     printf("Sending %d %s requests, %d bytes each, %d in parallel "
            "(starting at offset %" PRId64 ", step size %d)\n",
@@ -4257,6 +4271,9 @@ static int img_bench(int argc, char **argv)
     if (flush_interval) {
         printf("Sending flush every %d requests\n", flush_interval);
     }
+    if (write_flags & BDRV_REQ_SERIALISING) {
+        printf("Requests are serialising\n");
+    }
 
     buf_size = data.nrreq * data.bufsize;
     data.buf = blk_blockalign(blk, buf_size);
@@ -35,6 +35,8 @@ DEF("machine", HAS_ARG, QEMU_OPTION_machine, \
     "                kernel_irqchip=on|off|split controls accelerated irqchip support (default=off)\n"
     "                vmport=on|off|auto controls emulation of vmport (default: auto)\n"
     "                kvm_shadow_mem=size of KVM shadow MMU in bytes\n"
+    "                kvm-dirty-ring-size=n number of entries of the KVM dirty rings (default=0, disabled)\n"
+    "                kvm-coalesced-mmio-poll-us=n period of the KVM coalesced MMIO drain thread (default=0, disabled)\n"
     "                dump-guest-core=on|off include guest memory in a core dump (default=on)\n"
     "                mem-merge=on|off controls memory merge support (default: on)\n"
     "                igd-passthru=on|off controls IGD GFX passthrough support (default=off)\n"
@@ -79,6 +81,18 @@ value based on accel. For accel=xen the default is off otherwise the default
 is on.
 @item kvm_shadow_mem=size
 Defines the size of the KVM shadow MMU.
+@item kvm-dirty-ring-size=@var{n}
+Track dirty guest memory with per-vCPU dirty rings of @var{n} entries
+instead of dirty bitmaps, when KVM supports it.  @var{n} must be a power
+of two.  The default, 0, uses dirty bitmaps.
+@item kvm-coalesced-mmio-poll-us=@var{n}
+Drain the KVM coalesced MMIO ring every @var{n} microseconds from a
+dedicated thread.  Writes to devices that do not need the global mutex,
+such as the RTC index port and the PCI configuration address port, are
+then applied without it and without waiting for a vCPU to flush the
+ring.  The thread stops polling while the ring stays empty, and resumes
+when a vCPU finds writes in it.  The default, 0, leaves the ring to the
+vCPU threads.
 @item dump-guest-core=on|off
 Include guest memory in a core dump. The default is on.
 @item mem-merge=on|off
@@ -790,7 +804,8 @@ DEF("drive", HAS_ARG, QEMU_OPTION_drive,
     "-drive [file=file][,if=type][,bus=n][,unit=m][,media=d][,index=i]\n"
     "       [,cache=writethrough|writeback|none|directsync|unsafe][,format=f]\n"
     "       [,snapshot=on|off][,rerror=ignore|stop|report]\n"
-    "       [,werror=ignore|stop|report|enospc][,id=name][,aio=threads|native]\n"
+    "       [,werror=ignore|stop|report|enospc][,id=name]\n"
+    "       [,aio=threads|native|io_uring]\n"
     "       [,readonly=on|off][,copy-on-read=on|off]\n"
     "       [,discard=ignore|unmap][,detect-zeroes=on|off|unmap]\n"
     "       [[,bps=b]|[[,bps_rd=r][,bps_wr=w]]]\n"
@@ -858,7 +873,9 @@ unsafe       │ on                off            on
 The default mode is @option{cache=writeback}.
 
 @item aio=@var{aio}
-@var{aio} is "threads", or "native" and selects between pthread based disk I/O and native Linux AIO.
+@var{aio} is "threads", "native" or "io_uring" and selects between pthread
+based disk I/O, native Linux AIO and Linux io_uring.  Unlike native AIO,
+io_uring does not require @option{cache.direct=on}.
 @item format=@var{format}
 Specify which disk @var{format} will be used rather than detecting
 the format.  Can be used to specify format=raw to avoid interpreting
@@ -3820,6 +3837,20 @@ HXCOMM HX does not support conditional compilation of text.
 @include qemu-option-trace.texi
 ETEXI
 
+DEF("plugin", HAS_ARG, QEMU_OPTION_plugin,
+    "-plugin [file=]<file>[,arg=<string>]\n"
+    "                load a TCG instrumentation plugin\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -plugin [file=]@var{file}[,arg=@var{string}]
+@findex -plugin
+
+Load a TCG instrumentation plugin from the shared object @var{file}.
+Each @option{arg} is passed to the plugin's @code{qemu_plugin_install}
+function; the option can be repeated.  Plugins are only available when
+QEMU is configured with @option{--enable-plugins}.
+ETEXI
+
 HXCOMM Internal use
 DEF("qtest", HAS_ARG, QEMU_OPTION_qtest, "", QEMU_ARCH_ALL)
 DEF("qtest-log", HAS_ARG, QEMU_OPTION_qtest_log, "", QEMU_ARCH_ALL)
@@ -3900,7 +3931,7 @@ property must be set.  These objects are placed in the
 
 @table @option
 
-@item -object memory-backend-file,id=@var{id},size=@var{size},mem-path=@var{dir},share=@var{on|off},discard-data=@var{on|off},merge=@var{on|off},dump=@var{on|off},prealloc=@var{on|off},host-nodes=@var{host-nodes},policy=@var{default|preferred|bind|interleave},align=@var{align}
+@item -object memory-backend-file,id=@var{id},size=@var{size},mem-path=@var{dir},share=@var{on|off},discard-data=@var{on|off},merge=@var{on|off},dump=@var{on|off},prealloc=@var{on|off},prealloc-async=@var{on|off},host-nodes=@var{host-nodes},policy=@var{default|preferred|bind|interleave},align=@var{align}
 
 Creates a memory file backend object, which can be used to back
 the guest RAM with huge pages.
@@ -3940,7 +3971,13 @@ memory deduplication.
 Setting the @option{dump} boolean option to @var{off} excludes the memory from
 core dumps. This feature is also known as MADV_DONTDUMP.
 
-The @option{prealloc} boolean option enables memory preallocation.
+The @option{prealloc} boolean option enables memory preallocation.  The
+preallocation threads run on the CPUs of the @option{host-nodes}, if any.
+
+If the host supports MADV_POPULATE_WRITE, the @option{prealloc-async} boolean
+option lets the rest of the machine be created while the memory is being
+preallocated.  The guest only starts once preallocation is complete; the
+read-only @option{prealloc-progress} property reports its progress in percent.
 
 The @option{host-nodes} option binds the memory range to a list of NUMA host
 nodes.
@@ -52,13 +52,11 @@ static hppa_tlb_entry *hppa_find_tlb(CPUHPPAState *env, vaddr addr)
 static void hppa_flush_tlb_ent(CPUHPPAState *env, hppa_tlb_entry *ent)
 {
     CPUState *cs = CPU(hppa_env_get_cpu(env));
-    unsigned i, n = 1 << (2 * ent->page_size);
-    uint64_t addr = ent->va_b;
+    unsigned n = 1 << (2 * ent->page_size);
 
-    for (i = 0; i < n; ++i, addr += TARGET_PAGE_SIZE) {
-        /* Do not flush MMU_PHYS_IDX.  */
-        tlb_flush_page_by_mmuidx(cs, addr, 0xf);
-    }
+    /* Do not flush MMU_PHYS_IDX.  */
+    tlb_flush_range_by_mmuidx(cs, ent->va_b, (target_ulong)n * TARGET_PAGE_SIZE,
+                              0xf);
 
     memset(ent, 0, sizeof(*ent));
     ent->va_b = -1;
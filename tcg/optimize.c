@@ -113,6 +113,27 @@ static void init_arg_info(struct tcg_temp_info *infos,
     init_ts_info(infos, temps_used, arg_temp(arg));
 }
 
+/* Forget about the temps that die at the end of a basic block, while
+   keeping what is known about globals and local temps.  This is the
+   state on the fall-through path of a conditional branch, which can
+   only be entered from the branch itself.  */
+static void reset_bb_temps(TCGContext *s, TCGTempSet *temps_used)
+{
+    int nb_temps = s->nb_temps;
+    size_t i;
+
+    for (i = find_next_bit(temps_used->l, nb_temps, s->nb_globals);
+         i < nb_temps;
+         i = find_next_bit(temps_used->l, nb_temps, i + 1)) {
+        TCGTemp *ts = &s->temps[i];
+
+        if (!ts->temp_local) {
+            reset_ts(ts);
+            clear_bit(i, temps_used->l);
+        }
+    }
+}
+
 static TCGTemp *find_better_copy(TCGContext *s, TCGTemp *ts)
 {
     TCGTemp *i;
@@ -1315,7 +1336,7 @@ void tcg_optimize(TCGContext *s)
                 /* Simplify LT/GE comparisons vs zero to a single compare
                    vs the high word of the input.  */
             do_brcond_high:
-                bitmap_zero(temps_used.l, nb_temps);
+                reset_bb_temps(s, &temps_used);
                 op->opc = INDEX_op_brcond_i32;
                 op->args[0] = op->args[1];
                 op->args[1] = op->args[3];
@@ -1341,7 +1362,7 @@ void tcg_optimize(TCGContext *s)
                     goto do_default;
                 }
             do_brcond_low:
-                bitmap_zero(temps_used.l, nb_temps);
+                reset_bb_temps(s, &temps_used);
                 op->opc = INDEX_op_brcond_i32;
                 op->args[1] = op->args[2];
                 op->args[2] = op->args[4];
@@ -1459,9 +1480,21 @@ void tcg_optimize(TCGContext *s)
                to compute the operation result) so no propagation is done.
                We trash everything if the operation is the end of a basic
                block, otherwise we only trash the output args.  "mask" is
-               the non-zero bits mask for the first output arg.  */
+               the non-zero bits mask for the first output arg.
+               Conditional branches only end the basic block for the
+               taken path; globals and local temps keep their state
+               across the fall-through, which extends the propagation
+               of constants and copies past the branch.  */
             if (def->flags & TCG_OPF_BB_END) {
-                bitmap_zero(temps_used.l, nb_temps);
+                switch (opc) {
+                CASE_OP_32_64(brcond):
+                case INDEX_op_brcond2_i32:
+                    reset_bb_temps(s, &temps_used);
+                    break;
+                default:
+                    bitmap_zero(temps_used.l, nb_temps);
+                    break;
+                }
             } else {
         do_reset_output:
                 for (i = 0; i < nb_oargs; i++) {
@@ -819,6 +819,21 @@ size_t tcg_tb_phys_invalidate_count(void)
     return total;
 }
 
+void tcg_tb_jmp_cache_l2_counts(size_t *hits, size_t *misses)
+{
+    unsigned int n_ctxs = atomic_read(&n_tcg_ctxs);
+    unsigned int i;
+
+    *hits = 0;
+    *misses = 0;
+    for (i = 0; i < n_ctxs; i++) {
+        const TCGContext *s = atomic_read(&tcg_ctxs[i]);
+
+        *hits += atomic_read(&s->tb_jmp_cache_l2_hits);
+        *misses += atomic_read(&s->tb_jmp_cache_l2_misses);
+    }
+}
+
 /* pool based memory allocation */
 void *tcg_malloc_internal(TCGContext *s, int size)
 {
@@ -2538,10 +2553,12 @@ static void liveness_pass_1(TCGContext *s)
                         arg_life |= SYNC_ARG << i;
                     }
                     ts->state = TS_DEAD;
-                    la_reset_pref(ts);
 
-                    /* Not used -- it will be tcg_target_call_oarg_regs[i].  */
-                    op->output_pref[i] = 0;
+                    /* The result is returned in tcg_target_call_oarg_regs[i],
+                       but it may be moved to a register that survives the
+                       calls that follow.  */
+                    op->output_pref[i] = *la_temp_pref(ts);
+                    la_reset_pref(ts);
                 }
 
                 if (!(call_flags & (TCG_CALL_NO_WRITE_GLOBALS |
@@ -3569,6 +3586,33 @@ static void tcg_reg_alloc_op(TCGContext *s, const TCGOp *op)
 #define STACK_DIR(x) (x)
 #endif
 
+/*
+ * Return the register that will hold the call output TS, which the helper
+ * returned in REG.  If liveness found that the value is live across later
+ * calls, its preference PREF no longer includes REG; move it to a free
+ * call-saved register from PREF now, instead of spilling it at the next
+ * call.  Never evict another temp to do so.
+ */
+static TCGReg tcg_reg_alloc_call_output(TCGContext *s, TCGTemp *ts,
+                                        TCGReg reg, TCGRegSet pref,
+                                        TCGRegSet allocated_regs)
+{
+    int i;
+
+    if (tcg_regset_test_reg(pref, reg)) {
+        return reg;
+    }
+    pref &= ~tcg_target_call_clobber_regs & ~allocated_regs;
+    for (i = 0; i < ARRAY_SIZE(tcg_target_reg_alloc_order); i++) {
+        TCGReg r = tcg_target_reg_alloc_order[i];
+        if (tcg_regset_test_reg(pref, r) && s->reg_to_temp[r] == NULL) {
+            tcg_out_mov(s, ts->type, r, reg);
+            return r;
+        }
+    }
+    return reg;
+}
+
 static void tcg_reg_alloc_call(TCGContext *s, TCGOp *op)
 {
     const int nb_oargs = TCGOP_CALLO(op);
@@ -3686,6 +3730,10 @@ static void tcg_reg_alloc_call(TCGContext *s, TCGOp *op)
             if (ts->val_type == TEMP_VAL_REG) {
                 s->reg_to_temp[ts->reg] = NULL;
             }
+            if (!IS_DEAD_ARG(i)) {
+                reg = tcg_reg_alloc_call_output(s, ts, reg, op->output_pref[i],
+                                                allocated_regs);
+            }
             ts->val_type = TEMP_VAL_REG;
             ts->reg = reg;
             ts->mem_coherent = 0;
@@ -710,6 +710,8 @@ struct TCGContext {
     void *code_gen_highwater;
 
     size_t tb_phys_invalidate_count;
+    size_t tb_jmp_cache_l2_hits;
+    size_t tb_jmp_cache_l2_misses;
 
     /* Track which vCPU triggers events */
     CPUState *cpu;                      /* *_trans */
@@ -724,6 +726,12 @@ struct TCGContext {
 
     TCGLabel *exitreq_label;
 
+#ifdef CONFIG_PLUGIN
+    /* The TB and the instruction being translated for plugins */
+    struct qemu_plugin_tb *plugin_tb;
+    struct qemu_plugin_insn *plugin_insn;
+#endif
+
     TCGTempSet free_temps[TCG_TYPE_COUNT * 2];
     TCGTemp temps[TCG_MAX_TEMPS]; /* globals first, temps after */
 
@@ -887,6 +895,7 @@ size_t tcg_code_capacity(void);
 void tcg_tb_insert(TranslationBlock *tb);
 void tcg_tb_remove(TranslationBlock *tb);
 size_t tcg_tb_phys_invalidate_count(void);
+void tcg_tb_jmp_cache_l2_counts(size_t *hits, size_t *misses);
 TranslationBlock *tcg_tb_lookup(uintptr_t tc_ptr);
 void tcg_tb_foreach(GTraverseFunc func, gpointer user_data);
 size_t tcg_nb_tbs(void);
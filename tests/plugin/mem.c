@@ -0,0 +1,68 @@
+/*
+ * Count the guest memory accesses, and histogram them by size.
+ *
+ * The total is kept with an inline counter; the histogram needs the
+ * access information and thus a callback.  Pass "arg=r", "arg=w" or
+ * "arg=rw" (the default) to select the accesses to count.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <qemu-plugin.h>
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
+
+static uint64_t mem_count;
+static uint64_t size_count[4];
+static enum qemu_plugin_mem_rw rw = QEMU_PLUGIN_MEM_RW;
+
+static void vcpu_mem(unsigned int cpu_index, qemu_plugin_meminfo_t info,
+                     uint64_t vaddr, void *udata)
+{
+    size_count[qemu_plugin_mem_size_shift(info)]++;
+}
+
+static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
+{
+    size_t n = qemu_plugin_tb_n_insns(tb);
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        struct qemu_plugin_insn *insn = qemu_plugin_tb_get_insn(tb, i);
+
+        qemu_plugin_register_vcpu_mem_inline(insn, rw,
+                                             QEMU_PLUGIN_INLINE_ADD_U64,
+                                             &mem_count, 1);
+        qemu_plugin_register_vcpu_mem_cb(insn, vcpu_mem, rw, NULL);
+    }
+}
+
+static void plugin_exit(qemu_plugin_id_t id, void *p)
+{
+    int i;
+
+    fprintf(stderr, "mem accesses: %" PRIu64 "\n", mem_count);
+    for (i = 0; i < 4; i++) {
+        fprintf(stderr, "  %2d bytes: %" PRIu64 "\n", 1 << i, size_count[i]);
+    }
+}
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id,
+                                           const qemu_info_t *info,
+                                           int argc, char **argv)
+{
+    if (argc) {
+        if (strcmp(argv[0], "r") == 0) {
+            rw = QEMU_PLUGIN_MEM_R;
+        } else if (strcmp(argv[0], "w") == 0) {
+            rw = QEMU_PLUGIN_MEM_W;
+        }
+    }
+    qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
+    qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
+    return 0;
+}
@@ -0,0 +1,97 @@
+/*
+ * Measure the per-syscall overhead of linux-user emulation
+ *
+ * Times a few cheap syscalls, some of which QEMU passes straight to
+ * the host and some of which go through the full do_syscall1() path,
+ * and prints the average cost of each.  Pass an iteration count as
+ * the only argument to override the default.
+ *
+ * This is not part of check-tcg; see "bench" in
+ * tests/tcg/multiarch/Makefile.target.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+static int pipefd[2];
+static char cwd[4096];
+
+static int bench_getppid(void)
+{
+    /* The parent may be outside our PID namespace, which reads as 0 */
+    return getppid() >= 0;
+}
+
+static int bench_sched_yield(void)
+{
+    return sched_yield() == 0;
+}
+
+static int bench_umask(void)
+{
+    return umask(022) == 022;
+}
+
+static int bench_lseek_pipe(void)
+{
+    return lseek(pipefd[0], 0, SEEK_CUR) == -1 && errno == ESPIPE;
+}
+
+static int bench_getcwd(void)
+{
+    return getcwd(cwd, sizeof(cwd)) != NULL;
+}
+
+static const struct {
+    const char *name;
+    int (*fn)(void);
+} benches[] = {
+    { "getppid", bench_getppid },
+    { "sched_yield", bench_sched_yield },
+    { "umask", bench_umask },
+    { "lseek (pipe)", bench_lseek_pipe },
+    { "getcwd", bench_getcwd },
+};
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+    long iters = argc > 1 ? atol(argv[1]) : 100000;
+    unsigned i;
+    long n;
+
+    if (iters <= 0 || pipe(pipefd) < 0) {
+        fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+    umask(022);
+
+    for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+        double start = now_ns();
+
+        for (n = 0; n < iters; n++) {
+            if (!benches[i].fn()) {
+                fprintf(stderr, "%s: unexpected result\n", benches[i].name);
+                return 1;
+            }
+        }
+        printf("%-14s %8.1f ns/call\n", benches[i].name,
+               (now_ns() - start) / iters);
+    }
+    return 0;
+}
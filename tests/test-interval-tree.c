@@ -0,0 +1,121 @@
+/*
+ * Interval tree unit tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/interval-tree.h"
+
+#define N_NODES 512
+#define SPACE   4096
+
+static IntervalTreeNode nodes[N_NODES];
+static bool in_tree[N_NODES];
+
+static bool match_odd(IntervalTreeNode *node, void *opaque)
+{
+    return (node - nodes) & 1;
+}
+
+/* The lowest-start overlapping node, the way the tree should find it */
+static IntervalTreeNode *find_slow(uint64_t start, uint64_t end, bool odd)
+{
+    IntervalTreeNode *best = NULL;
+    int i;
+
+    if (start >= end) {
+        return NULL;
+    }
+    for (i = 0; i < N_NODES; i++) {
+        IntervalTreeNode *n = &nodes[i];
+
+        if (!in_tree[i] || n->start >= n->end ||
+            n->start >= end || n->end <= start || (odd && !(i & 1))) {
+            continue;
+        }
+        if (!best || n->start < best->start ||
+            (n->start == best->start && (uintptr_t)n < (uintptr_t)best)) {
+            best = n;
+        }
+    }
+    return best;
+}
+
+static void test_empty(void)
+{
+    IntervalTreeRoot root = {};
+    IntervalTreeNode n = { .start = 10, .end = 10 };
+
+    g_assert(interval_tree_find(&root, 0, UINT64_MAX, NULL, NULL) == NULL);
+
+    interval_tree_insert(&root, &n);
+    g_assert(interval_tree_find(&root, 0, UINT64_MAX, NULL, NULL) == NULL);
+    g_assert(interval_tree_find(&root, 10, 10, NULL, NULL) == NULL);
+    interval_tree_remove(&root, &n);
+    g_assert(root.root == NULL);
+}
+
+static void test_adjacent(void)
+{
+    IntervalTreeRoot root = {};
+    IntervalTreeNode a = { .start = 0, .end = 4096 };
+    IntervalTreeNode b = { .start = 4096, .end = 8192 };
+
+    interval_tree_insert(&root, &a);
+    interval_tree_insert(&root, &b);
+    g_assert(interval_tree_find(&root, 4095, 4096, NULL, NULL) == &a);
+    g_assert(interval_tree_find(&root, 4096, 4097, NULL, NULL) == &b);
+    g_assert(interval_tree_find(&root, 0, 8192, NULL, NULL) == &a);
+    g_assert(interval_tree_find(&root, 8192, 9000, NULL, NULL) == NULL);
+    interval_tree_remove(&root, &a);
+    g_assert(interval_tree_find(&root, 0, 8192, NULL, NULL) == &b);
+    interval_tree_remove(&root, &b);
+    g_assert(root.root == NULL);
+}
+
+static void test_random(void)
+{
+    IntervalTreeRoot root = {};
+    int i, j;
+
+    for (i = 0; i < 200000; i++) {
+        int k = g_test_rand_int_range(0, N_NODES);
+        uint64_t start = g_test_rand_int_range(0, SPACE);
+        uint64_t end = start + g_test_rand_int_range(0, SPACE / 8);
+        bool odd = g_test_rand_bit();
+
+        if (in_tree[k]) {
+            interval_tree_remove(&root, &nodes[k]);
+            in_tree[k] = false;
+        } else {
+            nodes[k].start = g_test_rand_int_range(0, SPACE);
+            nodes[k].end = nodes[k].start +
+                           g_test_rand_int_range(0, SPACE / 16);
+            interval_tree_insert(&root, &nodes[k]);
+            in_tree[k] = true;
+        }
+
+        g_assert(interval_tree_find(&root, start, end,
+                                    odd ? match_odd : NULL, NULL) ==
+                 find_slow(start, end, odd));
+    }
+
+    for (j = 0; j < N_NODES; j++) {
+        if (in_tree[j]) {
+            interval_tree_remove(&root, &nodes[j]);
+            in_tree[j] = false;
+        }
+    }
+    g_assert(root.root == NULL);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/interval-tree/empty", test_empty);
+    g_test_add_func("/interval-tree/adjacent", test_adjacent);
+    g_test_add_func("/interval-tree/random", test_random);
+    return g_test_run();
+}
@@ -682,6 +682,165 @@ static void pci_hotplug(void)
     qtest_shutdown(qs);
 }
 
+static QOSState *pci_multiqueue_start(const char *file_fmt)
+{
+    QOSState *qs;
+    char *tmp_path;
+    char *file;
+    char *cmd;
+
+    tmp_path = drive_create();
+    file = g_strdup_printf(file_fmt, tmp_path);
+    cmd = g_strdup_printf("-object iothread,id=iothread0 "
+                          "-object iothread,id=iothread1 "
+                          "-drive if=none,id=drive0,file=%s,format=raw "
+                          "-device virtio-blk-pci,id=drv0,drive=drive0,"
+                          "num-queues=2,len-iothreads=2,"
+                          "iothreads[0]=iothread0,iothreads[1]=iothread1,"
+                          "addr=%x.%x", file, PCI_SLOT, PCI_FN);
+
+    qs = qtest_pc_boot("%s", cmd);
+    global_qtest = qs->qts;
+    unlink(tmp_path);
+    g_free(tmp_path);
+    g_free(file);
+    g_free(cmd);
+    return qs;
+}
+
+static void multiqueue_write_read(QVirtioDevice *dev, QGuestAllocator *alloc,
+                                  QVirtQueue *vq, uint64_t sector)
+{
+    QVirtioBlkReq req;
+    uint64_t req_addr;
+    uint32_t free_head;
+    uint8_t status;
+    char *data;
+
+    /* Write request */
+    req.type = VIRTIO_BLK_T_OUT;
+    req.ioprio = 1;
+    req.sector = sector;
+    req.data = g_malloc0(512);
+    strcpy(req.data, "TEST");
+
+    req_addr = virtio_blk_request(alloc, dev, &req, 512);
+
+    g_free(req.data);
+
+    free_head = qvirtqueue_add(vq, req_addr, 16, false, true);
+    qvirtqueue_add(vq, req_addr + 16, 512, false, true);
+    qvirtqueue_add(vq, req_addr + 528, 1, true, false);
+
+    qvirtqueue_kick(dev, vq, free_head);
+
+    qvirtio_wait_used_elem(dev, vq, free_head, NULL, QVIRTIO_BLK_TIMEOUT_US);
+    status = readb(req_addr + 528);
+    g_assert_cmpint(status, ==, 0);
+
+    guest_free(alloc, req_addr);
+
+    /* Read request */
+    req.type = VIRTIO_BLK_T_IN;
+    req.ioprio = 1;
+    req.sector = sector;
+    req.data = g_malloc0(512);
+
+    req_addr = virtio_blk_request(alloc, dev, &req, 512);
+
+    g_free(req.data);
+
+    free_head = qvirtqueue_add(vq, req_addr, 16, false, true);
+    qvirtqueue_add(vq, req_addr + 16, 512, true, true);
+    qvirtqueue_add(vq, req_addr + 528, 1, true, false);
+
+    qvirtqueue_kick(dev, vq, free_head);
+
+    qvirtio_wait_used_elem(dev, vq, free_head, NULL, QVIRTIO_BLK_TIMEOUT_US);
+    status = readb(req_addr + 528);
+    g_assert_cmpint(status, ==, 0);
+
+    data = g_malloc0(512);
+    memread(req_addr + 16, data, 512);
+    g_assert_cmpstr(data, ==, "TEST");
+    g_free(data);
+
+    guest_free(alloc, req_addr);
+}
+
+/*
+ * Start a virtio-blk device with two virtqueues in two IOThreads and
+ * submit a request on each of them.  Returns whether the BlockBackend
+ * ended up in multiqueue mode, which refuses to enable I/O throttling.
+ */
+static bool pci_multiqueue_run(const char *file_fmt)
+{
+    QVirtioPCIDevice *dev;
+    QOSState *qs;
+    QVirtQueuePCI *vqpci[2];
+    uint32_t features;
+    QDict *rsp;
+    bool multiqueue;
+    int i;
+
+    qs = pci_multiqueue_start(file_fmt);
+    dev = virtio_blk_pci_init(qs->pcibus, PCI_SLOT);
+
+    features = qvirtio_get_features(&dev->vdev);
+    features = features & ~(QVIRTIO_F_BAD_FEATURE |
+                            (1u << VIRTIO_RING_F_INDIRECT_DESC) |
+                            (1u << VIRTIO_RING_F_EVENT_IDX) |
+                            (1u << VIRTIO_BLK_F_SCSI));
+    qvirtio_set_features(&dev->vdev, features);
+
+    for (i = 0; i < 2; i++) {
+        vqpci[i] = (QVirtQueuePCI *)qvirtqueue_setup(&dev->vdev,
+                                                     qs->alloc, i);
+    }
+
+    /* Starts the dataplane, which enables multiqueue mode if it can */
+    qvirtio_set_driver_ok(&dev->vdev);
+
+    for (i = 0; i < 2; i++) {
+        multiqueue_write_read(&dev->vdev, qs->alloc, &vqpci[i]->vq, i);
+    }
+
+    rsp = qmp("{'execute': 'block_set_io_throttle',"
+              " 'arguments': {'device': 'drive0',"
+              "  'bps': 1048576, 'bps_rd': 0, 'bps_wr': 0,"
+              "  'iops': 0, 'iops_rd': 0, 'iops_wr': 0}}");
+    multiqueue = qmp_rsp_is_err(rsp);
+
+    if (multiqueue) {
+        /* The op blocker pins the graph below a multiqueue BlockBackend */
+        rsp = qmp("{'execute': 'block_resize',"
+                  " 'arguments': {'device': 'drive0', 'size': %d}}",
+                  TEST_IMAGE_SIZE * 2);
+        g_assert(qmp_rsp_is_err(rsp));
+    }
+
+    for (i = 0; i < 2; i++) {
+        qvirtqueue_cleanup(dev->vdev.bus, &vqpci[i]->vq, qs->alloc);
+    }
+    qvirtio_pci_device_disable(dev);
+    qvirtio_pci_device_free(dev);
+    qtest_shutdown(qs);
+
+    return multiqueue;
+}
+
+static void pci_multiqueue(void)
+{
+    g_assert(pci_multiqueue_run("%s"));
+}
+
+static void pci_multiqueue_unsupported(void)
+{
+    /* blkdebug does not support multiqueue, so blk_set_multiqueue() fails
+     * and the device falls back to a single IOThread */
+    g_assert(!pci_multiqueue_run("blkdebug::%s"));
+}
+
 /*
  * Check that setting the vring addr on a non-existent virtqueue does
  * not crash.
@@ -760,6 +919,9 @@ int main(int argc, char **argv)
         if (strcmp(arch, "i386") == 0 || strcmp(arch, "x86_64") == 0) {
             qtest_add_func("/virtio/blk/pci/msix", pci_msix);
             qtest_add_func("/virtio/blk/pci/idx", pci_idx);
+            qtest_add_func("/virtio/blk/pci/multiqueue", pci_multiqueue);
+            qtest_add_func("/virtio/blk/pci/multiqueue-unsupported",
+                           pci_multiqueue_unsupported);
         }
         qtest_add_func("/virtio/blk/pci/hotplug", pci_hotplug);
     } else if (strcmp(arch, "arm") == 0) {
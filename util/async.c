@@ -277,6 +277,14 @@ aio_ctx_finalize(GSource     *source)
     }
 #endif
 
+#ifdef CONFIG_LINUX_IO_URING
+    if (ctx->linux_io_uring) {
+        luring_detach_aio_context(ctx->linux_io_uring, ctx);
+        luring_cleanup(ctx->linux_io_uring);
+        ctx->linux_io_uring = NULL;
+    }
+#endif
+
     assert(QSLIST_EMPTY(&ctx->scheduled_coroutines));
     qemu_bh_delete(ctx->co_schedule_bh);
 
@@ -314,10 +322,21 @@ GSource *aio_get_g_source(AioContext *ctx)
     return &ctx->source;
 }
 
+/*
+ * The thread pool and the AIO engines are created lazily.  With multiqueue
+ * BlockBackends, an IOThread may do so for its own AioContext while the
+ * main thread opens an image in the same context; whoever loses the race
+ * throws its copy away.
+ */
 ThreadPool *aio_get_thread_pool(AioContext *ctx)
 {
-    if (!ctx->thread_pool) {
-        ctx->thread_pool = thread_pool_new(ctx);
+    ThreadPool *pool = atomic_read(&ctx->thread_pool);
+
+    if (!pool) {
+        pool = thread_pool_new(ctx);
+        if (atomic_cmpxchg(&ctx->thread_pool, NULL, pool) != NULL) {
+            thread_pool_free(pool);
+        }
     }
     return ctx->thread_pool;
 }
@@ -325,10 +344,17 @@ ThreadPool *aio_get_thread_pool(AioContext *ctx)
 #ifdef CONFIG_LINUX_AIO
 LinuxAioState *aio_setup_linux_aio(AioContext *ctx, Error **errp)
 {
-    if (!ctx->linux_aio) {
-        ctx->linux_aio = laio_init(errp);
-        if (ctx->linux_aio) {
-            laio_attach_aio_context(ctx->linux_aio, ctx);
+    LinuxAioState *s = atomic_read(&ctx->linux_aio);
+
+    if (!s) {
+        s = laio_init(errp);
+        if (!s) {
+            return NULL;
+        }
+        laio_attach_aio_context(s, ctx);
+        if (atomic_cmpxchg(&ctx->linux_aio, NULL, s) != NULL) {
+            laio_detach_aio_context(s, ctx);
+            laio_cleanup(s);
         }
     }
     return ctx->linux_aio;
@@ -341,6 +367,32 @@ LinuxAioState *aio_get_linux_aio(AioContext *ctx)
 }
 #endif
 
+#ifdef CONFIG_LINUX_IO_URING
+LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp)
+{
+    LuringState *s = atomic_read(&ctx->linux_io_uring);
+
+    if (!s) {
+        s = luring_init(errp);
+        if (!s) {
+            return NULL;
+        }
+        luring_attach_aio_context(s, ctx);
+        if (atomic_cmpxchg(&ctx->linux_io_uring, NULL, s) != NULL) {
+            luring_detach_aio_context(s, ctx);
+            luring_cleanup(s);
+        }
+    }
+    return ctx->linux_io_uring;
+}
+
+LuringState *aio_get_linux_io_uring(AioContext *ctx)
+{
+    assert(ctx->linux_io_uring);
+    return ctx->linux_io_uring;
+}
+#endif
+
 void aio_notify(AioContext *ctx)
 {
     /* Write e.g. bh->scheduled before reading ctx->notify_me.  Pairs
@@ -431,6 +483,9 @@ AioContext *aio_context_new(Error **errp)
                            event_notifier_poll);
 #ifdef CONFIG_LINUX_AIO
     ctx->linux_aio = NULL;
+#endif
+#ifdef CONFIG_LINUX_IO_URING
+    ctx->linux_io_uring = NULL;
 #endif
     ctx->thread_pool = NULL;
     qemu_rec_mutex_init(&ctx->lock);
@@ -0,0 +1,167 @@
+/*
+ * Intrusive interval tree
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/interval-tree.h"
+
+/* Nodes are ordered by start, ties are broken by address */
+static bool node_before(const IntervalTreeNode *a, const IntervalTreeNode *b)
+{
+    if (a->start != b->start) {
+        return a->start < b->start;
+    }
+    return (uintptr_t)a < (uintptr_t)b;
+}
+
+static void node_update(IntervalTreeNode *n)
+{
+    uint64_t end = n->end;
+
+    if (n->left && n->left->subtree_end > end) {
+        end = n->left->subtree_end;
+    }
+    if (n->right && n->right->subtree_end > end) {
+        end = n->right->subtree_end;
+    }
+    n->subtree_end = end;
+}
+
+static IntervalTreeNode *rotate_right(IntervalTreeNode *n)
+{
+    IntervalTreeNode *l = n->left;
+
+    n->left = l->right;
+    node_update(n);
+    l->right = n;
+    node_update(l);
+    return l;
+}
+
+static IntervalTreeNode *rotate_left(IntervalTreeNode *n)
+{
+    IntervalTreeNode *r = n->right;
+
+    n->right = r->left;
+    node_update(n);
+    r->left = n;
+    node_update(r);
+    return r;
+}
+
+static IntervalTreeNode *treap_insert(IntervalTreeNode *t,
+                                      IntervalTreeNode *node)
+{
+    if (!t) {
+        return node;
+    }
+    if (node_before(node, t)) {
+        t->left = treap_insert(t->left, node);
+        if (t->left->priority > t->priority) {
+            return rotate_right(t);
+        }
+    } else {
+        t->right = treap_insert(t->right, node);
+        if (t->right->priority > t->priority) {
+            return rotate_left(t);
+        }
+    }
+    node_update(t);
+    return t;
+}
+
+/* Join two treaps; all nodes of @a come before those of @b */
+static IntervalTreeNode *treap_merge(IntervalTreeNode *a, IntervalTreeNode *b)
+{
+    if (!a) {
+        return b;
+    }
+    if (!b) {
+        return a;
+    }
+    if (a->priority > b->priority) {
+        a->right = treap_merge(a->right, b);
+        node_update(a);
+        return a;
+    } else {
+        b->left = treap_merge(a, b->left);
+        node_update(b);
+        return b;
+    }
+}
+
+static IntervalTreeNode *treap_remove(IntervalTreeNode *t,
+                                      IntervalTreeNode *node)
+{
+    assert(t);
+    if (t == node) {
+        return treap_merge(t->left, t->right);
+    }
+    if (node_before(node, t)) {
+        t->left = treap_remove(t->left, node);
+    } else {
+        t->right = treap_remove(t->right, node);
+    }
+    node_update(t);
+    return t;
+}
+
+void interval_tree_insert(IntervalTreeRoot *root, IntervalTreeNode *node)
+{
+    uint32_t x = root->seed ?: 0x9e3779b9;
+
+    /* xorshift32 */
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    root->seed = x;
+
+    node->left = node->right = NULL;
+    node->priority = x;
+    node->subtree_end = node->end;
+    root->root = treap_insert(root->root, node);
+}
+
+void interval_tree_remove(IntervalTreeRoot *root, IntervalTreeNode *node)
+{
+    root->root = treap_remove(root->root, node);
+    node->left = node->right = NULL;
+}
+
+static IntervalTreeNode *treap_find(IntervalTreeNode *t,
+                                    uint64_t start, uint64_t end,
+                                    IntervalTreeMatchFunc *match,
+                                    void *opaque)
+{
+    IntervalTreeNode *found;
+
+    if (!t || t->subtree_end <= start) {
+        return NULL;
+    }
+    found = treap_find(t->left, start, end, match, opaque);
+    if (found) {
+        return found;
+    }
+    /* Neither @t nor anything on its right starts before @end */
+    if (t->start >= end) {
+        return NULL;
+    }
+    if (t->end > start && t->start < t->end && (!match || match(t, opaque))) {
+        return t;
+    }
+    return treap_find(t->right, start, end, match, opaque);
+}
+
+IntervalTreeNode *interval_tree_find(IntervalTreeRoot *root,
+                                     uint64_t start, uint64_t end,
+                                     IntervalTreeMatchFunc *match,
+                                     void *opaque)
+{
+    if (start >= end) {
+        return NULL;
+    }
+    return treap_find(root->root, start, end, match, opaque);
+}
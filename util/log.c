@@ -250,6 +250,8 @@ const QEMULogItem qemu_log_items[] = {
       "show micro ops after optimization" },
     { CPU_LOG_TB_OP_IND, "op_ind",
       "show micro ops before indirect lowering" },
+    { CPU_LOG_TB_SIZE, "tb_size",
+      "show guest and host code size of each compiled TB, one line per TB" },
     { CPU_LOG_INT, "int",
       "show interrupts/exceptions in short format" },
     { CPU_LOG_EXEC, "exec",
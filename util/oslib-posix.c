@@ -38,9 +38,12 @@
 #include <libgen.h>
 #include <sys/signal.h>
 #include "qemu/cutils.h"
+#include "qemu/bitops.h"
+#include "qemu/units.h"
 
 #ifdef CONFIG_LINUX
 #include <sys/syscall.h>
+#include <sched.h>
 #endif
 
 #ifdef __FreeBSD__
@@ -61,18 +64,34 @@
 
 #define MAX_MEM_PREALLOC_THREAD_COUNT 16
 
+/* Memory populated by a thread between two updates of the progress */
+#define MEM_PREALLOC_CHUNK (64 * MiB)
+
 struct MemsetThread {
     char *addr;
     size_t numpages;
     size_t hpagesize;
     QemuThread pgthread;
     sigjmp_buf env;
+    MemPreallocContext *context;
 };
 typedef struct MemsetThread MemsetThread;
 
-static MemsetThread *memset_thread;
-static int memset_num_threads;
-static bool memset_thread_failed;
+struct MemPreallocContext {
+    MemsetThread *threads;
+    int num_threads;
+    bool use_madv_populate_write;
+    bool any_thread_failed;
+    size_t numpages;
+    size_t done_pages;
+#ifdef CONFIG_LINUX
+    bool has_cpus;
+    cpu_set_t cpus;
+#endif
+};
+
+/* The preallocation whose threads the SIGBUS handler may longjmp out of */
+static MemPreallocContext *sigbus_memset_context;
 
 int qemu_get_thread_id(void)
 {
@@ -375,31 +394,47 @@ char *qemu_get_exec_dir(void)
 static void sigbus_handler(int signal)
 {
     int i;
-    if (memset_thread) {
-        for (i = 0; i < memset_num_threads; i++) {
-            if (qemu_thread_is_self(&memset_thread[i].pgthread)) {
-                siglongjmp(memset_thread[i].env, 1);
+    if (sigbus_memset_context) {
+        for (i = 0; i < sigbus_memset_context->num_threads; i++) {
+            MemsetThread *thread = &sigbus_memset_context->threads[i];
+
+            if (qemu_thread_is_self(&thread->pgthread)) {
+                siglongjmp(thread->env, 1);
             }
         }
     }
 }
 
+static void memset_thread_set_affinity(MemPreallocContext *context)
+{
+#ifdef CONFIG_LINUX
+    if (context->has_cpus) {
+        /* Best effort, e.g. a cpuset cgroup may exclude these CPUs */
+        sched_setaffinity(0, sizeof(context->cpus), &context->cpus);
+    }
+#endif
+}
+
 static void *do_touch_pages(void *arg)
 {
     MemsetThread *memset_args = (MemsetThread *)arg;
+    MemPreallocContext *context = memset_args->context;
     sigset_t set, oldset;
 
+    memset_thread_set_affinity(context);
+
     /* unblock SIGBUS */
     sigemptyset(&set);
     sigaddset(&set, SIGBUS);
     pthread_sigmask(SIG_UNBLOCK, &set, &oldset);
 
     if (sigsetjmp(memset_args->env, 1)) {
-        memset_thread_failed = true;
+        context->any_thread_failed = true;
     } else {
         char *addr = memset_args->addr;
         size_t numpages = memset_args->numpages;
         size_t hpagesize = memset_args->hpagesize;
+        size_t chunk = MAX(MEM_PREALLOC_CHUNK / hpagesize, 1);
         size_t i;
         for (i = 0; i < numpages; i++) {
             /*
@@ -416,17 +451,94 @@ static void *do_touch_pages(void *arg)
              */
             *(volatile char *)addr = *addr;
             addr += hpagesize;
+            if ((i + 1) % chunk == 0) {
+                atomic_add(&context->done_pages, chunk);
+            }
         }
+        atomic_add(&context->done_pages, numpages % chunk);
     }
     pthread_sigmask(SIG_SETMASK, &oldset, NULL);
     return NULL;
 }
 
-static inline int get_memset_num_threads(int smp_cpus)
+static void *do_madv_populate_write_pages(void *arg)
+{
+    MemsetThread *memset_args = (MemsetThread *)arg;
+    MemPreallocContext *context = memset_args->context;
+    char *addr = memset_args->addr;
+    size_t numpages = memset_args->numpages;
+    size_t hpagesize = memset_args->hpagesize;
+    size_t chunk = MAX(MEM_PREALLOC_CHUNK / hpagesize, 1);
+    size_t n;
+
+    memset_thread_set_affinity(context);
+
+    while (numpages) {
+        n = MIN(chunk, numpages);
+        if (qemu_madvise(addr, n * hpagesize, QEMU_MADV_POPULATE_WRITE)) {
+            context->any_thread_failed = true;
+            break;
+        }
+        atomic_add(&context->done_pages, n);
+        addr += n * hpagesize;
+        numpages -= n;
+    }
+    return NULL;
+}
+
+/*
+ * MADV_POPULATE_WRITE faults pages in without touching their contents
+ * and reports errors instead of raising SIGBUS.  Probe for it with the
+ * first page, which has to be populated anyway.
+ */
+static bool madv_populate_write_possible(char *area, size_t pagesize)
+{
+    return !qemu_madvise(area, pagesize, QEMU_MADV_POPULATE_WRITE) ||
+           errno != EINVAL;
+}
+
+#ifdef CONFIG_LINUX
+/* Add the CPUs of host NUMA node @node to @cpus */
+static void add_node_cpus(unsigned long node, cpu_set_t *cpus)
+{
+    char *path, *contents;
+    const char *p;
+    unsigned long first, last;
+
+    path = g_strdup_printf("/sys/devices/system/node/node%lu/cpulist", node);
+    if (g_file_get_contents(path, &contents, NULL, NULL)) {
+        /* e.g. "0-7,16-23\n" */
+        p = contents;
+        while (qemu_strtoul(p, &p, 10, &first) == 0) {
+            last = first;
+            if (*p == '-' && qemu_strtoul(p + 1, &p, 10, &last) < 0) {
+                break;
+            }
+            for (; first <= last && first < CPU_SETSIZE; first++) {
+                CPU_SET(first, cpus);
+            }
+            if (*p != ',') {
+                break;
+            }
+            p++;
+        }
+        g_free(contents);
+    }
+    g_free(path);
+}
+#endif
+
+static inline int get_memset_num_threads(MemPreallocContext *context,
+                                         int smp_cpus)
 {
     long host_procs = sysconf(_SC_NPROCESSORS_ONLN);
     int ret = 1;
 
+#ifdef CONFIG_LINUX
+    if (context->has_cpus) {
+        host_procs = CPU_COUNT(&context->cpus);
+    }
+#endif
     if (host_procs > 0) {
         ret = MIN(MIN(host_procs, MAX_MEM_PREALLOC_THREAD_COUNT), smp_cpus);
     }
@@ -434,70 +546,155 @@ static inline int get_memset_num_threads(int smp_cpus)
     return ret;
 }
 
-static bool touch_all_pages(char *area, size_t hpagesize, size_t numpages,
-                            int smp_cpus)
+static MemPreallocContext *memset_context_new(size_t numpages, int smp_cpus,
+                                              const unsigned long *host_nodes,
+                                              unsigned long maxnode)
 {
+    MemPreallocContext *context = g_new0(MemPreallocContext, 1);
+
+#ifdef CONFIG_LINUX
+    if (maxnode) {
+        unsigned long node;
+
+        CPU_ZERO(&context->cpus);
+        for (node = find_first_bit(host_nodes, maxnode); node < maxnode;
+             node = find_next_bit(host_nodes, maxnode, node + 1)) {
+            add_node_cpus(node, &context->cpus);
+        }
+        context->has_cpus = CPU_COUNT(&context->cpus) > 0;
+    }
+#endif
+    context->numpages = numpages;
+    context->num_threads = get_memset_num_threads(context, smp_cpus);
+    context->threads = g_new0(MemsetThread, context->num_threads);
+    return context;
+}
+
+static void memset_context_start(MemPreallocContext *context, char *area,
+                                 size_t hpagesize)
+{
+    size_t numpages = context->numpages;
     size_t numpages_per_thread;
     size_t size_per_thread;
     char *addr = area;
     int i = 0;
 
-    memset_thread_failed = false;
-    memset_num_threads = get_memset_num_threads(smp_cpus);
-    memset_thread = g_new0(MemsetThread, memset_num_threads);
-    numpages_per_thread = (numpages / memset_num_threads);
+    numpages_per_thread = (numpages / context->num_threads);
     size_per_thread = (hpagesize * numpages_per_thread);
-    for (i = 0; i < memset_num_threads; i++) {
-        memset_thread[i].addr = addr;
-        memset_thread[i].numpages = (i == (memset_num_threads - 1)) ?
-                                    numpages : numpages_per_thread;
-        memset_thread[i].hpagesize = hpagesize;
-        qemu_thread_create(&memset_thread[i].pgthread, "touch_pages",
-                           do_touch_pages, &memset_thread[i],
-                           QEMU_THREAD_JOINABLE);
+    for (i = 0; i < context->num_threads; i++) {
+        MemsetThread *thread = &context->threads[i];
+
+        thread->addr = addr;
+        thread->numpages = (i == (context->num_threads - 1)) ?
+                           numpages : numpages_per_thread;
+        thread->hpagesize = hpagesize;
+        thread->context = context;
+        qemu_thread_create(&thread->pgthread, "touch_pages",
+                           context->use_madv_populate_write ?
+                           do_madv_populate_write_pages : do_touch_pages,
+                           thread, QEMU_THREAD_JOINABLE);
         addr += size_per_thread;
         numpages -= numpages_per_thread;
     }
-    for (i = 0; i < memset_num_threads; i++) {
-        qemu_thread_join(&memset_thread[i].pgthread);
-    }
-    g_free(memset_thread);
-    memset_thread = NULL;
+}
 
-    return memset_thread_failed;
+/* Wait for the threads of @context and free it */
+static void memset_context_join(MemPreallocContext *context, Error **errp)
+{
+    int i;
+
+    for (i = 0; i < context->num_threads; i++) {
+        qemu_thread_join(&context->threads[i].pgthread);
+    }
+    if (context->any_thread_failed) {
+        error_setg(errp, "os_mem_prealloc: Insufficient free host memory "
+            "pages available to allocate guest RAM");
+    }
+    g_free(context->threads);
+    g_free(context);
 }
 
 void os_mem_prealloc(int fd, char *area, size_t memory, int smp_cpus,
+                     const unsigned long *host_nodes, unsigned long maxnode,
                      Error **errp)
 {
     int ret;
     struct sigaction act, oldact;
     size_t hpagesize = qemu_fd_getpagesize(fd);
     size_t numpages = DIV_ROUND_UP(memory, hpagesize);
+    MemPreallocContext *context;
+    bool use_madv_populate_write;
+
+    use_madv_populate_write = madv_populate_write_possible(area, hpagesize);
+    if (!use_madv_populate_write) {
+        memset(&act, 0, sizeof(act));
+        act.sa_handler = &sigbus_handler;
+        act.sa_flags = 0;
+
+        ret = sigaction(SIGBUS, &act, &oldact);
+        if (ret) {
+            error_setg_errno(errp, errno,
+                "os_mem_prealloc: failed to install signal handler");
+            return;
+        }
+    }
 
-    memset(&act, 0, sizeof(act));
-    act.sa_handler = &sigbus_handler;
-    act.sa_flags = 0;
-
-    ret = sigaction(SIGBUS, &act, &oldact);
-    if (ret) {
-        error_setg_errno(errp, errno,
-            "os_mem_prealloc: failed to install signal handler");
-        return;
+    context = memset_context_new(numpages, smp_cpus, host_nodes, maxnode);
+    context->use_madv_populate_write = use_madv_populate_write;
+    if (!use_madv_populate_write) {
+        sigbus_memset_context = context;
     }
 
     /* touch pages simultaneously */
-    if (touch_all_pages(area, hpagesize, numpages, smp_cpus)) {
-        error_setg(errp, "os_mem_prealloc: Insufficient free host memory "
-            "pages available to allocate guest RAM");
+    memset_context_start(context, area, hpagesize);
+    memset_context_join(context, errp);
+    sigbus_memset_context = NULL;
+
+    if (!use_madv_populate_write) {
+        ret = sigaction(SIGBUS, &oldact, NULL);
+        if (ret) {
+            /* Terminate QEMU since it can't recover from error */
+            perror("os_mem_prealloc: failed to reinstall signal handler");
+            exit(1);
+        }
+    }
+}
+
+MemPreallocContext *os_mem_prealloc_async(int fd, char *area, size_t sz,
+                                          int smp_cpus,
+                                          const unsigned long *host_nodes,
+                                          unsigned long maxnode)
+{
+    size_t hpagesize = qemu_fd_getpagesize(fd);
+    MemPreallocContext *context;
+
+    /*
+     * Touching the pages writes back what was read, which could undo
+     * concurrent stores to the memory, and SIGBUS cannot be caught while
+     * the rest of QEMU keeps running.
+     */
+    if (!madv_populate_write_possible(area, hpagesize)) {
+        return NULL;
     }
 
-    ret = sigaction(SIGBUS, &oldact, NULL);
-    if (ret) {
-        /* Terminate QEMU since it can't recover from error */
-        perror("os_mem_prealloc: failed to reinstall signal handler");
-        exit(1);
+    context = memset_context_new(DIV_ROUND_UP(sz, hpagesize), smp_cpus,
+                                 host_nodes, maxnode);
+    context->use_madv_populate_write = true;
+    memset_context_start(context, area, hpagesize);
+    return context;
+}
+
+unsigned int os_mem_prealloc_progress(MemPreallocContext *context)
+{
+    if (!context->numpages) {
+        return 100;
     }
+    return atomic_read(&context->done_pages) * 100 / context->numpages;
+}
+
+void os_mem_prealloc_wait(MemPreallocContext *context, Error **errp)
+{
+    memset_context_join(context, errp);
 }
 
 
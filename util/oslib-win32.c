@@ -549,6 +549,7 @@ int getpagesize(void)
 }
 
 void os_mem_prealloc(int fd, char *area, size_t memory, int smp_cpus,
+                     const unsigned long *host_nodes, unsigned long maxnode,
                      Error **errp)
 {
     int i;
@@ -560,6 +561,24 @@ void os_mem_prealloc(int fd, char *area, size_t memory, int smp_cpus,
     }
 }
 
+MemPreallocContext *os_mem_prealloc_async(int fd, char *area, size_t sz,
+                                          int smp_cpus,
+                                          const unsigned long *host_nodes,
+                                          unsigned long maxnode)
+{
+    return NULL;
+}
+
+unsigned int os_mem_prealloc_progress(MemPreallocContext *ctx)
+{
+    g_assert_not_reached();
+}
+
+void os_mem_prealloc_wait(MemPreallocContext *ctx, Error **errp)
+{
+    g_assert_not_reached();
+}
+
 
 char *qemu_get_pid_name(pid_t pid)
 {
@@ -131,6 +131,7 @@ int main(int argc, char **argv)
 #include "qapi/qapi-commands-ui.h"
 #include "qapi/qmp/qerror.h"
 #include "sysemu/iothread.h"
+#include "qemu/plugin.h"
 
 #define MAX_VIRTIO_CONSOLES 1
 
@@ -2977,6 +2978,7 @@ int main(int argc, char **argv, char **envp)
     const char *log_mask = NULL;
     const char *log_file = NULL;
     char *trace_file = NULL;
+    QemuPluginList plugin_list = QTAILQ_HEAD_INITIALIZER(plugin_list);
     ram_addr_t maxram_size;
     uint64_t ram_slots = 0;
     FILE *vmstate_dump_file = NULL;
@@ -3802,6 +3804,9 @@ int main(int argc, char **argv, char **envp)
                 g_free(trace_file);
                 trace_file = trace_opt_parse(optarg);
                 break;
+            case QEMU_OPTION_plugin:
+                qemu_plugin_opt_parse(optarg, &plugin_list);
+                break;
             case QEMU_OPTION_readconfig:
                 {
                     int ret = qemu_read_config_file(optarg);
@@ -3957,6 +3962,10 @@ int main(int argc, char **argv, char **envp)
 
     set_memory_options(&ram_slots, &maxram_size, machine_class);
 
+    if (qemu_plugin_load_list(&plugin_list)) {
+        exit(1);
+    }
+
     os_daemonize();
     rcu_disable_atfork();
 